@@ -10,11 +10,128 @@
 
 #include "cli.h"
 #include "stdarg.h"
+#include "stdint.h"
 #include "stdio.h"
 #include "stdlib.h"
 #include "string.h"
 
 /** Private defines ---------------------------------------------------------*/
+#define NODE_NONE           (-1)                // No command node
+#define NODE_GROUP_PROMPT   "Command group"     // Prompt of a group created by a sub command
+#define BENCH_SAMPLES       256                 // Run times kept by bench for percentiles
+#define CANCEL_POLL_MS      10                  // Console is read ahead for Ctrl-C at most this often
+
+/** Private types -----------------------------------------------------------*/
+#if CLI_BUILTIN_ENABLE
+/*!@typedef DebugArgs_TypeDef
+ *          Arguments of "debug".
+ */
+typedef struct
+{
+    int On;                             //!< -e, turn on
+    int Off;                            //!< -d, turn off
+    int Level;                          //!< -l, level to set
+} DebugArgs_TypeDef;
+
+/*!@typedef SleepArgs_TypeDef
+ *          Arguments of "sleep".
+ */
+typedef struct
+{
+    float Seconds;                      //!< Time to sleep
+} SleepArgs_TypeDef;
+
+/*!@typedef TimeoutArgs_TypeDef
+ *          Arguments of "timeout".
+ */
+typedef struct
+{
+    float Seconds;                      //!< Time limit of the command
+} TimeoutArgs_TypeDef;
+
+/*!@typedef TestArgs_TypeDef
+ *          Arguments of "test".
+ */
+typedef struct
+{
+    int Int;                            //!< -i
+    char *String;                       //!< -s
+    int Bool;                           //!< --bool
+} TestArgs_TypeDef;
+
+/*!@typedef Bench_TypeDef
+ *          State of a running "bench", kept across yields of the command.
+ */
+typedef struct
+{
+    CliPlan_TypeDef *Plan;              //!< Command being measured
+    unsigned int Runs;                  //!< Runs to measure, 0 for no limit
+    unsigned int Warmup;                //!< Runs before measuring
+    float Seconds;                      //!< Time limit in s as typed
+    unsigned long long Limit;           //!< Time limit in ns, 0 for none
+    unsigned long long Begin;           //!< Time the measured runs started
+    unsigned long long Start;           //!< Time the current run started
+    unsigned int Num;                   //!< Runs measured
+    unsigned long long Min;             //!< Fastest run in ns
+    unsigned long long Max;             //!< Slowest run in ns
+    double Mean;                        //!< Running mean in ns
+    double M2;                          //!< Running sum of squared deviations
+    unsigned int Seed;                  //!< Random state of reservoir sampling
+    unsigned int Sample[BENCH_SAMPLES]; //!< Reservoir of run times in ns
+} Bench_TypeDef;
+#endif
+
+#if CLI_SESSION_ENABLE
+/*!@brief State of a console that is not running. It's swapped with the
+ *        globals of the line editor & console job while the session runs, so
+ *        the editor works on it unchanged. Pointers into CliConsoleJob or
+ *        CliConsoleRecord stay valid, they always hold the running session.
+ */
+struct CliSession
+{
+    int (*Getc)(void *arg);             //!< Input of the session, EOF for none
+    void *Arg;                          //!< Argument of Getc
+    CliOutput_TypeDef *Output;          //!< Output of the session
+    char *StringPtr;                    //!< Line buffer
+    unsigned int StringIdx;             //!< Cursor in the line
+    char KeyEscBuf[8];                  //!< Escape sequence of a special key
+    int KeyEscIdx;                      //!< Bytes in KeyEscBuf
+    char KeyEscFlag;                    //!< Inside an escape sequence
+#if CLI_SUGGEST_ENABLE
+    unsigned int SuggestLen;            //!< Length of the suggestion drawn
+#endif
+#if CLI_PASTE_ENABLE
+    unsigned int PasteFlag;             //!< Inside a bracketed paste
+    unsigned int PasteTail;             //!< Length of the text after the cursor
+    unsigned int PasteEsc;              //!< Bytes of ANSI_PASTE_END matched
+#endif
+#if CLI_STREAM_ARG_ENABLE
+    short StreamNode;                   //!< Stream command taking the payload
+    int (*StreamChunk)(int, const char *, int); //!< Payload consumer of StreamNode
+    char StreamBuf[CLI_STREAM_CHUNK_SIZE]; //!< Payload bytes not passed yet
+    unsigned int StreamLen;             //!< Bytes in StreamBuf
+    int StreamRet;                      //!< First error of the consumer
+    unsigned int StreamCheck;           //!< Line may still be the name of a stream command
+    unsigned int StreamEsc;             //!< Bytes of an escape sequence in the payload
+    char StreamEscBuf[8];               //!< Escape sequence in the payload
+#endif
+#if HISTORY_ENABLE
+    char **HistoryPtr;                  //!< History of the session
+    unsigned int HistoryQueueHead;      //!< History queue head
+    unsigned int HistoryQueueTail;      //!< History queue tail
+    unsigned int HistoryPullDepth;      //!< History pull depth
+    unsigned int HistoryMemUsage;       //!< History memory usage
+#endif
+#if CLI_CANCEL_ENABLE
+    char CancelAhead[CLI_CANCEL_AHEAD_SIZE]; //!< Input typed while the job runs
+    unsigned int CancelAheadLen;        //!< Bytes in CancelAhead
+    unsigned int CancelAheadIdx;        //!< Bytes of CancelAhead taken
+    unsigned int CancelTick;            //!< Time the input was read ahead last
+#endif
+    CliJob_TypeDef Job;                 //!< Command line job of the session
+    CliRecord_TypeDef Record;           //!< JSON record of the job
+};
+#endif
 
 /** Private function prototypes ---------------------------------------------*/
 extern void cli_sleep(int ms);
@@ -24,20 +141,157 @@ extern void cli_free(void *ptr);
 extern int cli_port_init(void);
 extern void cli_port_deinit(void);
 extern int cli_port_getc(void);
+extern int cli_port_write(int stream, const char *buf, int len);
+extern unsigned long long cli_getnanos(void);
 extern int cli_getopt(int argc, char **args, char **data_ptr, CliOption_TypeDef options[]);
+char *cli_strtoarg(char *str, int *argc, char **argv);
+static short *node_children(CliTable_TypeDef *t, int parent);
+static int node_find(const CliTable_TypeDef *t, int parent, const char *name, int len);
+static int cli_resolve(const CliTable_TypeDef *t, int argc, char **argv, int *depth);
+static CliTable_TypeDef *table_read_lock(unsigned int *idx);
+static void table_read_unlock(unsigned int idx);
+#if CLI_STREAM_ARG_ENABLE
+static int stream_detect(void);
+#endif
+#if CLI_SUGGEST_ENABLE
+extern void cli_suggest_clear(void);
+extern void cli_suggest_add(const char *line);
+extern int cli_suggest_find(const char *prefix, int len, char *buf, int size);
+extern void cli_suggest_show(void);
+static void suggest_show(void);
+#endif
+#if CLI_POOL_ENABLE && CLI_BUILTIN_ENABLE
+extern int builtin_pool(int argc, char **args);
+#endif
+#if CLI_RX_ENABLE && CLI_BUILTIN_ENABLE
+extern int builtin_rx(int argc, char **args);
+#endif
+#if CLI_TX_ENABLE
+extern void cli_tx_poll(void);
+extern void cli_tx_flush(void);
+extern int builtin_tx(int argc, char **args);
+#endif
+#if CLI_TIMER_ENABLE
+extern void cli_timer_poll(void);
+extern void cli_timer_deinit(void);
+extern int builtin_every(int argc, char **args);
+extern int builtin_after(int argc, char **args);
+extern int builtin_cancel(int argc, char **args);
+#endif
+#if CLI_PLUGIN_ENABLE
+extern void cli_plugin_init(void);
+extern void cli_plugin_poll(void);
+extern void cli_plugin_deinit(void);
+#if CLI_BUILTIN_ENABLE
+extern int builtin_plugin(int argc, char **args);
+#endif
+#endif
+#if CLI_SHM_ENABLE
+extern void cli_shm_poll(void);
+extern void cli_shm_deinit(void);
+extern int builtin_shm(int argc, char **args);
+extern int builtin_shm_open(int argc, char **args);
+extern int builtin_shm_close(int argc, char **args);
+#endif
+#if CLI_SERVER_ENABLE
+extern void cli_server_poll(void);
+extern void cli_server_deinit(void);
+extern int builtin_server(int argc, char **args);
+extern int builtin_server_open(int argc, char **args);
+extern int builtin_server_close(int argc, char **args);
+#endif
+#if CLI_MEM_ENABLE && CLI_BUILTIN_ENABLE
+extern int builtin_mem(int argc, char **args);
+extern int builtin_mem_list(int argc, char **args);
+extern int builtin_mem_log(int argc, char **args);
+#endif
+#if CLI_TRACE_ENABLE
+extern void cli_trace_begin_args(int argc, char **argv);
+#if CLI_BUILTIN_ENABLE
+extern int builtin_trace(int argc, char **args);
+extern int builtin_trace_start(int argc, char **args);
+extern int builtin_trace_stop(int argc, char **args);
+extern int builtin_trace_dump(int argc, char **args);
+#endif
+#endif
+#if CLI_RPC_ENABLE
+extern int cli_rpc_poll(void);
+extern int builtin_rpc(int argc, char **args);
+#endif
+#if CLI_XFER_ENABLE && CLI_BUILTIN_ENABLE
+extern int cli_xfer_poll(void);
+extern int builtin_xfer(int argc, char **args);
+extern int builtin_xfer_rx(int argc, char **args);
+extern int builtin_xfer_tx(int argc, char **args);
+#endif
 
 /** Variables ---------------------------------------------------------------*/
 int gCliDebugLevel = 3;             // Get debug level from Makefile
+int gCliMode = CLI_MODE_TEXT;       // Output mode
+CliOutput_TypeDef *CliOutputCur = NULL; // Output in use, NULL for the port
 char * StringPtr = NULL;            // Command String buffer pointer
 unsigned int StringIdx = 0;         // Command string index
+unsigned int CliLineEditing = 0;    // Echo is from the line editor, not a command
+char KeyEscBuf[8] = { 0 };          // Escape sequence of a special key being received
+int KeyEscIdx = 0;                  // Bytes in KeyEscBuf
+char KeyEscFlag = 0;                // Inside an escape sequence
+#if CLI_SUGGEST_ENABLE
+unsigned int SuggestLen = 0;        // Length of the suggestion drawn after the cursor
+#endif
+#if CLI_PASTE_ENABLE
+unsigned int PasteFlag = 0;         // Inside a bracketed paste
+unsigned int PasteTail = 0;         // Length of the text after the cursor, parked at buffer end
+unsigned int PasteEsc = 0;          // Bytes of ANSI_PASTE_END matched
+#endif
+#if CLI_STREAM_ARG_ENABLE
+short StreamNode = NODE_NONE;       // Stream command taking the payload of the console line
+int (*StreamChunk)(int, const char *, int) = NULL; // Payload consumer of StreamNode
+char StreamBuf[CLI_STREAM_CHUNK_SIZE]; // Payload bytes not passed yet
+unsigned int StreamLen = 0;         // Bytes in StreamBuf
+int StreamRet = 0;                  // First error of the consumer, the rest is dropped
+unsigned int StreamCheck = 1;       // Line may still be the name of a stream command
+unsigned int StreamEsc = 0;         // Bytes of an escape sequence in the payload
+char StreamEscBuf[8];               // Escape sequence in the payload
+#endif
+#if HISTORY_ENABLE
 char ** HistoryPtr = NULL;          // History pointer buffer pointer
 unsigned int HistoryQueueHead = 0;  // History queue head
 unsigned int HistoryQueueTail = 0;  // History queue tail
 unsigned int HistoryPullDepth = 0;  // History pull depth
 unsigned int HistoryMemUsage = 0;   // History total memory usage
-unsigned int CliNumOfBuiltin = 0;   // Number of built-in commands
-unsigned int CliNumOfCommands = 0;  // Number of commands
-CliCommand_TypeDef *CliCommandList = NULL; // CLI commands list pointer
+#endif
+unsigned int CliRegBuiltin = 0;     // Commands registered now are built-in ones
+unsigned int CliCommandGen = 0;     // Command list generation, changes on every register
+#if CLI_GETOPT_ENABLE
+unsigned int CliOptReset = 0;       // Force cli_getopt to restart on next call
+#endif
+CliTable_TypeDef *CliTable = NULL;  // Published command table, read without lock
+CliTable_TypeDef *CliTableBuf = NULL; // The two versions of the command table
+unsigned int CliTableEpoch = 0;     // Flips on every publish, selects the reader counter
+unsigned int CliTableReaders[2];    // Readers inside a read section, by epoch
+unsigned char CliTableLock = 0;     // Writer spinlock
+short CliCommandCur = NODE_NONE;    // Command that is running now
+#if CLI_STATIC_MEM
+char CliStringBuf[CLI_STR_BUF_SIZE];                    // Static command string buffer
+CliTable_TypeDef CliTableStatic[2];                     // Static command tables
+#if HISTORY_ENABLE
+char *CliHistoryBuf[HISTORY_DEPTH];                     // Static history pointer buffer
+#endif
+#endif
+CliJob_TypeDef *CliJobCur = NULL;   // Job that is running now
+CliJob_TypeDef CliConsoleJob = { 0 }; // Job of the command line from console
+CliRecord_TypeDef CliConsoleRecord = { 0 }; // JSON record of the console job
+#if CLI_CANCEL_ENABLE
+char CancelAhead[CLI_CANCEL_AHEAD_SIZE]; // Input typed while the console job runs
+unsigned int CancelAheadLen = 0;    // Bytes in CancelAhead
+unsigned int CancelAheadIdx = 0;    // Bytes of CancelAhead taken by cli_getline
+unsigned int CancelTick = 0;        // Time the console was read ahead for Ctrl-C last
+#endif
+CliSession_TypeDef *CliSessionCur = NULL; // Session that is running now, NULL for the console
+#if CLI_PLAN_CACHE_SIZE > 0
+CliPlan_TypeDef *CliPlanCache[CLI_PLAN_CACHE_SIZE] = { 0 }; // Compiled plans by command string
+unsigned int CliPlanStamp = 0;      // Plan cache LRU clock
+#endif
 
 /** Functions ---------------------------------------------------------------*/
 /*!@brief Insert a char to a position of a string.
@@ -96,10 +350,331 @@ char *delete_char(char *string, int pos)
 void print_newline(char *string, int pos)
 {
     // Erase terminal line, print new buffer string and Move cursor
-    CLI_PRINT("%s\r%s%s", ANSI_ERASE_LINE, CLI_PROMPT_CHAR, string);
-    CLI_PRINT("\e[%luG", (uint32_t)pos + strlen(CLI_PROMPT_CHAR) + 1);
+    CLI_ECHO("%s\r%s%s", ANSI_ERASE_LINE, CLI_PROMPT_CHAR, string);
+    CLI_ECHO("\e[%luG", (uint32_t)pos + strlen(CLI_PROMPT_CHAR) + 1);
+#if CLI_SUGGEST_ENABLE
+    SuggestLen = 0;
+    suggest_show();
+#endif
+}
+
+#if CLI_SUGGEST_ENABLE
+/*!@brief Erase the suggestion drawn after the cursor.
+ */
+static void suggest_hide(void)
+{
+    if (SuggestLen > 0)
+    {
+        CLI_ECHO(ANSI_ERASE_LINE_END);
+        SuggestLen = 0;
+    }
+}
+
+/*!@brief Draw the rest of the most used command starting with the line, dimmed
+ *        after the cursor, while the cursor is at the end of the line.
+ */
+static void suggest_show(void)
+{
+    char buf[CLI_STR_BUF_SIZE];
+    int len = 0;
+
+#if CLI_STREAM_ARG_ENABLE
+    if (StreamNode == NODE_NONE)
+#endif
+    if (StringPtr[StringIdx] == 0)
+    {
+        // Only a suggestion that fits in the line buffer can be taken.
+        len = cli_suggest_find(StringPtr, StringIdx, buf, CLI_STR_BUF_SIZE - 1 - StringIdx);
+    }
+
+    suggest_hide();
+    if (len > 0)
+    {
+        CLI_ECHO(ANSI_DIM "%s" ANSI_RESET "\e[%dD", buf, len);
+        SuggestLen = len;
+    }
+}
+
+/*!@brief Take the suggestion into the line, by Right arrow at the end of it.
+ */
+static void suggest_accept(void)
+{
+    char buf[CLI_STR_BUF_SIZE];
+    int len = cli_suggest_find(StringPtr, StringIdx, buf, CLI_STR_BUF_SIZE - 1 - StringIdx);
+
+    if (len > 0)
+    {
+        // Drawn over the dimmed text, then a longer command may be suggested.
+        strcpy(StringPtr + StringIdx, buf);
+        StringIdx += len;
+        CLI_ECHO("%s", buf);
+        SuggestLen = 0;
+        suggest_show();
+    }
+}
+
+#endif
+
+/*!@brief Draw the prompt & input line again, when the output scheduler has
+ *        erased it to print output in between.
+ */
+void cli_redraw(void)
+{
+    if ((CliConsoleJob.Plan == NULL) && (StringPtr != NULL))
+    {
+        print_newline(StringPtr, StringIdx);
+    }
+}
+
+#if CLI_PASTE_ENABLE
+/*!@brief Start of a bracketed paste.
+ *        Text after the cursor is parked at the end of the buffer, pasted
+ *        bytes are written to the gap without echo and the line is drawn
+ *        once, when a pasted line is complete or the paste ends.
+ */
+void paste_begin(void)
+{
+    PasteTail = strlen(StringPtr) - StringIdx;
+    memmove(&StringPtr[CLI_STR_BUF_SIZE - 1 - PasteTail], &StringPtr[StringIdx], PasteTail);
+    StringPtr[CLI_STR_BUF_SIZE - 1] = 0;
+    StringPtr[StringIdx] = 0;
+    PasteFlag = 1;
+    PasteEsc = 0;
+}
+
+/*!@brief End of a bracketed paste, put the parked text back & redraw.
+ */
+void paste_end(void)
+{
+    memmove(&StringPtr[StringIdx], &StringPtr[CLI_STR_BUF_SIZE - 1 - PasteTail], PasteTail);
+    memset(&StringPtr[StringIdx + PasteTail], 0, CLI_STR_BUF_SIZE - StringIdx - PasteTail);
+    PasteFlag = 0;
+    print_newline(StringPtr, StringIdx);
+}
+
+/*!@brief Put a pasted byte to the line buffer.
+ *
+ * @param c     Pasted byte
+ * @return      1 when a non-empty line is complete, or 0.
+ */
+int paste_char(char c)
+{
+    const char *end = ANSI_PASTE_END;
+
+    // Watch for the end marker, other escape sequences are dropped.
+    if (c == end[PasteEsc])
+    {
+        if (end[++PasteEsc] == 0)
+        {
+            paste_end();
+        }
+        return 0;
+    }
+    if (PasteEsc != 0)
+    {
+        PasteEsc = (c == end[0]);
+        return 0;
+    }
+
+    if ((c == '\r') || (c == '\n'))
+    {
+        StringPtr[StringIdx] = 0;
+        return (StringIdx > 0);
+    }
+
+    if (c == '\t')
+    {
+        c = ' ';
+    }
+    if (((unsigned char) c >= ' ') && (c != '\x7f') && (StringIdx < CLI_STR_BUF_SIZE - 2 - PasteTail))
+    {
+        StringPtr[StringIdx++] = c;
+#if CLI_STREAM_ARG_ENABLE
+        if ((c == ' ') && (PasteTail == 0))
+        {
+            stream_detect();
+        }
+#endif
+    }
+    return 0;
+}
+#endif /* CLI_PASTE_ENABLE */
+
+#if CLI_STREAM_ARG_ENABLE
+/*!@brief Payload is pasted, it's drawn once per chunk instead of echo.
+ */
+static int stream_quiet(void)
+{
+#if CLI_PASTE_ENABLE
+    return PasteFlag;
+#else
+    return 0;
+#endif
+}
+
+/*!@brief Pass the payload bytes collected so far to the stream command.
+ *
+ * @param end   Line ends, the new line is echoed before the consumer may print.
+ */
+static void stream_flush(int end)
+{
+    if (stream_quiet())
+    {
+        CLI_ECHO("%.*s", StreamLen, StreamBuf);
+    }
+    if (end)
+    {
+        CLI_ECHO("\n");
+    }
+    if ((StreamLen != 0) && (StreamRet == 0))
+    {
+        StreamRet = StreamChunk(CLI_CHUNK_DATA, StreamBuf, StreamLen);
+    }
+    StreamLen = 0;
+}
+
+/*!@brief Check if the line so far is the name of a stream command, then the
+ *        rest of the line is its payload, passed in chunks as it comes in
+ *        instead of being kept in the line buffer.
+ *        Called when a separator is added at the end of the line.
+ *
+ * @return 1 if the payload starts.
+ */
+static int stream_detect(void)
+{
+    char buf[CLI_STR_BUF_SIZE];
+    char *argv[CLI_ARGC_MAX];
+    int argc = 0;
+    int depth = 0;
+    unsigned int idx;
+
+    if (!StreamCheck)
+    {
+        return 0;
+    }
+
+    // Only the first command of a line is checked.
+    memcpy(buf, StringPtr, StringIdx);
+    buf[StringIdx] = 0;
+    if (cli_strtoarg(buf, &argc, argv) != NULL)
+    {
+        StreamCheck = 0;
+        return 0;
+    }
+    if (argc == 0)
+    {
+        return 0;
+    }
+
+    CliTable_TypeDef *t = table_read_lock(&idx);
+    int node = cli_resolve(t, argc, argv, &depth);
+    int (*chunk)(int, const char *, int) = NULL;
+    if ((node != NODE_NONE) && (depth == argc))
+    {
+        chunk = t->List[node].Chunk;
+        // Words after a command are arguments, only a group can go on.
+        StreamCheck = (chunk == NULL) && (t->List[node].Child != NODE_NONE);
+    }
+    else
+    {
+        StreamCheck = 0;
+    }
+    table_read_unlock(idx);
+
+    if (chunk == NULL)
+    {
+        return 0;
+    }
+
+    if (stream_quiet())
+    {
+        print_newline(StringPtr, StringIdx);
+    }
+    StreamNode = node;
+    StreamChunk = chunk;
+    StreamLen = 0;
+    StreamEsc = 0;
+    StreamRet = chunk(CLI_CHUNK_BEGIN, NULL, 0);
+    return 1;
+}
+
+/*!@brief Take a byte of the payload of a stream command.
+ *        The payload can only be cut back within the chunk not passed yet.
+ *
+ * @return 0 to go on, 1 when the line ends or -1 when it's cancelled.
+ */
+static int stream_char(char c)
+{
+    // Escape sequences are dropped, except the bracketed paste markers.
+    if ((StreamEsc != 0) || (c == '\e'))
+    {
+        StreamEscBuf[StreamEsc++] = c;
+        StreamEscBuf[StreamEsc] = 0;
+        if (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || (c == '~')
+            || (StreamEsc >= sizeof(StreamEscBuf) - 1))
+        {
+#if CLI_PASTE_ENABLE
+            if (strcmp(StreamEscBuf, ANSI_PASTE_BEGIN) == 0)
+            {
+                PasteFlag = 1;
+                PasteTail = 0;
+                PasteEsc = 0;
+            }
+            else if (strcmp(StreamEscBuf, ANSI_PASTE_END) == 0)
+            {
+                stream_flush(0);
+                PasteFlag = 0;
+            }
+#endif
+            StreamEsc = 0;
+        }
+        return 0;
+    }
+
+    switch (c)
+    {
+    case '\r':
+    case '\n':
+        stream_flush(1);
+        return 1;
+    case '\x03': // Ctrl-C
+        return -1;
+    case '\x7f':
+    case '\b':
+        if (StreamLen > 0)
+        {
+            StreamLen--;
+            if (!stream_quiet())
+            {
+                CLI_ECHO("\b \b");
+            }
+        }
+        return 0;
+    case '\t':
+        c = ' ';
+        break;
+    default:
+        break;
+    }
+
+    if ((unsigned char) c < ' ')
+    {
+        return 0;
+    }
+    StreamBuf[StreamLen++] = c;
+    if (!stream_quiet())
+    {
+        CLI_ECHO("%c", c);
+    }
+    if (StreamLen >= CLI_STREAM_CHUNK_SIZE)
+    {
+        stream_flush(0);
+    }
+    return 0;
 }
+#endif /* CLI_STREAM_ARG_ENABLE */
 
+#if HISTORY_ENABLE
 /*!@brief Clear history buffer & heap.
  *
  */
@@ -158,6 +733,10 @@ char *history_push(char *string)
     // Request memory & copy command
     unsigned int len = strlen(string) + 1;
     char * ptr = cli_malloc(len);
+    if (ptr == NULL)
+    {
+        return NULL;
+    }
     memcpy(ptr, string, len);
 
     // Save new history queue pointer & queue head.
@@ -222,6 +801,7 @@ char *history_pull(int depth)
 
     return HistoryPtr[pull_idx];
 }
+#endif /* HISTORY_ENABLE */
 
 /*!@brief Handle specail key from key board.
  *        Check if a string is part of ANSI escape sequence.
@@ -236,29 +816,26 @@ char *history_pull(int depth)
  */
 int handle_special_key(char c)
 {
-    static char EscBuf[8] = { 0 };
-    static int EscIdx = 0;
-    static char EscFlag = 0;
-
     // Start of ESC flow control
     if (c == '\e')
     {
-        EscFlag = 1;
-        EscIdx = 0;
-        memset(EscBuf, 0, 8);
+        KeyEscFlag = 1;
+        KeyEscIdx = 0;
+        memset(KeyEscBuf, 0, 8);
     }
 
     // Return the character unchanged if not Escape sequence.
-    if (EscFlag == 0)
+    if (KeyEscFlag == 0)
     {
         return c;
     }
     else
     {
         // Put character to Escape sequence buffer
-        EscBuf[EscIdx++] = c;
+        KeyEscBuf[KeyEscIdx++] = c;
 
-        if (strcmp(EscBuf, ANSI_CURSOR_UP) == 0) //!< Up Arrow
+#if HISTORY_ENABLE
+        if (strcmp(KeyEscBuf, ANSI_CURSOR_UP) == 0) //!< Up Arrow
         {
             if (HistoryPullDepth < history_getdepth())
             {
@@ -266,7 +843,7 @@ int handle_special_key(char c)
             }
             history_pull(HistoryPullDepth);
         }
-        else if (strcmp(EscBuf, ANSI_CURSOR_DOWN) == 0) //!< Down Arrow
+        else if (strcmp(KeyEscBuf, ANSI_CURSOR_DOWN) == 0) //!< Down Arrow
         {
             if (HistoryPullDepth > 0)
             {
@@ -274,30 +851,51 @@ int handle_special_key(char c)
             }
             history_pull(HistoryPullDepth);
         }
-        else if (strcmp(EscBuf, ANSI_CURSOR_RIGHT) == 0) //!< Right arrow
+        else
+#endif
+        if (strcmp(KeyEscBuf, ANSI_CURSOR_RIGHT) == 0) //!< Right arrow
         {
             if (StringPtr[StringIdx] != 0)
             {
                 StringIdx++;
-                CLI_PRINT("%s", ANSI_CURSOR_RIGHT);
+                CLI_ECHO("%s", ANSI_CURSOR_RIGHT);
+#if CLI_SUGGEST_ENABLE
+                suggest_show();
+#endif
+            }
+#if CLI_SUGGEST_ENABLE
+            else if (SuggestLen > 0)
+            {
+                suggest_accept();
             }
+#endif
         }
-        else if (strcmp(EscBuf, ANSI_CURSOR_LEFT) == 0) //!< Left arrow
+        else if (strcmp(KeyEscBuf, ANSI_CURSOR_LEFT) == 0) //!< Left arrow
         {
+#if CLI_SUGGEST_ENABLE
+            suggest_hide();
+#endif
             if (StringIdx > 0)
             {
                 StringIdx--;
-                CLI_PRINT("%s", ANSI_CURSOR_LEFT);
+                CLI_ECHO("%s", ANSI_CURSOR_LEFT);
             }
         }
+#if CLI_PASTE_ENABLE
+        else if (strcmp(KeyEscBuf, ANSI_PASTE_BEGIN) == 0) //!< Bracketed paste
+        {
+            paste_begin();
+        }
+#endif
 
-        // Escape Sequence is ended by a Letter, clear buffer and flag for next
-        // new operation.
-        if (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')))
+        // Escape Sequence is ended by a Letter or '~' (e.g. Delete "\e[3~"),
+        // clear buffer and flag for next new operation.
+        if (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || (c == '~')
+            || (KeyEscIdx >= sizeof(KeyEscBuf) - 1))
         {
-            EscFlag = 0;
-            memset(EscBuf, 0, 8);
-            EscIdx = 0;
+            KeyEscFlag = 0;
+            memset(KeyEscBuf, 0, 8);
+            KeyEscIdx = 0;
         }
 
         return 0;
@@ -306,76 +904,114 @@ int handle_special_key(char c)
     return 0;
 }
 
+#if CLI_BUILTIN_ENABLE
 int builtin_debug(int argc, char **args)
 {
-    const char *helptext = "debug usage\n"
-            "\t-e --on     Turn on debug\n"
-            "\t-d --off    Turn off\n"
-            "\t-l --level  Show or set debug level\n"
-            "\t-h --help   Show help text\n";
+    static const CliOption_TypeDef options[] = {
+        CLI_OPTION('e', "on", CLI_OPT_FLAG, DebugArgs_TypeDef, On, NULL, 0, 0, "Turn on debug"),
+        CLI_OPTION('d', "off", CLI_OPT_FLAG, DebugArgs_TypeDef, Off, NULL, 0, 0, "Turn off"),
+        CLI_OPTION('l', "level", CLI_OPT_INT, DebugArgs_TypeDef, Level, NULL, -1, 3,
+                   "Set debug level, -1 turns off all print"),
+        CLI_OPTION_END(NULL) };
+    DebugArgs_TypeDef a = { 0, 0, gCliDebugLevel };
 
-    if ((argc <= 1) || (strcmp("-h", args[1]) == 0) || (strcmp("--help", args[1]) == 0))
+    if (argc <= 1)
     {
-        CLI_PRINT("%s", helptext);
+        Cli_PrintOptions(args[0], options);
+        return 0;
     }
-    else if ((strcmp("-e", args[1]) == 0) || (strcmp("--on", args[1]) == 0))
+
+    int ret = Cli_ParseOptions(argc, args, options, &a);
+    if (ret <= 0)
     {
-        gCliDebugLevel = 3;
-        CLI_PRINT("Turn on debug log\n");
+        return ret;
     }
-    else if ((strcmp("-d", args[1]) == 0) || (strcmp("--off", args[1]) == 0))
+
+    gCliDebugLevel = a.On ? 3 : a.Off ? 0 : a.Level;
+    CLI_PRINT("Debug level = %d\n", gCliDebugLevel);
+    return 0;
+}
+#endif /* CLI_BUILTIN_ENABLE */
+
+/*!@brief Print top level commands, built-in ones or registered ones.
+ */
+static void help_list_root(const CliTable_TypeDef *t, int builtin)
+{
+    int num = 0;
+
+    for (int i = t->Root; i != NODE_NONE; i = t->List[i].Sibling)
     {
-        gCliDebugLevel = 0;
-        CLI_PRINT("Turn off debug log\n");
+        num += (t->List[i].Builtin == builtin);
     }
-    else if ((strcmp("-l", args[1]) == 0) || (strcmp("--level", args[1]) == 0))
+
+    if (builtin)
     {
-        if (argc <= 2)
-        {
-            CLI_PRINT("Debug level = %d\n", gCliDebugLevel);
-        }
-        else
-        {
-            unsigned int level = strtol(args[2], NULL, 0);
-            gCliDebugLevel = level;
-            CLI_PRINT("Debug level = %d\n", gCliDebugLevel);
-        }
+        CLI_PRINT("\r\nBuilt-in Commands [%d]:\n", num);
     }
     else
     {
-        CLI_ERROR("ERROR: invalid option of [%s]\n", args[1]);
+        CLI_PRINT("\r\nRegistered Commands [%d]: \n", num);
     }
+    CLI_PRINT("-------------------------------------------\n");
 
-    return 0;
+    for (int i = t->Root; i != NODE_NONE; i = t->List[i].Sibling)
+    {
+        const CliCommand_TypeDef *cmd = &t->List[i];
+        if ((cmd->Builtin == builtin) && (cmd->Prompt != NULL))
+        {
+            CLI_PRINT("%-12.*s%s\n", cmd->NameLen, cmd->Name, cmd->Prompt);
+        }
+    }
+}
 
+/*!@brief Print sub commands of a group.
+ */
+static void help_list_node(const CliTable_TypeDef *t, int node)
+{
+    const CliCommand_TypeDef *group = &t->List[node];
+
+    CLI_PRINT("\r\n%.*s: %s\n", group->NameLen, group->Name, group->Prompt);
+    CLI_PRINT("-------------------------------------------\n");
+    for (int i = group->Child; i != NODE_NONE; i = t->List[i].Sibling)
+    {
+        const CliCommand_TypeDef *cmd = &t->List[i];
+        CLI_PRINT("%-12.*s%s\n", cmd->NameLen, cmd->Name, cmd->Prompt);
+    }
 }
 
-/*!@brief Built-in command of "help"
+/*!@brief Built-in command of "help", "help net" shows sub commands of "net".
  *
  */
 int builtin_help(int argc, char **argv)
 {
-    CLI_PRINT("\r\nBuilt-in Commands [%d]:\n", CliNumOfBuiltin);
-    CLI_PRINT("-------------------------------------------\n");
-    for (int i = 0; i < CliNumOfBuiltin; i++)
+    unsigned int idx;
+    CliTable_TypeDef *t = table_read_lock(&idx);
+    int ret = 0;
+
+    if (argc > 1)
     {
-        if ((CliCommandList[i].Name != NULL) && (CliCommandList[i].Prompt != NULL))
+        int depth = 0;
+        int node = cli_resolve(t, argc - 1, argv + 1, &depth);
+        if ((node == NODE_NONE) || (depth != argc - 1))
         {
-            CLI_PRINT("%-12s%s\n", CliCommandList[i].Name, CliCommandList[i].Prompt);
+            CLI_ERROR("ERROR: Unknown command of [%s], try [help].\n", argv[depth + 1]);
+            ret = CLI_FAIL;
         }
-    }
-
-    CLI_PRINT("\r\nRegistered Commands [%d]: \n", CliNumOfCommands - CliNumOfBuiltin);
-    CLI_PRINT("-------------------------------------------\n");
-    for (int i = CliNumOfBuiltin; i < CLI_COMMAND_SIZE; i++)
-    {
-        if ((CliCommandList[i].Name != NULL) && (CliCommandList[i].Prompt != NULL))
+        else
         {
-            CLI_PRINT("%-12s%s\n", CliCommandList[i].Name, CliCommandList[i].Prompt);
+            help_list_node(t, node);
+            CLI_PRINT("\n");
         }
     }
-    CLI_PRINT("\n");
-    return 0;
+    else
+    {
+        help_list_root(t, 1);
+        help_list_root(t, 0);
+        CLI_PRINT("\n");
+    }
+
+    table_read_unlock(idx);
+    return ret;
 }
 
 int builtin_version(int argc, char **argv)
@@ -388,20 +1024,51 @@ int builtin_version(int argc, char **argv)
     return 0;
 }
 
+/*!@brief Built-in command of "mode", switch between terminal & JSON output.
+ *
+ */
+int builtin_mode(int argc, char **args)
+{
+    if (argc < 2)
+    {
+        CLI_PRINT("%s\n", (gCliMode == CLI_MODE_JSON) ? "json" : "text");
+        return 0;
+    }
+
+    if (strcmp(args[1], "text") == 0)
+    {
+        Cli_SetMode(CLI_MODE_TEXT);
+    }
+    else if (strcmp(args[1], "json") == 0)
+    {
+        Cli_SetMode(CLI_MODE_JSON);
+    }
+    else
+    {
+        CLI_PRINT("usage: mode [text|json]\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+#if CLI_BUILTIN_ENABLE
 /*!@brief Built-in command of "history"
  *
  */
 int builtin_history(int argc, char **args)
 {
-    const char *helptext = "history usage:\n"
-            "\t-d --dump  Dump command history.\n"
-            "\t-c --clear Clear command history.\n"
-            "\t-h --help  Show this help text.\n";
-
 #if HISTORY_ENABLE == 0
     CLI_PRINT("History is function disabled.\n");
     return -1;
+#else
+    const char *helptext = "history usage:\n"
+            "\t-d --dump  Dump command history.\n"
+            "\t-c --clear Clear command history.\n"
+#if CLI_SUGGEST_ENABLE
+            "\t-s --suggest Show the most used commands suggested.\n"
 #endif
+            "\t-h --help  Show this help text.\n";
 
     if ((argc < 2) || (args[argc - 1] == NULL))
     {
@@ -413,12 +1080,12 @@ int builtin_history(int argc, char **args)
     {
         CLI_PRINT("History Mem Usage = %d\n", HistoryMemUsage);
         CLI_PRINT("History dump:\n");
-        CLI_PRINT("Index  Address    Command\n");
-        CLI_PRINT("-------------------------\n");
+        CLI_PRINT("Index  Address            Command\n");
+        CLI_PRINT("---------------------------------\n");
         for (int i = HistoryQueueTail; i < HistoryQueueHead; i++)
         {
             int j = i % HISTORY_DEPTH;
-            CLI_PRINT("%-6d 0x%08X %s\n", i, (int )HistoryPtr[j],
+            CLI_PRINT("%-6d %-18p %s\n", i, (void *) HistoryPtr[j],
                     (HistoryPtr[j] == NULL) ? "NULL" : HistoryPtr[j]);
         }
     }
@@ -426,7 +1093,16 @@ int builtin_history(int argc, char **args)
     {
         CLI_PRINT("History clear!\n");
         history_clear();
+#if CLI_SUGGEST_ENABLE
+        cli_suggest_clear();
+#endif
+    }
+#if CLI_SUGGEST_ENABLE
+    else if ((strcmp("-s", args[1]) == 0) || (strcmp("--suggest", args[1]) == 0))
+    {
+        cli_suggest_show();
     }
+#endif
     else if ((strcmp("-h", args[1]) == 0) || (strcmp("--help", args[1]) == 0))
     {
         CLI_PRINT("%s", helptext);
@@ -437,76 +1113,52 @@ int builtin_history(int argc, char **args)
     }
 
     return 0;
+#endif
 }
 
+#if CLI_GETOPT_ENABLE
 /*!@brief Built-in command of "test"
  *
  */
 int builtin_test(int argc, char **args)
 {
-    CLI_PRINT("Argc = %d\n", argc);
-    for (int i = 0; i < argc; i++)
+    static const CliOption_TypeDef options[] = {
+        CLI_OPTION('i', "integer", CLI_OPT_INT, TestArgs_TypeDef, Int, NULL, 0, 0,
+                   "Get a Integer value"),
+        CLI_OPTION('s', "string", CLI_OPT_STRING, TestArgs_TypeDef, String, NULL, 0, 0,
+                   "Get a String value"),
+        CLI_OPTION(0, "bool", CLI_OPT_FLAG, TestArgs_TypeDef, Bool, NULL, 0, 0,
+                   "Get a Boolean value"),
+        CLI_OPTION_END("[args ...]") };
+    TestArgs_TypeDef a = { 0, "", 0 };
+
+    int ret = Cli_ParseOptions(argc, args, options, &a);
+    if (ret <= 0)
     {
-        CLI_PRINT("Args[%d] = %s\n", i, args[i] == NULL ? "NULL" : args[i]);
+        return ret;
     }
 
-    static CliOption_TypeDef options[] = { { 'i', "integer", 'i' }, { 's', "string", 's' }, { 0,
-            "bool", 'b' }, { 'h', "help", 'h' }, { 0, "", 0 } };
-
-    int c = 0;
-    char *data[1] = { 0 };
-
-    do
+    CLI_PRINT("Result: Int[%d] String[%s] Bool[%d]\n", a.Int, a.String, a.Bool);
+    for (int i = ret; i < argc; i++)
     {
-        c = cli_getopt(argc, args, data, options);
-
-        switch (c)
-        {
-        case 'i':
-        {
-            if (*data != NULL)
-            {
-                CLI_PRINT("Get Integer value of [%s]\n", *data);
-            }
-            break;
-        }
-        case 's':
-        {
-            if (*data != NULL)
-            {
-                CLI_PRINT("Get String value of [%s]\n", *data);
-            }
-            break;
-        }
-        case 'b':
-        {
-            CLI_PRINT("Bool flag is set\n");
-            break;
-        }
-        case 'h':
-        {
-            CLI_PRINT("help text here!");
-            break;
-        }
-        case '?':
-        default:
-        {
-            CLI_ERROR("ERROR: invalid option of [%s]\n", (*data == NULL ? "NULL" : *data));
-            return -1;
-        }
-        }
-
-    } while (c != -1);
+        CLI_PRINT("Args[%d] = %s\n", i, args[i]);
+    }
 
     return 0;
 }
+#endif /* CLI_GETOPT_ENABLE */
 
 /*!@brief Built-in command of "repeat"
- *
+ *        Resumable, so a repeated command that yields doesn't block Cli_Run.
  */
 int builtin_repeat(int argc, char **args)
 {
     const char *helptext = "usage: repeat [num] \"command\"\n";
+    CliPt_TypeDef *pt = Cli_PtSelf();
+    unsigned int count = (argc >= 3) ? strtol(args[1], NULL, 0) : 0;
+    int ret = 0;
+
+    CLI_PT_BEGIN(pt);
 
     if ((argc < 3) || (args == NULL))
     {
@@ -514,40 +1166,107 @@ int builtin_repeat(int argc, char **args)
         return -1;
     }
 
-    unsigned int count = strtol(args[1], NULL, 0);
-
-    for (unsigned int i = 1; i <= count; i++)
+    // Compile once, the loop only dispatches.
+    pt->Ptr = Cli_PlanCompile(args[2]);
+    if (pt->Ptr == NULL)
     {
+        return CLI_FAIL;
+    }
 
-        CLI_INFO("%sRepeat %d/%d: [%s] %s\n", ANSI_BOLD, i, count, args[2], ANSI_RESET);
-        int ret = Cli_RunByString(args[2]);
+    // A cancelled line ends the plan with CLI_CANCELLED, so the loop stops
+    // and the plan is released below.
+    for (pt->Count = 1; pt->Count <= count; pt->Count++)
+    {
+        CLI_INFO("%sRepeat %d/%d: [%s] %s\n", ANSI_BOLD, pt->Count, count, args[2], ANSI_RESET);
+        CLI_PT_SPAWN(pt, ret, Cli_PlanRun(pt->Ptr));
         if (ret != 0)
         {
-            return ret;
+            break;
         }
     }
 
-    return 0;
+    Cli_PlanFree(pt->Ptr);
+    CLI_PT_END(pt);
+    return ret;
 }
 
 /*!@brief Built-in command of "sleep"
- *
+ *        Yields until the interval is over instead of blocking Cli_Run.
  */
 int builtin_sleep(int argc, char **args)
 {
-    const char *helptext = "usage: sleep [seconds]\n";
+    static const CliOption_TypeDef options[] = {
+        CLI_ARGUMENT("seconds", CLI_OPT_FLOAT, SleepArgs_TypeDef, Seconds, NULL, 0, 86400,
+                     "Time to sleep"),
+        CLI_OPTION_END(NULL) };
+    CliPt_TypeDef *pt = Cli_PtSelf();
+    SleepArgs_TypeDef a;
 
-    if ((argc <= 1) || (args[1] == NULL))
+    CLI_PT_BEGIN(pt);
+
+    int ret = Cli_ParseOptions(argc, args, options, &a);
+    if (ret <= 0)
     {
-        CLI_PRINT("%s", helptext);
-        return -1;
+        return ret;
     }
 
-    float sec = strtof(args[1], NULL);
-    cli_sleep(sec * 1000);
+    pt->Tick = cli_gettick() + (unsigned int) (a.Seconds * 1000);
+    CLI_PT_WAIT_UNTIL(pt, Cli_Cancelled() || ((int) (cli_gettick() - pt->Tick) >= 0));
 
-    return 0;
+    CLI_PT_END(pt);
+    return Cli_Cancelled() ? CLI_CANCELLED : 0;
+}
+
+#if CLI_CANCEL_ENABLE
+/*!@brief Built-in command of "timeout", run a command line with a time limit.
+ *        The line is cancelled when it runs longer, see Cli_Cancelled().
+ */
+int builtin_timeout(int argc, char **args)
+{
+    static const CliOption_TypeDef options[] = {
+        CLI_ARGUMENT("seconds", CLI_OPT_FLOAT, TimeoutArgs_TypeDef, Seconds, NULL, 0, 86400,
+                     "Time limit"),
+        CLI_OPTION_END("\"command\"") };
+    CliPt_TypeDef *pt = Cli_PtSelf();
+    TimeoutArgs_TypeDef a;
+    int ret = 0;
+
+    CLI_PT_BEGIN(pt);
+
+    int i = Cli_ParseOptions(argc, args, options, &a);
+    if ((i > 0) && (i >= argc))
+    {
+        Cli_PrintOptions(args[0], options);
+        i = CLI_FAIL;
+    }
+    if (i <= 0)
+    {
+        return i;
+    }
+
+    pt->Ptr = (i + 1 == argc) ? Cli_PlanCompile(args[i]) : Cli_PlanCompileArgs(argc - i, args + i);
+    if (pt->Ptr == NULL)
+    {
+        return CLI_FAIL;
+    }
+
+    // The limit is kept in this level, Cli_Cancelled() checks it for the
+    // commands below.
+    pt->Start = cli_gettick();
+    pt->Timeout = (unsigned int) (a.Seconds * 1000);
+    pt->Timeout = (pt->Timeout > 0) ? pt->Timeout : 1;
+    CLI_PT_SPAWN(pt, ret, Cli_PlanRun(pt->Ptr));
+
+    if ((ret == CLI_CANCELLED) && (cli_gettick() - pt->Start >= pt->Timeout))
+    {
+        CLI_ERROR("ERROR: [%s] timed out after %u ms.\n", ((CliPlan_TypeDef *) pt->Ptr)->Source,
+                  pt->Timeout);
+    }
+    Cli_PlanFree(pt->Ptr);
+    CLI_PT_END(pt);
+    return ret;
 }
+#endif /* CLI_CANCEL_ENABLE */
 
 /*!@brief Built-in command of "time"
  *
@@ -555,6 +1274,10 @@ int builtin_sleep(int argc, char **args)
 int builtin_time(int argc, char **args)
 {
     const char *helptext = "usage: time [command]\n";
+    CliPt_TypeDef *pt = Cli_PtSelf();
+    int ret = 0;
+
+    CLI_PT_BEGIN(pt);
 
     if ((argc <= 1) || (args[1] == NULL))
     {
@@ -562,15 +1285,247 @@ int builtin_time(int argc, char **args)
         return -1;
     }
 
-    unsigned int start = cli_gettick();
-    int ret = Cli_RunByArgs(argc - 1, args + 1);
-    unsigned int stop = cli_gettick();
+    // Compile outside of the measurement, only execution is timed.
+    pt->Ptr = Cli_PlanCompileArgs(argc - 1, args + 1);
+    if (pt->Ptr == NULL)
+    {
+        return CLI_FAIL;
+    }
+
+    pt->Tick = cli_gettick();
+    CLI_PT_SPAWN(pt, ret, Cli_PlanRun(pt->Ptr));
+    unsigned int elapsed = cli_gettick() - pt->Tick;
+    Cli_PlanFree(pt->Ptr);
+
+    CLI_PRINT("time: %d.%03d s\n", elapsed / 1000, elapsed % 1000);
+
+    CLI_PT_END(pt);
+    return ret;
+}
+
+static int bench_null_write(void *arg, int stream, const char *buf, int len)
+{
+    return len;
+}
+
+/*!@brief Run the measured plan once with its output dropped.
+ */
+static int bench_run(Bench_TypeDef *b)
+{
+    static CliOutput_TypeDef null = { bench_null_write, NULL };
+
+    CliOutput_TypeDef *prev = Cli_SetOutput(&null);
+    int ret = Cli_PlanRun(b->Plan);
+    Cli_SetOutput(prev);
+    return ret;
+}
+
+/*!@brief Add a run time to the statistics. Mean & deviation are running values
+ *        over every run, percentiles come from a uniform sample of the runs.
+ */
+static void bench_add(Bench_TypeDef *b, unsigned long long ns)
+{
+    b->Num++;
+    b->Min = ((b->Num == 1) || (ns < b->Min)) ? ns : b->Min;
+    b->Max = (ns > b->Max) ? ns : b->Max;
+
+    double delta = ns - b->Mean;
+    b->Mean += delta / b->Num;
+    b->M2 += delta * (ns - b->Mean);
+
+    unsigned int slot = b->Num - 1;
+    if (slot >= BENCH_SAMPLES)
+    {
+        b->Seed = b->Seed * 1103515245 + 12345;
+        slot = (b->Seed >> 8) % b->Num;
+    }
+    if (slot < BENCH_SAMPLES)
+    {
+        b->Sample[slot] = (ns < UINT32_MAX) ? ns : UINT32_MAX;
+    }
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *) a;
+    unsigned int y = *(const unsigned int *) b;
+    return (x > y) - (x < y);
+}
+
+static unsigned long long bench_isqrt(unsigned long long v)
+{
+    unsigned long long r = v;
+    unsigned long long x = (v + 1) / 2;
+
+    while (x < r)
+    {
+        r = x;
+        x = (x + v / x) / 2;
+    }
+    return r;
+}
+
+static void bench_report(Bench_TypeDef *b)
+{
+    unsigned int num = (b->Num < BENCH_SAMPLES) ? b->Num : BENCH_SAMPLES;
+    unsigned long long total = cli_getnanos() - b->Begin;
+
+    qsort(b->Sample, num, sizeof(b->Sample[0]), bench_cmp);
+    CLI_PRINT("runs   = %u in %llu.%03llu ms, %u warmup\n", b->Num, total / 1000000,
+              total / 1000 % 1000, b->Warmup);
+    CLI_PRINT("min    = %llu ns\n", b->Min);
+    CLI_PRINT("mean   = %llu ns\n", (unsigned long long) b->Mean);
+    CLI_PRINT("median = %u ns\n", b->Sample[num / 2]);
+    CLI_PRINT("p99    = %u ns\n", b->Sample[num * 99 / 100]);
+    CLI_PRINT("max    = %llu ns\n", b->Max);
+    CLI_PRINT("stddev = %llu ns\n",
+              (b->Num > 1) ? bench_isqrt((unsigned long long) (b->M2 / (b->Num - 1))) : 0);
+}
+
+/*!@brief Built-in command of "bench", run a command many times with its
+ *        output dropped and show statistics of the run time.
+ *        The command is compiled once, runs only dispatch it. A command that
+ *        yields is resumed like in "repeat", its wait is part of the run time.
+ */
+int builtin_bench(int argc, char **args)
+{
+    static const CliOption_TypeDef options[] = {
+        CLI_OPTION('n', "runs", CLI_OPT_UINT, Bench_TypeDef, Runs, NULL, 0, 100000000,
+                   "Runs to measure, 1000 without -t"),
+        CLI_OPTION('w', "warmup", CLI_OPT_UINT, Bench_TypeDef, Warmup, "10", 0, 1000000,
+                   "Runs before measuring"),
+        CLI_OPTION('t', "time", CLI_OPT_FLOAT, Bench_TypeDef, Seconds, NULL, 0, 3600,
+                   "Time limit in seconds"),
+        CLI_OPTION_END("\"command\"") };
+    CliPt_TypeDef *pt = Cli_PtSelf();
+    Bench_TypeDef *b = pt->Ptr;
+    int ret = 0;
+
+    CLI_PT_BEGIN(pt);
+
+    b = cli_malloc(sizeof(Bench_TypeDef));
+    if (b == NULL)
+    {
+        return CLI_FAIL;
+    }
+    memset(b, 0, sizeof(Bench_TypeDef));
+    pt->Ptr = b;
+
+    int i = Cli_ParseOptions(argc, args, options, b);
+    if ((i > 0) && (i >= argc))
+    {
+        Cli_PrintOptions(args[0], options);
+        i = CLI_FAIL;
+    }
+    if (i <= 0)
+    {
+        cli_free(b);
+        return i;
+    }
+    b->Limit = b->Seconds * 1e9;
+    b->Runs = ((b->Runs == 0) && (b->Limit == 0)) ? 1000 : b->Runs;
+
+    // A quoted command line may hold several words & ';', otherwise the words
+    // are the command.
+    b->Plan = (i + 1 == argc) ? Cli_PlanCompile(args[i]) : Cli_PlanCompileArgs(argc - i, args + i);
+    if (b->Plan == NULL)
+    {
+        cli_free(b);
+        return CLI_FAIL;
+    }
+
+    for (pt->Count = 0; pt->Count < b->Warmup; pt->Count++)
+    {
+        CLI_PT_SPAWN(pt, ret, bench_run(b));
+        if (ret != 0)
+        {
+            break;
+        }
+    }
 
-    CLI_PRINT("time: %d.%03d s\n", (stop - start) / 1000, (stop - start) % 1000);
+    b->Begin = cli_getnanos();
+    while ((ret == 0) && ((b->Runs == 0) || (b->Num < b->Runs))
+           && ((b->Limit == 0) || (cli_getnanos() - b->Begin < b->Limit)))
+    {
+        b->Start = cli_getnanos();
+        CLI_PT_SPAWN(pt, ret, bench_run(b));
+        bench_add(b, cli_getnanos() - b->Start);
+    }
 
+    // A cancelled bench still shows the runs it has measured.
+    if ((ret != 0) && (ret != CLI_CANCELLED))
+    {
+        CLI_ERROR("ERROR: command returned %d after %u runs\n", ret, b->Num);
+    }
+    else if (b->Num > 0)
+    {
+        bench_report(b);
+    }
+    Cli_PlanFree(b->Plan);
+    cli_free(b);
+    CLI_PT_END(pt);
     return ret;
 }
 
+#if CLI_STREAM_ARG_ENABLE
+/*!@brief Stream command of "hexsum", count & sum the bytes of a hex payload,
+ *        e.g. "hexsum 01 02 A0FF ...". An example of Cli_RegisterStream().
+ */
+int builtin_hexsum(int event, const char *buf, int len)
+{
+    static unsigned int bytes = 0;
+    static unsigned char sum = 0;
+    static int high = -1;
+
+    switch (event)
+    {
+    case CLI_CHUNK_BEGIN:
+        bytes = 0;
+        sum = 0;
+        high = -1;
+        return 0;
+    case CLI_CHUNK_DATA:
+        for (int i = 0; i < len; i++)
+        {
+            char c = buf[i];
+            int v = ((c >= '0') && (c <= '9')) ? c - '0' : ((c | 0x20) >= 'a') && ((c | 0x20) <= 'f')
+                    ? (c | 0x20) - 'a' + 10 : -1;
+            if (v < 0)
+            {
+                if ((c != ' ') && (c != ',') && (c != ':'))
+                {
+                    CLI_ERROR("ERROR: invalid hex [%c] after %u bytes\n", c, bytes);
+                    return CLI_FAIL;
+                }
+            }
+            else if (high < 0)
+            {
+                high = v;
+            }
+            else
+            {
+                sum += (high << 4) | v;
+                bytes++;
+                high = -1;
+            }
+        }
+        return 0;
+    case CLI_CHUNK_END:
+        if (high >= 0)
+        {
+            CLI_ERROR("ERROR: odd number of hex digits\n");
+            return CLI_FAIL;
+        }
+        CLI_PRINT("bytes = %u, sum = 0x%02X\n", bytes, sum);
+        return 0;
+    default:
+        return 0;
+    }
+}
+#endif
+#endif /* CLI_BUILTIN_ENABLE */
+
+#if CLI_GETOPT_ENABLE
 /*!@brief   Get options from arguments.
  *          This is a implement for "getopt" & "getopt_long" in standard C++
  * liberary. This function check all the arguments and return the index of
@@ -579,7 +1534,9 @@ int builtin_time(int argc, char **args)
  * options list.. Generally this function should be called in loop until it
  * returns '0'.
  *
- * @example Refer to builtin_test as an example. a simple example as below:
+ *          Built-in commands use Cli_ParseOptions() instead, which checks &
+ *          stores values by an option table in one pass.
+ * @example A simple example as below:
  *          int ret = 0;
  *          CliOption_TypeDef options[] = {{'a',"aaa",'a'}};
  *          do {
@@ -609,12 +1566,13 @@ int cli_getopt(int argc, char **args, char **data_ptr, CliOption_TypeDef options
     static int op_idx = 0;
     static int op_ret = '?';
 
-    if ((op_argc != argc) || (op_args != args))
+    if ((op_argc != argc) || (op_args != args) || CliOptReset)
     {
         op_argc = argc;
         op_args = args;
         op_idx = 1; // ignore the 1st argument, it's the command name.
         op_ret = '?';
+        CliOptReset = 0;
     }
 
     if ((op_argc > 0) && (op_idx < op_argc) && (op_args[op_idx] != NULL))
@@ -675,140 +1633,741 @@ int cli_getopt(int argc, char **args, char **data_ptr, CliOption_TypeDef options
     exit: op_idx++;
     return op_ret;
 }
+#endif /* CLI_GETOPT_ENABLE */
 
-/*!@brief Get a line for CLI.
- *        This function will check input from cli_port_getc() function.
- *        Put them to buffer until get a new line "\n".
- *
- * @return Pointer to the line or NULL for no line is get.
+/*!@brief Describe the value of an option, e.g. "<uint 0..100>" or "<off|on>".
  */
-char *cli_getline(void)
+static void opt_hint(const CliOption_TypeDef *opt, char *buf, int size)
 {
-    if (StringPtr == NULL)
+    static const char *names[] = { "", "", "int", "uint", "float", "", "string" };
+    int type = opt->Type & ~CLI_OPT_ARG;
+
+    if (type == CLI_OPT_FLAG)
     {
-        return 0;
+        buf[0] = 0;
+    }
+    else if (type == CLI_OPT_ENUM)
+    {
+        snprintf(buf, size, "<%s>", opt->Enum);
+    }
+    else if ((opt->Min < opt->Max) && (type != CLI_OPT_STRING))
+    {
+        snprintf(buf, size, "<%s %ld..%ld>", names[type], opt->Min, opt->Max);
+    }
+    else
+    {
+        snprintf(buf, size, "<%s>", names[type]);
     }
+}
 
-    char c = 0;
+/*!@brief Index of a name in the '|' separated names of an enum option, a
+ *        number is taken as the index.
+ * @return Index or -1 if it's not one of the names.
+ */
+static int opt_enum(const char *names, const char *val)
+{
+    int len = strlen(val);
+    int idx = 0;
+    int num = 0;
 
-    do
+    for (const char *p = names; *p != 0; idx++)
     {
-        // Get 1 char and check
-        c = cli_port_getc();
+        const char *end = strchr(p, '|');
+        int n = (end != NULL) ? end - p : (int) strlen(p);
+        if ((n == len) && (strncmp(p, val, len) == 0))
+        {
+            return idx;
+        }
+        p += (end != NULL) ? n + 1 : n;
+    }
 
-        // Handle characters
-        switch (c)
+    char *end = NULL;
+    num = strtol(val, &end, 0);
+    return ((end != val) && (*end == 0) && (num >= 0) && (num < idx)) ? num : -1;
+}
+
+/*!@brief Check the value of an option & store it in the caller's struct.
+ *
+ * @param opt   Option
+ * @param val   Value as typed
+ * @param out   Caller's struct
+ * @return      0 or CLI_FAIL if the format or the range is wrong.
+ */
+static int opt_store(const CliOption_TypeDef *opt, const char *val, void *out)
+{
+    void *ptr = (char *) out + opt->Offset;
+    int range = (opt->Min < opt->Max);
+    char *end = NULL;
+
+    switch (opt->Type & ~CLI_OPT_ARG)
+    {
+    case CLI_OPT_FLAG:
+        *(int *) ptr = (val[0] != '0');
+        return 0;
+    case CLI_OPT_STRING:
+        *(const char **) ptr = val;
+        return 0;
+    case CLI_OPT_ENUM:
+    {
+        int idx = opt_enum(opt->Enum, val);
+        if (idx < 0)
         {
-        case '\x0':  // NULL
-        case '\xff': // EOF
+            return CLI_FAIL;
+        }
+        *(int *) ptr = idx;
+        return 0;
+    }
+    case CLI_OPT_INT:
+    {
+        long v = strtol(val, &end, 0);
+        if ((end == val) || (*end != 0) || (range && ((v < opt->Min) || (v > opt->Max))))
         {
-            break;
+            return CLI_FAIL;
         }
-        case '\x7f': // Delete for MacOs keyboard
-        case '\b':   // Backspace PC keyboard
+        *(int *) ptr = v;
+        return 0;
+    }
+    case CLI_OPT_UINT:
+    {
+        unsigned long v = strtoul(val, &end, 0);
+        if ((end == val) || (*end != 0) || (val[0] == '-')
+            || (range && ((v < (unsigned long) opt->Min) || (v > (unsigned long) opt->Max))))
         {
-            if (StringIdx > 0)
-            {
-                // Delete 1 byte from buffer.
-                delete_char(StringPtr, StringIdx);
-                StringIdx--;
-                // Print New line
-                print_newline(StringPtr, StringIdx);
-            }
-            break;
+            return CLI_FAIL;
         }
-        case '\r': // CR
-        case '\n': // LF
+        *(unsigned int *) ptr = v;
+        return 0;
+    }
+    case CLI_OPT_FLOAT:
+    {
+        float v = strtof(val, &end);
+        if ((end == val) || (*end != 0) || (range && ((v < opt->Min) || (v > opt->Max))))
         {
-            // Push to history without \'n'
-            if (StringIdx > 0)
+            return CLI_FAIL;
+        }
+        *(float *) ptr = v;
+        return 0;
+    }
+    default:
+        return 0;
+    }
+}
+
+/*!@brief Find the option of an argument, "-x", "-xVALUE", "--name" or
+ *        "--name=VALUE".
+ *
+ * @param val   Value given in the same argument, NULL if none
+ * @return      Option or NULL if it's not in the list.
+ */
+static const CliOption_TypeDef *opt_find(const CliOption_TypeDef options[], const char *arg,
+                                         const char **val)
+{
+    const CliOption_TypeDef *opt;
+
+    *val = NULL;
+    if (arg[1] == '-')
+    {
+        const char *eq = strchr(arg, '=');
+        int len = (eq != NULL) ? eq - arg - 2 : (int) strlen(arg + 2);
+        for (opt = options; opt->ReturnVal != 0; opt++)
+        {
+            if (!(opt->Type & CLI_OPT_ARG) && (opt->LongName != NULL)
+                && (strncmp(opt->LongName, arg + 2, len) == 0) && (opt->LongName[len] == 0))
             {
-                history_push(StringPtr);
+                *val = (eq != NULL) ? eq + 1 : NULL;
+                return opt;
             }
+        }
+        return NULL;
+    }
 
-            // Echo back
-            strcat(StringPtr, "\n");
-            CLI_PRINT("\n");
+    for (opt = options; opt->ReturnVal != 0; opt++)
+    {
+        if (!(opt->Type & CLI_OPT_ARG) && (opt->ShortName != 0) && (opt->ShortName == arg[1]))
+        {
+            *val = (arg[2] != 0) ? arg + 2 : NULL;
+            return opt;
+        }
+    }
+    return NULL;
+}
 
-            // Return pointer and length
-            StringIdx = 0;
-            HistoryPullDepth = 0;
-            return StringPtr;
+/*!@brief Print the help text of a command from its option table, e.g.
+ *
+ *          usage: sleep [options] <seconds>
+ *            -h --help                             Show this help text
+ *            <seconds>        <float 0..86400>     Time to sleep
+ *
+ * @param name      Command name
+ * @param options   Option table, see CliOption_TypeDef
+ */
+void Cli_PrintOptions(const char *name, const CliOption_TypeDef options[])
+{
+    const CliOption_TypeDef *opt;
+    char hint[48];
+    char flag[24];
+    int help = 1;
+
+    CLI_PRINT("usage: %s [options]", name);
+    for (opt = options; opt->ReturnVal != 0; opt++)
+    {
+        if (opt->Type & CLI_OPT_ARG)
+        {
+            CLI_PRINT((opt->Default != NULL) ? " [<%s>]" : " <%s>", opt->LongName);
         }
-        default:
+        help = help && (opt->ShortName != 'h');
+    }
+    if (opt->Help != NULL)
+    {
+        CLI_PRINT(" %s", opt->Help);
+    }
+    CLI_PRINT("\n");
+
+    if (help)
+    {
+        CLI_PRINT("  %-16s %-20s %s\n", "-h --help", "", "Show this help text");
+    }
+    for (opt = options; opt->ReturnVal != 0; opt++)
+    {
+        if (opt->Type == CLI_OPT_NONE)
         {
-            // Handle special keys first
-            if (handle_special_key(c) == 0)
+            continue;
+        }
+        if (opt->Type & CLI_OPT_ARG)
+        {
+            snprintf(flag, sizeof(flag), "<%s>", opt->LongName);
+        }
+        else
+        {
+            snprintf(flag, sizeof(flag), "%c%c %s%s", opt->ShortName ? '-' : ' ',
+                     opt->ShortName ? opt->ShortName : ' ', opt->LongName ? "--" : "",
+                     opt->LongName ? opt->LongName : "");
+        }
+        opt_hint(opt, hint, sizeof(hint));
+        CLI_PRINT("  %-16s %-20s %s", flag, hint, opt->Help ? opt->Help : "");
+        if (opt->Default != NULL)
+        {
+            CLI_PRINT(" (default %s)", opt->Default);
+        }
+        CLI_PRINT("\n");
+    }
+}
+
+/*!@brief Parse the arguments of a command by an option table in one pass.
+ *        Values are checked by type & range and stored in the caller's struct
+ *        at the offset of each option, "-h" & "--help" print the help text
+ *        made from the table. Options come first, up to the first argument
+ *        that isn't one or "--", then the positional arguments in table order.
+ *        Values without a default keep what the caller put in the struct.
+ *
+ * @example CLI_OPTION_END(NULL) tells there are no more arguments.
+ *          static const CliOption_TypeDef options[] = {
+ *              CLI_OPTION('n', "num", CLI_OPT_UINT, Args_TypeDef, Num, "1", 1, 100, "Count"),
+ *              CLI_OPTION_END(NULL) };
+ *          Args_TypeDef a;
+ *          int ret = Cli_ParseOptions(argc, args, options, &a);
+ *          if (ret <= 0)
+ *              return ret;
+ *
+ * @param argc      Argument count
+ * @param args      Argument vector, args[0] is the command name
+ * @param options   Option table, see CliOption_TypeDef
+ * @param out       Caller's struct to store the values in
+ * @retval          Index of the first argument left, >= 1
+ *          0           Help text is shown
+ *          CLI_FAIL    Invalid argument, an error is shown
+ */
+int Cli_ParseOptions(int argc, char **args, const CliOption_TypeDef options[], void *out)
+{
+    const CliOption_TypeDef *opt;
+    const char *val = NULL;
+    int i = 1;
+
+    for (opt = options; opt->ReturnVal != 0; opt++)
+    {
+        if ((opt->Type != CLI_OPT_NONE) && (opt->Default != NULL))
+        {
+            opt_store(opt, opt->Default, out);
+        }
+    }
+
+    while ((i < argc) && (args[i][0] == '-') && (args[i][1] != 0))
+    {
+        char *arg = args[i++];
+
+        if ((arg[1] == '-') && (arg[2] == 0))
+        {
+            break;
+        }
+        // A negative number is an argument.
+        if ((arg[1] == '.') || ((arg[1] >= '0') && (arg[1] <= '9')))
+        {
+            i--;
+            break;
+        }
+
+        opt = opt_find(options, arg, &val);
+        if ((opt == NULL) && ((strcmp(arg, "-h") == 0) || (strcmp(arg, "--help") == 0)))
+        {
+            Cli_PrintOptions(args[0], options);
+            return 0;
+        }
+        if ((opt == NULL) || (opt->Type == CLI_OPT_NONE)
+            || ((opt->Type == CLI_OPT_FLAG) && (val != NULL) && (arg[1] != '-')))
+        {
+            CLI_ERROR("ERROR: invalid option of [%s], try \"%s -h\"\n", arg, args[0]);
+            return CLI_FAIL;
+        }
+
+        if (opt->Type == CLI_OPT_FLAG)
+        {
+            val = (val != NULL) ? val : "1";
+        }
+        else if ((val == NULL) && (i < argc))
+        {
+            val = args[i++];
+        }
+        else if (val == NULL)
+        {
+            CLI_ERROR("ERROR: missing value of [%s]\n", arg);
+            return CLI_FAIL;
+        }
+
+        if (opt_store(opt, val, out) != 0)
+        {
+            char hint[48];
+            opt_hint(opt, hint, sizeof(hint));
+            CLI_ERROR("ERROR: invalid value [%s] of [%s], expect %s\n", val, arg, hint);
+            return CLI_FAIL;
+        }
+    }
+
+    for (opt = options; opt->ReturnVal != 0; opt++)
+    {
+        if (!(opt->Type & CLI_OPT_ARG))
+        {
+            continue;
+        }
+        if (i >= argc)
+        {
+            if (opt->Default == NULL)
             {
-                return 0;
+                CLI_ERROR("ERROR: missing <%s>, try \"%s -h\"\n", opt->LongName, args[0]);
+                return CLI_FAIL;
             }
-            else
+            continue;
+        }
+        if (opt_store(opt, args[i], out) != 0)
+        {
+            char hint[48];
+            opt_hint(opt, hint, sizeof(hint));
+            CLI_ERROR("ERROR: invalid value [%s] of <%s>, expect %s\n", args[i], opt->LongName, hint);
+            return CLI_FAIL;
+        }
+        i++;
+    }
+
+    // The end of the table has the usage of the arguments left, if any.
+    if ((i < argc) && (opt->Help == NULL))
+    {
+        CLI_ERROR("ERROR: unexpected argument [%s], try \"%s -h\"\n", args[i], args[0]);
+        return CLI_FAIL;
+    }
+    return i;
+}
+
+/*!@brief Complete the command name before the cursor on Tab.
+ *        Only sub commands of the group typed so far are candidates. A unique
+ *        match is inserted, otherwise the common prefix is inserted or all
+ *        candidates are listed.
+ */
+static void complete_table(CliTable_TypeDef *t)
+{
+    char buf[CLI_STR_BUF_SIZE];
+    char *argv[CLI_ARGC_MAX];
+    int argc = 0;
+
+    // Only the last ';' separated command before the cursor matters.
+    memcpy(buf, StringPtr, StringIdx);
+    buf[StringIdx] = 0;
+    char *cmd = strrchr(buf, ';');
+    cmd = (cmd != NULL) ? cmd + 1 : buf;
+    int partial = (StringIdx > 0) && (buf[StringIdx - 1] != ' ') && (buf[StringIdx - 1] != ';');
+    cli_strtoarg(cmd, &argc, argv);
+
+    // Walk down the words that are complete.
+    int words = partial ? argc - 1 : argc;
+    int node = NODE_NONE;
+    for (int i = 0; i < words; i++)
+    {
+        node = node_find(t, node, argv[i], strlen(argv[i]));
+        if (node == NODE_NONE)
+        {
+            return;
+        }
+    }
+
+    const char *word = partial ? argv[argc - 1] : "";
+    int wlen = strlen(word);
+    int match = NODE_NONE;
+    int common = 0;
+    int num = 0;
+
+    for (int i = *node_children(t, node); i != NODE_NONE; i = t->List[i].Sibling)
+    {
+        CliCommand_TypeDef *c = &t->List[i];
+        if ((c->NameLen < wlen) || (strncmp(c->Name, word, wlen) != 0))
+        {
+            continue;
+        }
+
+        if (num++ == 0)
+        {
+            match = i;
+            common = c->NameLen;
+        }
+        else
+        {
+            // Shrink to the prefix shared with the first match.
+            int n = wlen;
+            while ((n < common) && (n < c->NameLen) && (c->Name[n] == t->List[match].Name[n]))
             {
-                if (strlen(StringPtr) < CLI_STR_BUF_SIZE - 2)
-                {
-                    // Insert 1 byte to buffer
-                    insert_char(StringPtr, c, StringIdx);
-                    StringIdx++;
+                n++;
+            }
+            common = n;
+        }
+    }
 
-                    // Loop back a char or line
-                    if (StringPtr[StringIdx] == 0)
-                    {
-                        CLI_PRINT("%c", c)
-                    }
-                    else
-                    {
-                        print_newline(StringPtr, StringIdx);
-                    }
-                }
+    if (num == 0)
+    {
+        return;
+    }
+
+    if ((num > 1) && (common == wlen))
+    {
+        CLI_ECHO("\n");
+        for (int i = *node_children(t, node); i != NODE_NONE; i = t->List[i].Sibling)
+        {
+            CliCommand_TypeDef *c = &t->List[i];
+            if ((c->NameLen >= wlen) && (strncmp(c->Name, word, wlen) == 0))
+            {
+                CLI_ECHO("%.*s  ", c->NameLen, c->Name);
             }
+        }
+        CLI_ECHO("\n");
+        print_newline(StringPtr, StringIdx);
+        return;
+    }
+
+    // Insert the rest of the name, and a space after a unique match.
+    const char *rest = t->List[match].Name + wlen;
+    int len = common - wlen + (num == 1);
+    for (int i = 0; (i < len) && (strlen(StringPtr) < CLI_STR_BUF_SIZE - 2); i++)
+    {
+        insert_char(StringPtr, (i < common - wlen) ? rest[i] : ' ', StringIdx);
+        StringIdx++;
+    }
+    print_newline(StringPtr, StringIdx);
+}
+
+/*!@brief Tab completion on a snapshot of the command table.
+ */
+static void cli_complete(void)
+{
+    unsigned int idx;
+    CliTable_TypeDef *t = table_read_lock(&idx);
+
+    complete_table(t);
+    table_read_unlock(idx);
+}
+
+/*!@brief Get a byte from the input of the running session, or of the port.
+ */
+static int cli_input(void)
+{
+#if CLI_SESSION_ENABLE
+    if (CliSessionCur != NULL)
+    {
+        return CliSessionCur->Getc(CliSessionCur->Arg);
+    }
+#endif
+    return cli_port_getc();
+}
+
+#if CLI_CANCEL_ENABLE
+/*!@brief Look for Ctrl-C in the input while the console job runs. Other
+ *        bytes are kept for cli_getline, up to CLI_CANCEL_AHEAD_SIZE, the rest
+ *        waits in the port. Ctrl-C cancels the job and drops the bytes typed
+ *        ahead of it, like a terminal does.
+ */
+static void cancel_poll(void)
+{
+    while (CancelAheadLen < CLI_CANCEL_AHEAD_SIZE)
+    {
+        int c = cli_input();
+        if (c < 0)
+        {
             break;
         }
+        if (c == '\x03')
+        {
+            CliConsoleJob.Cancel = CLI_CANCEL_USER;
+            CancelAheadLen = 0;
+            CancelAheadIdx = 0;
+            CLI_ECHO("^C\n");
+            break;
         }
-    } while ((c != '\xff') && (c != EOF));
+        CancelAhead[CancelAheadLen++] = c;
+    }
+}
 
-    return NULL;
+#endif
+/*!@brief Get a byte of console input, the bytes typed while the last command
+ *        line ran come first.
+ */
+static int cli_getc(void)
+{
+#if CLI_CANCEL_ENABLE
+    if (CancelAheadIdx < CancelAheadLen)
+    {
+        int c = (unsigned char) CancelAhead[CancelAheadIdx++];
+        if (CancelAheadIdx == CancelAheadLen)
+        {
+            CancelAheadIdx = 0;
+            CancelAheadLen = 0;
+        }
+        return c;
+    }
+#endif
+    return cli_input();
 }
 
-/*!@brief   String to Arguments
+/*!@brief Get a line for CLI.
+ *        This function will check input from cli_port_getc() function.
+ *        Put them to buffer until get a new line "\n".
  *
- * @param str   Input string
- * @param argc  Output argument count
- * @param argv  Output argument vector
- * @return      Pointer to the tail of the string is not processed, or NULL for
- * all string is processed.
+ * @return Pointer to the line or NULL for no line is get.
  */
-char *cli_strtoarg(char *str, int *argc, char **argv)
+char *cli_getline(void)
 {
-    if ((str == NULL) || (argc == NULL) || (argv == NULL))
+    if (StringPtr == NULL)
     {
-        return NULL;
+        return 0;
     }
 
-    *argc = 0;
-    char flag_quote = 0; // Flags for inside 2x quote mark ""
-    char flag_arg_head = 0; // Flags to mark argument head
+    char c = 0;
 
-    for (int i = 0; str[i] != 0; i++)
+    do
     {
-        switch (str[i])
+        // Get 1 char and check
+        c = cli_getc();
+
+#if CLI_STREAM_ARG_ENABLE
+        // Payload of a stream command goes to the command, the line buffer
+        // keeps the command name to run when the line ends.
+        if ((StreamNode != NODE_NONE) && (c != '\x0') && (c != '\xff'))
         {
-        case '#':
+            int end = stream_char(c);
+            if (end == 0)
+            {
+                continue;
+            }
+            if (end < 0)
+            {
+                StreamChunk(CLI_CHUNK_ABORT, NULL, 0);
+                StreamNode = NODE_NONE;
+                memset(StringPtr, 0, CLI_STR_BUF_SIZE);
+                CLI_ECHO("^C\n");
+            }
+            else
+            {
+                strcat(StringPtr, "\n");
+            }
+            StreamCheck = 1;
+            StringIdx = 0;
+            return StringPtr;
+        }
+
+#endif
+#if CLI_PASTE_ENABLE
+        // Pasted bytes are stored without echo, a complete line is drawn
+        // once and returned like an ENTER, the rest stays in the input.
+        if (PasteFlag)
         {
-            // Ignore comment lines
-            return NULL;
+            if (paste_char(c) == 0)
+            {
+                continue;
+            }
+            print_newline(StringPtr, StringIdx);
+            c = '\n';
         }
-        case '"':
+
+#endif
+        // Handle characters
+        switch (c)
+        {
+        case '\x0':  // NULL
+        case '\xff': // EOF
         {
-            // Set ignore flag up. string inside "" will not be processed.
-            flag_quote = !flag_quote;
-            str[i] = 0;
             break;
         }
-        case ';':
+        case '\x7f': // Delete for MacOs keyboard
+        case '\b':   // Backspace PC keyboard
         {
-            // Command separator, return tail commands for next process.
-            if (flag_quote == 0)
-            {
+#if CLI_STREAM_ARG_ENABLE
+            StreamCheck = 1;
+#endif
+            if (StringIdx > 0)
+            {
+                // Delete 1 byte from buffer.
+                delete_char(StringPtr, StringIdx);
+                StringIdx--;
+                // Print New line
+                print_newline(StringPtr, StringIdx);
+            }
+            break;
+        }
+        case '\t': // Tab
+        {
+            cli_complete();
+            break;
+        }
+#if CLI_CANCEL_ENABLE
+        case '\x03': // Ctrl-C, drop the line
+        {
+            memset(StringPtr, 0, CLI_STR_BUF_SIZE);
+            StringIdx = 0;
+#if HISTORY_ENABLE
+            HistoryPullDepth = 0;
+#endif
+#if CLI_STREAM_ARG_ENABLE
+            StreamCheck = 1;
+#endif
+#if CLI_SUGGEST_ENABLE
+            suggest_hide();
+#endif
+            CLI_ECHO("^C\n%s", CLI_PROMPT_CHAR);
+            break;
+        }
+#endif
+        case '\r': // CR
+        case '\n': // LF
+        {
+#if HISTORY_ENABLE
+            // Push to history without \'n'
+            if (StringIdx > 0)
+            {
+                history_push(StringPtr);
+            }
+            HistoryPullDepth = 0;
+#endif
+#if CLI_SUGGEST_ENABLE
+            if (StringPtr[0] != 0)
+            {
+                cli_suggest_add(StringPtr);
+            }
+            suggest_hide();
+#endif
+
+            // Echo back
+            strcat(StringPtr, "\n");
+            CLI_ECHO("\n");
+#if CLI_STREAM_ARG_ENABLE
+            StreamCheck = 1;
+#endif
+
+            // Return pointer and length
+            StringIdx = 0;
+            return StringPtr;
+        }
+        default:
+        {
+            // Handle special keys first
+            if (handle_special_key(c) == 0)
+            {
+                return 0;
+            }
+            else
+            {
+                if (strlen(StringPtr) < CLI_STR_BUF_SIZE - 2)
+                {
+                    // Insert 1 byte to buffer
+                    insert_char(StringPtr, c, StringIdx);
+                    StringIdx++;
+
+                    // Loop back a char or line
+                    if (StringPtr[StringIdx] == 0)
+                    {
+                        CLI_ECHO("%c", c)
+#if CLI_STREAM_ARG_ENABLE
+                        if (c == ' ')
+                        {
+                            stream_detect();
+                        }
+#endif
+#if CLI_SUGGEST_ENABLE
+                        suggest_show();
+#endif
+                    }
+                    else
+                    {
+                        print_newline(StringPtr, StringIdx);
+                    }
+                }
+                else
+                {
+                    // Line is full, ring the bell instead of dropping silently.
+                    CLI_ECHO("\a");
+                }
+            }
+            break;
+        }
+        }
+    } while ((c != '\xff') && (c != EOF));
+
+    return NULL;
+}
+
+/*!@brief   String to Arguments
+ *
+ * @param str   Input string
+ * @param argc  Output argument count
+ * @param argv  Output argument vector
+ * @return      Pointer to the tail of the string is not processed, or NULL for
+ * all string is processed.
+ */
+char *cli_strtoarg(char *str, int *argc, char **argv)
+{
+    if ((str == NULL) || (argc == NULL) || (argv == NULL))
+    {
+        return NULL;
+    }
+
+    *argc = 0;
+    char flag_quote = 0; // Flags for inside 2x quote mark ""
+    char flag_arg_head = 0; // Flags to mark argument head
+
+    for (int i = 0; str[i] != 0; i++)
+    {
+        switch (str[i])
+        {
+        case '#':
+        {
+            // Ignore comment lines
+            return NULL;
+        }
+        case '"':
+        {
+            // Set ignore flag up. string inside "" will not be processed.
+            flag_quote = !flag_quote;
+            str[i] = 0;
+            break;
+        }
+        case ';':
+        {
+            // Command separator, return tail commands for next process.
+            if (flag_quote == 0)
+            {
                 str[i] = 0;
                 char *tail = str + i + 1;
 
@@ -816,141 +2375,1496 @@ char *cli_strtoarg(char *str, int *argc, char **argv)
             }
             break;
         }
-        case '\t':
-        case ' ':
-        case '\r':
-        case '\n':
+        case '\t':
+        case ' ':
+        case '\r':
+        case '\n':
+        {
+            // Separators
+            if (flag_quote == 0)
+            {
+                str[i] = 0;
+                flag_arg_head = 0;
+            }
+            break;
+        }
+        default:
+        {
+            // Normal characters, save argument pointer.
+            if ((flag_arg_head == 0) && (*argc < CLI_ARGC_MAX))
+            {
+                argv[*argc] = &str[i];
+                (*argc)++;
+            }
+            flag_arg_head = 1;
+            break;
+        }
+        }
+    }
+
+    return NULL;
+}
+
+char *Cli_TimeStampStr(void)
+{
+
+    static char timestamp[16] = { 0 };
+
+    uint32_t tick = cli_gettick();
+
+    sprintf(timestamp, "[%03u.%03u]", tick / 1000, tick % 1000);
+
+    return timestamp;
+}
+
+/*!@brief   Write to CLI output.
+ *          Goes to the output set by Cli_SetOutput(), or to the port.
+ *          Echo is dropped in machine-readable mode.
+ *
+ * @param   stream  CLI_STREAM_OUT/ERR/ECHO
+ * @param   buf     Bytes to write
+ * @param   len     Number of bytes
+ * @return  Number of bytes written.
+ */
+int Cli_Write(int stream, const char *buf, int len)
+{
+    if ((stream == CLI_STREAM_ECHO) && (gCliMode != CLI_MODE_TEXT))
+    {
+        return len;
+    }
+
+    if (CliOutputCur != NULL)
+    {
+        return CliOutputCur->Write(CliOutputCur->Arg, stream, buf, len);
+    }
+
+    return cli_port_write(stream, buf, len);
+}
+
+/*!@brief   vprintf to CLI output.
+ */
+static int cli_vprintf(int stream, const char *format, va_list args)
+{
+    char buf[CLI_STR_BUF_SIZE];
+    va_list copy;
+
+    va_copy(copy, args);
+    int len = vsnprintf(buf, sizeof(buf), format, copy);
+    va_end(copy);
+
+    if (len < (int) sizeof(buf))
+    {
+        return (len > 0) ? Cli_Write(stream, buf, len) : len;
+    }
+
+    // Long output, format it again in a buffer large enough.
+    char *big = cli_malloc(len + 1);
+    if (big == NULL)
+    {
+        return Cli_Write(stream, buf, sizeof(buf) - 1);
+    }
+    vsnprintf(big, len + 1, format, args);
+    len = Cli_Write(stream, big, len);
+    cli_free(big);
+
+    return len;
+}
+
+/*!@brief   printf to CLI output.
+ *
+ * @param   stream  CLI_STREAM_OUT/ERR/ECHO
+ * @param   format  printf format
+ * @return  Number of bytes written.
+ */
+int Cli_Printf(int stream, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    int len = cli_vprintf(stream, format, args);
+    va_end(args);
+
+    return len;
+}
+
+/*!@brief   Print a log message, used by CLI_ERROR/CLI_WARNING/CLI_INFO.
+ *          Terminal output gets color & time stamp, machine-readable output
+ *          gets the plain message. A message is written at once when it fits
+ *          in a line buffer, so a busy link can drop a WARNING/INFO whole.
+ *
+ * @param   level   1 error, 2 warning, 3 info
+ * @param   file    Source file
+ * @param   line    Source line
+ * @param   format  printf format
+ */
+void Cli_Log(int level, const char *file, int line, const char *format, ...)
+{
+    static const char *const color[] = { "", ANSI_RED, ANSI_YELLOW, ANSI_MAGENTE };
+    int stream = (level == 1) ? CLI_STREAM_ERR : CLI_STREAM_LOG;
+    int reset = (gCliMode == CLI_MODE_TEXT) ? strlen(ANSI_RESET) : 0;
+    char buf[CLI_STR_BUF_SIZE];
+    int head = 0;
+    va_list args;
+
+    if (gCliMode == CLI_MODE_TEXT)
+    {
+        if (level < 3)
+        {
+            head = snprintf(buf, sizeof(buf), "%s%s <%s:%d> ", color[level], Cli_TimeStampStr(),
+                            file, line);
+        }
+        else
+        {
+            head = snprintf(buf, sizeof(buf), "%s%s ", color[level], Cli_TimeStampStr());
+        }
+        head = (head < (int) sizeof(buf)) ? head : sizeof(buf) - 1;
+    }
+
+    va_start(args, format);
+    int len = vsnprintf(&buf[head], sizeof(buf) - head, format, args);
+    va_end(args);
+    len = (len > 0) ? len : 0;
+
+    if (head + len + reset < (int) sizeof(buf))
+    {
+        memcpy(&buf[head + len], ANSI_RESET, reset);
+        Cli_Write(stream, buf, head + len + reset);
+        return;
+    }
+
+    // Long message, write it in pieces.
+    Cli_Write(stream, buf, head);
+    va_start(args, format);
+    cli_vprintf(stream, format, args);
+    va_end(args);
+    Cli_Write(stream, ANSI_RESET, reset);
+}
+
+/*!@brief   Set where CLI output goes.
+ *
+ * @param   output  New output, NULL for the port.
+ * @return  The output in use before.
+ */
+CliOutput_TypeDef *Cli_SetOutput(CliOutput_TypeDef *output)
+{
+    CliOutput_TypeDef *prev = CliOutputCur;
+    CliOutputCur = output;
+    return prev;
+}
+
+/*!@brief   Capture output to buffer, stripping echo & ANSI escape sequences.
+ */
+static int capture_write(void *arg, int stream, const char *buf, int len)
+{
+    CliCapture_TypeDef *cap = arg;
+
+    if (stream == CLI_STREAM_ECHO)
+    {
+        return len;
+    }
+
+    for (int i = 0; i < len; i++)
+    {
+        char c = buf[i];
+
+        // Escape sequence runs from ESC to a letter.
+        if (c == '\e')
+        {
+            cap->Esc = 1;
+        }
+        else if (cap->Esc)
+        {
+            cap->Esc = !(((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')));
+        }
+        else if (c == '\r')
+        {
+            ;
+        }
+        else if (cap->Len < cap->Size)
+        {
+            cap->Buf[cap->Len++] = c;
+        }
+        else
+        {
+            cap->Lost++;
+        }
+    }
+
+    return len;
+}
+
+/*!@brief   Initialize a capture on a buffer.
+ *
+ * @param   capture Capture to initialize
+ * @param   buf     Buffer
+ * @param   size    Size of the buffer
+ */
+void Cli_CaptureInit(CliCapture_TypeDef *capture, char *buf, int size)
+{
+    memset(capture, 0, sizeof(CliCapture_TypeDef));
+    capture->Output.Write = capture_write;
+    capture->Output.Arg = capture;
+    capture->Buf = buf;
+    capture->Size = size;
+}
+
+/*!@brief   Set output mode.
+ *
+ * @param   mode    CLI_MODE_TEXT: interactive terminal.
+ *                  CLI_MODE_JSON: no echo, prompt & colors, every command line
+ *                  is answered by one JSON record, see CliRecord_TypeDef.
+ */
+void Cli_SetMode(int mode)
+{
+    gCliMode = mode;
+}
+
+/*!@brief   Write bytes as the content of a JSON string.
+ */
+static void json_write_string(const char *str, int len)
+{
+    char buf[CLI_STR_BUF_SIZE];
+    int n = 0;
+
+    for (int i = 0; i < len; i++)
+    {
+        unsigned char c = str[i];
+
+        // Flush before the buffer can overflow with the longest escape.
+        if (n > (int) sizeof(buf) - 8)
+        {
+            Cli_Write(CLI_STREAM_OUT, buf, n);
+            n = 0;
+        }
+
+        if ((c == '"') || (c == '\\'))
+        {
+            buf[n++] = '\\';
+            buf[n++] = c;
+        }
+        else if (c == '\n')
+        {
+            buf[n++] = '\\';
+            buf[n++] = 'n';
+        }
+        else if (c == '\t')
+        {
+            buf[n++] = '\\';
+            buf[n++] = 't';
+        }
+        else if (c < 0x20)
+        {
+            n += sprintf(&buf[n], "\\u%04x", c);
+        }
+        else
+        {
+            buf[n++] = c;
+        }
+    }
+
+    Cli_Write(CLI_STREAM_OUT, buf, n);
+}
+
+/*!@brief   Open a JSON record for a command line before its job starts.
+ *          Nothing is done in text mode.
+ *
+ * @param   record  Record, its capture buffer is allocated on first use.
+ * @param   plan    Command line
+ * @return  Output to start the job of the line with, NULL for the default.
+ */
+CliOutput_TypeDef *Cli_RecordBegin(CliRecord_TypeDef *record, CliPlan_TypeDef *plan)
+{
+    record->Plan = NULL;
+
+    if ((gCliMode != CLI_MODE_JSON) || (plan == NULL))
+    {
+        return NULL;
+    }
+
+    if (record->Capture.Buf == NULL)
+    {
+        char *buf = cli_malloc(CLI_CAPTURE_SIZE);
+        if (buf == NULL)
+        {
+            return NULL;
+        }
+        Cli_CaptureInit(&record->Capture, buf, CLI_CAPTURE_SIZE);
+    }
+
+    record->Capture.Len = 0;
+    record->Capture.Lost = 0;
+    record->Capture.Esc = 0;
+    record->Plan = plan;
+    record->Start = cli_getnanos();
+    plan->RefCount++;
+    return &record->Capture.Output;
+}
+
+/*!@brief   Close a JSON record when its job is finished, and write it out.
+ *
+ * @param   record  Record opened by Cli_RecordBegin()
+ * @param   ret     Return value of the command line
+ */
+void Cli_RecordEnd(CliRecord_TypeDef *record, int ret)
+{
+    if (record->Plan == NULL)
+    {
+        return;
+    }
+
+    unsigned long long us = (cli_getnanos() - record->Start) / 1000;
+    const char *cmd = record->Plan->Source;
+    int len = strlen(cmd);
+
+    while ((len > 0) && ((cmd[len - 1] == '\n') || (cmd[len - 1] == '\r')))
+    {
+        len--;
+    }
+
+    Cli_Write(CLI_STREAM_OUT, "{\"cmd\":\"", 8);
+    json_write_string(cmd, len);
+    Cli_Printf(CLI_STREAM_OUT, "\",\"ret\":%d,\"us\":%llu,", ret, us);
+    if (record->Timer != 0)
+    {
+        Cli_Printf(CLI_STREAM_OUT, "\"timer\":%u,", record->Timer);
+    }
+    if (record->Capture.Lost != 0)
+    {
+        Cli_Printf(CLI_STREAM_OUT, "\"trunc\":%d,", record->Capture.Lost);
+    }
+    Cli_Write(CLI_STREAM_OUT, "\"out\":\"", 7);
+    json_write_string(record->Capture.Buf, record->Capture.Len);
+    Cli_Write(CLI_STREAM_OUT, "\"}\n", 3);
+
+    Cli_PlanFree(record->Plan);
+    record->Plan = NULL;
+}
+
+/*!@brief   Hash of a parent node & a child name, used for child lookup.
+ */
+static unsigned int node_hash(int parent, const char *name, int len)
+{
+    uint32_t hash = (2166136261u ^ (uint32_t) (parent + 1)) * 16777619u;
+
+    for (int i = 0; i < len; i++)
+    {
+        hash ^= (uint8_t) name[i];
+        hash *= 16777619u;
+    }
+
+    return hash & (CLI_COMMAND_HASH_SIZE - 1);
+}
+
+/*!@brief   Sibling list head of a parent node.
+ */
+static short *node_children(CliTable_TypeDef *t, int parent)
+{
+    return (parent == NODE_NONE) ? &t->Root : &t->List[parent].Child;
+}
+
+/*!@brief   Find a child command by name.
+ *
+ * @param   parent  Parent node, NODE_NONE for top level
+ * @param   name    Name, not need to be NUL terminated
+ * @param   len     Length of name
+ * @return  Node of the child or NODE_NONE if not found.
+ */
+static int node_find(const CliTable_TypeDef *t, int parent, const char *name, int len)
+{
+    for (int i = t->Hash[node_hash(parent, name, len)]; i != NODE_NONE; i = t->List[i].HashNext)
+    {
+        const CliCommand_TypeDef *cmd = &t->List[i];
+        if ((cmd->Parent == parent) && (cmd->NameLen == len) && (strncmp(cmd->Name, name, len) == 0))
+        {
+            return i;
+        }
+    }
+
+    return NODE_NONE;
+}
+
+/*!@brief   Add a child command, it's linked after the last sibling so help
+ *          keeps the order of registration.
+ *
+ * @return  Node of the child or NODE_NONE if the list is full.
+ */
+static int node_add(CliTable_TypeDef *t, int parent, const char *name, int len)
+{
+    for (int i = 0; i < CLI_COMMAND_SIZE; i++)
+    {
+        CliCommand_TypeDef *cmd = &t->List[i];
+        if (cmd->Name != NULL)
+        {
+            continue;
+        }
+
+        unsigned int bucket = node_hash(parent, name, len);
+        cmd->Name = name;
+        cmd->NameLen = len;
+        cmd->Builtin = CliRegBuiltin;
+        cmd->Prompt = NODE_GROUP_PROMPT;
+        cmd->Func = NULL;
+#if CLI_STREAM_ARG_ENABLE
+        cmd->Chunk = NULL;
+#endif
+#if CLI_CANCEL_ENABLE
+        cmd->Timeout = 0;
+#endif
+        cmd->Parent = parent;
+        cmd->Child = NODE_NONE;
+        cmd->Sibling = NODE_NONE;
+        cmd->HashNext = t->Hash[bucket];
+        t->Hash[bucket] = i;
+
+        short *link = node_children(t, parent);
+        while (*link != NODE_NONE)
+        {
+            link = &t->List[*link].Sibling;
+        }
+        *link = i;
+
+        t->Num++;
+        return i;
+    }
+
+    return NODE_NONE;
+}
+
+/*!@brief   Remove a command without sub commands from the tree.
+ */
+static void node_remove(CliTable_TypeDef *t, int node)
+{
+    CliCommand_TypeDef *cmd = &t->List[node];
+    short *link = &t->Hash[node_hash(cmd->Parent, cmd->Name, cmd->NameLen)];
+
+    while (*link != node)
+    {
+        link = &t->List[*link].HashNext;
+    }
+    *link = cmd->HashNext;
+
+    link = node_children(t, cmd->Parent);
+    while (*link != node)
+    {
+        link = &t->List[*link].Sibling;
+    }
+    *link = cmd->Sibling;
+
+    memset(cmd, 0, sizeof(CliCommand_TypeDef));
+    t->Num--;
+}
+
+/*!@brief   Find a command by its full name, e.g. "net if show".
+ *
+ * @return  Node of the command or NODE_NONE if not found.
+ */
+static int node_find_path(const CliTable_TypeDef *t, const char *name)
+{
+    int node = NODE_NONE;
+
+    while (*name != 0)
+    {
+        int len = strcspn(name, " ");
+        if (len != 0)
+        {
+            node = node_find(t, node, name, len);
+            if (node == NODE_NONE)
+            {
+                return NODE_NONE;
+            }
+        }
+        name += len + (name[len] == ' ');
+    }
+
+    return node;
+}
+
+/*!@brief   Enter a read section of the command table, it may be nested.
+ *          The table returned is not changed until the section is left,
+ *          writers publish a new version meanwhile. No lock is taken, the
+ *          reader only counts itself in the counter of the current epoch.
+ *          The epoch is read again once counted: a reader that is counted
+ *          after a flip under the old epoch may not be waited for, it moves
+ *          to the new one.
+ *
+ * @param   idx     Output, counter to leave the section with
+ * @return  The published table.
+ */
+static CliTable_TypeDef *table_read_lock(unsigned int *idx)
+{
+    for (;;)
+    {
+        unsigned int epoch = __atomic_load_n(&CliTableEpoch, __ATOMIC_SEQ_CST);
+        *idx = epoch & 1;
+        __atomic_add_fetch(&CliTableReaders[*idx], 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&CliTableEpoch, __ATOMIC_SEQ_CST) == epoch)
+        {
+            break;
+        }
+        __atomic_sub_fetch(&CliTableReaders[*idx], 1, __ATOMIC_RELEASE);
+    }
+    return __atomic_load_n(&CliTable, __ATOMIC_SEQ_CST);
+}
+
+static void table_read_unlock(unsigned int idx)
+{
+    __atomic_sub_fetch(&CliTableReaders[idx], 1, __ATOMIC_RELEASE);
+}
+
+/*!@brief   Start a change of the command table, writers are serialized.
+ *          The change is made on a copy of the published table, in the
+ *          buffer of the version before it. No reader is left in that one,
+ *          the last writer has waited for them when it published.
+ *
+ * @return  Copy of the published table to change.
+ */
+static CliTable_TypeDef *table_write_begin(void)
+{
+    while (__atomic_test_and_set(&CliTableLock, __ATOMIC_ACQUIRE))
+    {
+    }
+
+    CliTable_TypeDef *t = (CliTable == &CliTableBuf[0]) ? &CliTableBuf[1] : &CliTableBuf[0];
+    memcpy(t, CliTable, sizeof(CliTable_TypeDef));
+    return t;
+}
+
+/*!@brief   End a change of the command table.
+ *          The new version is published and the epoch flips, new readers
+ *          count themselves in the other counter. Then the readers counted
+ *          under the old epoch are waited for, they are the only ones that
+ *          may still see the old version: the readers of the epoch before
+ *          were waited for by the last writer, and a reader can't be counted
+ *          under an epoch once it has flipped.
+ *
+ * @param   t       Table from table_write_begin()
+ * @param   publish 0 to drop the change
+ */
+static void table_write_end(CliTable_TypeDef *t, int publish)
+{
+    if (publish)
+    {
+        __atomic_store_n(&CliTable, t, __ATOMIC_SEQ_CST);
+        unsigned int old = __atomic_fetch_add(&CliTableEpoch, 1, __ATOMIC_SEQ_CST) & 1;
+        __atomic_add_fetch(&CliCommandGen, 1, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&CliTableReaders[old], __ATOMIC_SEQ_CST) != 0)
+        {
+            cli_sleep(0);
+        }
+    }
+    __atomic_clear(&CliTableLock, __ATOMIC_RELEASE);
+}
+
+/*!@brief   Add a command to the table, see Cli_Register().
+ */
+static int cli_register(const char *name, const char *prompt, int (*func)(int, char **),
+                        int (*chunk)(int, const char *, int), unsigned int timeout)
+{
+    if ((name == NULL) || (prompt == NULL))
+    {
+        return CLI_FAIL;
+    }
+
+    CliTable_TypeDef *t = table_write_begin();
+    int parent = NODE_NONE;
+    const char *word = name;
+
+    for (;;)
+    {
+        while (*word == ' ')
+        {
+            word++;
+        }
+
+        int len = strcspn(word, " ");
+        if ((len == 0) || (len > UINT8_MAX))
+        {
+            table_write_end(t, 0);
+            return CLI_FAIL;
+        }
+
+        const char *next = word + len;
+        while (*next == ' ')
+        {
+            next++;
+        }
+
+        int node = node_find(t, parent, word, len);
+        if (*next != 0)
+        {
+            // A group on the way.
+            parent = (node != NODE_NONE) ? node : node_add(t, parent, word, len);
+            if (parent == NODE_NONE)
+            {
+                table_write_end(t, 0);
+                return CLI_FAIL;
+            }
+            word = next;
+            continue;
+        }
+
+        // The command itself, it may take over a group that was created before.
+        if (node == NODE_NONE)
+        {
+            node = node_add(t, parent, word, len);
+        }
+        else if (t->List[node].Func != NULL)
+        {
+            table_write_end(t, 0);
+            return CLI_FAIL;
+        }
+
+        if (node != NODE_NONE)
+        {
+            t->List[node].Prompt = prompt;
+            t->List[node].Func = func;
+#if CLI_STREAM_ARG_ENABLE
+            t->List[node].Chunk = chunk;
+#endif
+#if CLI_CANCEL_ENABLE
+            t->List[node].Timeout = timeout;
+#endif
+        }
+        table_write_end(t, node != NODE_NONE);
+        return node;
+    }
+}
+
+/*!@brief   Register a command to CLI.
+ *          A name of several words registers a sub command, groups on the
+ *          way are created when they don't exist.
+ * @example Cli_Register("help","show help text",&builtin_help);
+ *          Cli_Register("net if show","show network interfaces",&net_if_show);
+ *
+ * @param   name      Command name, it must be kept as long as the command is registered.
+ * @param   prompt    Command prompt text
+ * @param   func      Pointer to function to run when the command is called,
+ *                    or NULL to register a group.
+ *
+ * @retval  index    The index of the command is inserted in the command list.
+ * @retval  -1       Command register fail.
+ */
+int Cli_Register(const char *name, const char *prompt, int (*func)(int, char **))
+{
+    return cli_register(name, prompt, func, NULL, 0);
+}
+
+/*!@brief   Register a command with a time limit. A command line is cancelled
+ *          when the command runs longer, see Cli_Cancelled(). A command that
+ *          yields & doesn't check it is dropped on its next resume, a command
+ *          that never returns can't be stopped.
+ * @example Cli_RegisterTimeout("flash erase", "Erase flash", &flash_erase, 30000);
+ *
+ * @param   name      Command name, see Cli_Register()
+ * @param   prompt    Command prompt text
+ * @param   func      Pointer to function to run when the command is called
+ * @param   timeout   Time limit in ms, 0 for none
+ * @retval  index    The index of the command is inserted in the command list.
+ * @retval  -1       Command register fail.
+ */
+int Cli_RegisterTimeout(const char *name, const char *prompt, int (*func)(int, char **),
+                        unsigned int timeout)
+{
+    return cli_register(name, prompt, func, NULL, timeout);
+}
+
+#if CLI_STREAM_ARG_ENABLE
+/*!@brief   Function of every stream command. A payload typed on the console
+ *          has been passed in chunks as it came in, it's only ended here.
+ *          Arguments of a command from elsewhere, e.g. a script or "rpc", are
+ *          passed as the payload, separated by a space.
+ */
+static int stream_exec(int argc, char **args)
+{
+    int (*chunk)(int, const char *, int) = StreamChunk;
+    int ret = StreamRet;
+
+    if ((StreamNode == CliCommandCur) && (CliJobCur == &CliConsoleJob))
+    {
+        StreamNode = NODE_NONE;
+    }
+    else
+    {
+        unsigned int idx;
+        chunk = table_read_lock(&idx)->List[CliCommandCur].Chunk;
+        table_read_unlock(idx);
+        if (chunk == NULL)
+        {
+            return CLI_FAIL;
+        }
+
+        ret = chunk(CLI_CHUNK_BEGIN, NULL, 0);
+        for (int i = 1; (i < argc) && (ret == 0); i++)
+        {
+            ret = (i > 1) ? chunk(CLI_CHUNK_DATA, " ", 1) : 0;
+            ret = (ret == 0) ? chunk(CLI_CHUNK_DATA, args[i], strlen(args[i])) : ret;
+        }
+    }
+
+    if (ret != 0)
+    {
+        chunk(CLI_CHUNK_ABORT, NULL, 0);
+        return ret;
+    }
+    return chunk(CLI_CHUNK_END, NULL, 0);
+}
+
+/*!@brief   Register a stream command, which takes a payload of any length.
+ *          On the console the rest of the line after the command name is its
+ *          payload, passed to the consumer in chunks of CLI_STREAM_CHUNK_SIZE
+ *          as it comes in, so neither CLI_STR_BUF_SIZE nor CLI_ARGC_MAX limit
+ *          it. The consumer gets CLI_CHUNK_BEGIN, CLI_CHUNK_DATA for each
+ *          chunk, and CLI_CHUNK_END for the result of the command, or
+ *          CLI_CHUNK_ABORT when a chunk has failed or the line is cancelled.
+ * @example Cli_RegisterStream("cal load", "Load calibration hex", &cal_load);
+ *
+ * @param   name      Command name, see Cli_Register()
+ * @param   prompt    Command prompt text
+ * @param   chunk     Payload consumer, return 0 to go on or an error
+ * @retval  index    The index of the command is inserted in the command list.
+ * @retval  -1       Command register fail.
+ */
+int Cli_RegisterStream(const char *name, const char *prompt,
+                       int (*chunk)(int event, const char *buf, int len))
+{
+    if (chunk == NULL)
+    {
+        return CLI_FAIL;
+    }
+
+    return cli_register(name, prompt, &stream_exec, chunk, 0);
+}
+#endif /* CLI_STREAM_ARG_ENABLE */
+
+/*!@brief   Unregister a command by its full name.
+ *          A command with sub commands becomes a group, and a group left
+ *          without sub commands & function is removed too.
+ *
+ * @param   name      Command name
+ * @retval  index    The index of the command in the command list.
+ * @retval  -1       Command not found.
+ */
+int Cli_Unregister(const char *name)
+{
+    if ((name == NULL) || (name[0] == 0))
+    {
+        return CLI_FAIL;
+    }
+
+    CliTable_TypeDef *t = table_write_begin();
+    int node = node_find_path(t, name);
+    if (node == NODE_NONE)
+    {
+        table_write_end(t, 0);
+        return CLI_FAIL;
+    }
+
+    if (t->List[node].Child != NODE_NONE)
+    {
+        t->List[node].Prompt = NODE_GROUP_PROMPT;
+        t->List[node].Func = NULL;
+#if CLI_STREAM_ARG_ENABLE
+        t->List[node].Chunk = NULL;
+#endif
+#if CLI_CANCEL_ENABLE
+        t->List[node].Timeout = 0;
+#endif
+    }
+    else
+    {
+        for (int n = node; (n != NODE_NONE) && (t->List[n].Child == NODE_NONE)
+                && ((n == node) || (t->List[n].Func == NULL));)
+        {
+            int parent = t->List[n].Parent;
+            node_remove(t, n);
+            n = parent;
+        }
+    }
+
+    table_write_end(t, 1);
+    return node;
+}
+
+/*!@brief   Find the command of an argument vector, walking down groups.
+ *          Each level is one hashed lookup, so it costs O(depth).
+ *
+ * @param   argc    Argument count
+ * @param   argv    Argument vector, e.g. "net" "if" "show" "eth0"
+ * @param   depth   Output, number of arguments that are command names
+ * @return  Node of the command or NODE_NONE if not found.
+ */
+static int cli_resolve(const CliTable_TypeDef *t, int argc, char **argv, int *depth)
+{
+    int node = NODE_NONE;
+    int d = 0;
+
+    while (d < argc)
+    {
+        int child = node_find(t, node, argv[d], strlen(argv[d]));
+        if (child == NODE_NONE)
+        {
+            break;
+        }
+
+        node = child;
+        d++;
+        if (t->List[node].Child == NODE_NONE)
+        {
+            break;
+        }
+    }
+
+    *depth = d;
+    return node;
+}
+
+/*!@brief   Get the running command.
+ *
+ * @return  Index of the command in the command list, or -1 when called
+ *          outside of a command.
+ */
+int Cli_CommandSelf(void)
+{
+    return CliCommandCur;
+}
+
+/*!@brief   Get the resume state of the running command.
+ *
+ * @return  Pointer to the state, or NULL when called outside of a command.
+ */
+CliPt_TypeDef *Cli_PtSelf(void)
+{
+    if ((CliJobCur == NULL) || (CliJobCur->Depth == 0))
+    {
+        return NULL;
+    }
+
+    return &CliJobCur->Frame[CliJobCur->Depth - 1];
+}
+
+#if CLI_CANCEL_ENABLE
+/*!@brief   Check if a nesting level has run longer than its time limit.
+ */
+static int frame_expired(const CliPt_TypeDef *pt, unsigned int now)
+{
+    return (pt->Timeout != 0) && (now - pt->Start >= pt->Timeout);
+}
+
+#endif
+/*!@brief   Check if the running command line is cancelled, by Ctrl-C on the
+ *          console or because the command, or a command it runs, has timed
+ *          out. A command that loops or waits should check it and return
+ *          CLI_CANCELLED, after it has released what it holds. It's cheap,
+ *          the console is read ahead for Ctrl-C every CANCEL_POLL_MS, so a
+ *          command that ends sooner, e.g. "rpc", leaves its input alone.
+ * @example CLI_PT_WAIT_UNTIL(pt, Cli_Cancelled() || device_ready());
+ *
+ * @return  0, CLI_CANCEL_USER or CLI_CANCEL_TIMEOUT.
+ */
+int Cli_Cancelled(void)
+{
+    CliJob_TypeDef *job = CliJobCur;
+    if (job == NULL)
+    {
+        return 0;
+    }
+
+#if CLI_CANCEL_ENABLE
+    unsigned int now = cli_gettick();
+    if ((job == &CliConsoleJob) && (now - CancelTick >= CANCEL_POLL_MS))
+    {
+        CancelTick = now;
+        cancel_poll();
+    }
+#endif
+    if (job->Cancel != 0)
+    {
+        return job->Cancel;
+    }
+
+#if CLI_CANCEL_ENABLE
+    // A level that has timed out cancels the levels it runs, not its caller.
+    for (int i = 0; i < job->Depth; i++)
+    {
+        if (frame_expired(&job->Frame[i], now))
+        {
+            return CLI_CANCEL_TIMEOUT;
+        }
+    }
+#endif
+    return 0;
+}
+
+/*!@brief   Enter one nesting level of the running job.
+ *
+ * @return  Resume state of the new level, or NULL if nesting is too deep.
+ */
+static CliPt_TypeDef *job_enter(void)
+{
+    if (CliJobCur->Depth >= CLI_JOB_DEPTH)
+    {
+        CLI_ERROR("ERROR: Command nesting deeper than %d.\n", CLI_JOB_DEPTH);
+        return NULL;
+    }
+
+    return &CliJobCur->Frame[CliJobCur->Depth++];
+}
+
+/*!@brief   Leave a nesting level. The resume state of this & deeper levels is
+ *          cleared unless the level is suspended.
+ *
+ * @param   pt      Resume state returned by job_enter()
+ * @param   pending The level has yielded and will be resumed.
+ */
+static void job_leave(CliPt_TypeDef *pt, int pending)
+{
+    CliJobCur->Depth--;
+
+    if (!pending)
+    {
+        memset(pt, 0, (uint8_t *) &CliJobCur->Frame[CLI_JOB_DEPTH] - (uint8_t *) pt);
+    }
+}
+
+/*!@brief   Run a job to the end, waiting in between when it yields.
+ *          Used by the blocking APIs, a job of the caller is kept aside.
+ *
+ * @param   plan    Plan to run, the job takes the reference.
+ * @return  Return value of the last segment.
+ */
+static int job_run_blocking(CliPlan_TypeDef *plan)
+{
+    CliJob_TypeDef job;
+    int ret = Cli_JobStart(&job, plan, NULL);
+
+    while (ret == CLI_PENDING)
+    {
+        cli_sleep(1);
+        ret = Cli_JobStep(&job);
+    }
+
+    return ret;
+}
+
+/*!@brief   Execute a resolved command and print the result.
+ *          Arguments are passed in a private NULL terminated copy, strings
+ *          included, so a command may change them in place, e.g. by strtok(),
+ *          and not break a plan that is run again.
+ *          Names of parent groups are skipped, a sub command gets its own name
+ *          as argv[0]. A group without function shows its sub commands.
+ *          Must be called inside a job, the command gets one nesting level.
+ *          The resolution is kept in the level when the command starts, it's
+ *          resumed with it even if another job resolves the plan again.
+ *
+ * @param   seg     Resolved segment
+ * @return  Return value of the command, CLI_PENDING if it has yielded.
+ */
+static int cli_exec(const CliPlanSegment_TypeDef *seg)
+{
+    char *args[CLI_ARGC_MAX + 1];
+    char buf[CLI_STR_BUF_SIZE];
+    CliPt_TypeDef *pt = job_enter();
+    if (pt == NULL)
+    {
+        return CLI_FAIL;
+    }
+
+    if (pt->Line == 0)
+    {
+        pt->Func = seg->Func;
+        pt->Node = seg->Node;
+        pt->Skip = seg->Skip;
+    }
+    int (*func)(int, char **) = pt->Func;
+    short node = pt->Node;
+    int argc = seg->Argc - pt->Skip;
+    char **argv = seg->Argv + pt->Skip;
+
+    if (node == NODE_NONE)
+    {
+        job_leave(pt, 0);
+        CLI_ERROR("ERROR: Unknown command of [%s], try [help].\n", argv[0]);
+        return CLI_FAIL;
+    }
+
+    if (func == NULL)
+    {
+        job_leave(pt, 0);
+        if (argc > 1)
+        {
+            CLI_ERROR("ERROR: Unknown sub command of [%s]\n", argv[1]);
+        }
+        unsigned int idx;
+        help_list_node(table_read_lock(&idx), node);
+        table_read_unlock(idx);
+        CLI_ECHO("%s\n", (argc > 1) ? "FAIL" : "OK");
+        return (argc > 1) ? CLI_FAIL : CLI_OK;
+    }
+
+    unsigned int len = 0;
+    for (int i = 0; i < argc; i++)
+    {
+        len += strlen(argv[i]) + 1;
+    }
+    char *heap = (len > sizeof(buf)) ? cli_malloc(len) : NULL;
+    char *str = (len > sizeof(buf)) ? heap : buf;
+    if (str == NULL)
+    {
+        job_leave(pt, 0);
+        return CLI_FAIL;
+    }
+    for (int i = 0; i < argc; i++)
+    {
+        unsigned int n = strlen(argv[i]) + 1;
+        args[i] = memcpy(str, argv[i], n);
+        str += n;
+    }
+    args[argc] = NULL;
+#if CLI_GETOPT_ENABLE
+    CliOptReset = 1;
+#endif
+
+#if CLI_CANCEL_ENABLE
+    // The watchdog of a command with a time limit starts on its first call.
+    if ((seg->Timeout != 0) && (pt->Line == 0))
+    {
+        pt->Start = cli_gettick();
+        pt->Timeout = seg->Timeout;
+    }
+#endif
+
+    short caller = CliCommandCur;
+    CliCommandCur = node;
+#if CLI_TRACE_ENABLE
+    if (gCliTraceOn)
+    {
+        cli_trace_begin_args(pt->Skip + 1, seg->Argv);
+    }
+#endif
+    int ret = func(argc, args);
+    CLI_TRACE_END();
+    CliCommandCur = caller;
+
+    // Only a command that has set its resume point can be pending.
+    int pending = (ret == CLI_PENDING) && (pt->Line != 0);
+#if CLI_CANCEL_ENABLE
+    int expired = frame_expired(pt, cli_gettick());
+    if (expired && (pending || (ret == CLI_CANCELLED)))
+    {
+        CLI_ERROR("ERROR: [%s] timed out after %u ms.\n", argv[0], pt->Timeout);
+    }
+#else
+    int expired = 0;
+#endif
+
+    // A command that still yields once it's cancelled would never end. It's
+    // resumed once more, with Cli_Cancelled() set, to release what it holds,
+    // then dropped with its resume state. The levels above it end normally.
+    if (pending && (expired || Cli_Cancelled()))
+    {
+        CliCommandCur = node;
+        func(argc, args);
+        CliCommandCur = caller;
+        pending = 0;
+        ret = CLI_CANCELLED;
+    }
+    job_leave(pt, pending);
+    cli_free(heap);
+    if (pending)
+    {
+        return CLI_PENDING;
+    }
+
+    CLI_ECHO("%s\n", ret ? "FAIL" : "OK");
+    return ret;
+}
+
+/*!@brief   Run the CLI by given arguments.
+ *          Blocks until the command is finished, even if it yields.
+ *
+ * @param   argc
+ * @param   args
+ * @return  -1      Run command fail.
+ */
+int Cli_RunByArgs(int argc, char **args)
+{
+    if ((argc == 0) || (args == NULL))
+    {
+        return CLI_FAIL;
+    }
+
+    return job_run_blocking(Cli_PlanCompileArgs(argc, args));
+}
+
+/*!@brief   FNV-1a hash of a string, used as plan cache key.
+ */
+static unsigned int plan_hash(const char *str)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*str != 0)
+    {
+        hash ^= (uint8_t) *str++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/*!@brief   Resolve function of every segment against current command list.
+ */
+static void plan_resolve(CliPlan_TypeDef *plan)
+{
+    CLI_TRACE_BEGIN("resolve");
+
+    // Generation first: a table published meanwhile only makes the plan stale.
+    unsigned int idx;
+    unsigned int gen = __atomic_load_n(&CliCommandGen, __ATOMIC_ACQUIRE);
+    CliTable_TypeDef *t = table_read_lock(&idx);
+    for (int i = 0; i < plan->NumOfSegments; i++)
+    {
+        CliPlanSegment_TypeDef *seg = &plan->Segments[i];
+        int depth = 0;
+
+        seg->Node = cli_resolve(t, seg->Argc, seg->Argv, &depth);
+        seg->Func = (seg->Node != NODE_NONE) ? t->List[seg->Node].Func : NULL;
+#if CLI_CANCEL_ENABLE
+        seg->Timeout = (seg->Node != NODE_NONE) ? t->List[seg->Node].Timeout : 0;
+#endif
+        seg->Skip = (depth > 0) ? depth - 1 : 0;
+    }
+    table_read_unlock(idx);
+
+    plan->Generation = gen;
+    CLI_TRACE_END();
+}
+
+/*!@brief   Allocate a plan with all its buffers in one block.
+ *
+ * @param   segs    Number of segments
+ * @param   args    Number of argument pointers
+ * @param   len     Size of source & tokenized string buffers.
+ * @return  Pointer to the plan or NULL for failure.
+ */
+static CliPlan_TypeDef *plan_alloc(int segs, int args, unsigned int len)
+{
+    CliPlan_TypeDef *plan = cli_malloc(sizeof(CliPlan_TypeDef) + sizeof(CliPlanSegment_TypeDef) * segs
+                                       + sizeof(char *) * args + len * 2);
+    if (plan == NULL)
+    {
+        return NULL;
+    }
+
+    plan->RefCount = 1;
+    plan->Segments = (CliPlanSegment_TypeDef *) (plan + 1);
+    plan->Segments[0].Argv = (char **) (plan->Segments + segs);
+    plan->Source = (char *) (plan->Segments[0].Argv + args);
+
+    return plan;
+}
+
+/*!@brief   Compile a command string to a plan.
+ *          The string is copied & split to ';' separated segments, each
+ *          segment is tokenized and its command is resolved.
+ *
+ * @param   cmd     Command string, e.g. "test -i 123; version"
+ * @return  Pointer to the plan or NULL for failure.
+ */
+CliPlan_TypeDef *Cli_PlanCompile(const char *cmd)
+{
+    if (cmd == NULL)
+    {
+        return NULL;
+    }
+
+    // Every argument takes at least 2 chars, this limits the argument pool.
+    unsigned int len = strlen(cmd) + 1;
+    int segs = 1;
+    for (const char *c = cmd; *c != 0; c++)
+    {
+        segs += (*c == ';');
+    }
+    int args = len / 2 + segs;
+    if (args > segs * CLI_ARGC_MAX)
+    {
+        args = segs * CLI_ARGC_MAX;
+    }
+
+    CliPlan_TypeDef *plan = plan_alloc(segs, args, len);
+    if (plan == NULL)
+    {
+        return NULL;
+    }
+
+    char *buf = plan->Source + len;
+    memcpy(plan->Source, cmd, len);
+    memcpy(buf, cmd, len);
+    plan->Hash = plan_hash(cmd);
+
+    // Tokenize segment by segment into the shared argument pool.
+    CLI_TRACE_BEGIN("tokenize");
+    char **argv = plan->Segments[0].Argv;
+    char *tail = buf;
+    do
+    {
+        CliPlanSegment_TypeDef *seg = &plan->Segments[plan->NumOfSegments++];
+        seg->Argv = argv;
+        tail = cli_strtoarg(tail, &seg->Argc, argv);
+        argv += seg->Argc;
+    } while ((tail != NULL) && (plan->NumOfSegments < segs));
+    CLI_TRACE_END();
+
+    plan_resolve(plan);
+    return plan;
+}
+
+/*!@brief   Compile already tokenized arguments to a single segment plan.
+ *
+ * @param   argc    Argument count
+ * @param   argv    Argument vector
+ * @return  Pointer to the plan or NULL for failure.
+ */
+CliPlan_TypeDef *Cli_PlanCompileArgs(int argc, char **argv)
+{
+    if ((argc <= 0) || (argv == NULL))
+    {
+        return NULL;
+    }
+
+    unsigned int len = 0;
+    for (int i = 0; i < argc; i++)
+    {
+        len += strlen(argv[i]) + 1;
+    }
+
+    CliPlan_TypeDef *plan = plan_alloc(1, argc, len);
+    if (plan == NULL)
+    {
+        return NULL;
+    }
+
+    // Source is the arguments joined by space, buffer keeps them separated.
+    char *src = plan->Source;
+    char *buf = plan->Source + len;
+    CliPlanSegment_TypeDef *seg = &plan->Segments[0];
+    for (int i = 0; i < argc; i++)
+    {
+        unsigned int n = strlen(argv[i]) + 1;
+        memcpy(buf, argv[i], n);
+        memcpy(src, argv[i], n);
+        src[n - 1] = ' ';
+        seg->Argv[i] = buf;
+        buf += n;
+        src += n;
+    }
+    src[-1] = 0;
+    seg->Argc = argc;
+    plan->NumOfSegments = 1;
+    plan->Hash = plan_hash(plan->Source);
+
+    plan_resolve(plan);
+    return plan;
+}
+
+/*!@brief   Run a compiled plan.
+ *          Segments are resolved again only if the command list has changed
+ *          since the plan was compiled.
+ *          Inside a job (e.g. from a command) the plan is resumable: it returns
+ *          CLI_PENDING when a segment yields and continues from that segment on
+ *          next call. Outside of a job it blocks until all segments finish.
+ *
+ * @param   plan    Plan to run
+ * @return  Return value of the last segment, or CLI_PENDING.
+ */
+int Cli_PlanRun(CliPlan_TypeDef *plan)
+{
+    if (plan == NULL)
+    {
+        return CLI_FAIL;
+    }
+
+    if (CliJobCur == NULL)
+    {
+        plan->RefCount++;
+        return job_run_blocking(plan);
+    }
+
+    CliPt_TypeDef *pt = job_enter();
+    if (pt == NULL)
+    {
+        return CLI_FAIL;
+    }
+
+    int ret = CLI_OK;
+    for (; pt->Seg < plan->NumOfSegments; pt->Seg++)
+    {
+        CliPlanSegment_TypeDef *seg = &plan->Segments[pt->Seg];
+        if (seg->Argc == 0)
+        {
+            continue;
+        }
+
+        // A cancelled line doesn't start its next command.
+        if ((pt->Line == 0) && Cli_Cancelled())
         {
-            // Separators
-            if (flag_quote == 0)
-            {
-                str[i] = 0;
-                flag_arg_head = 0;
-            }
+            ret = CLI_CANCELLED;
             break;
         }
-        default:
+
+        // A plan may be shared by jobs, a segment being resumed runs what it
+        // has started with, kept in its level by cli_exec().
+        if ((plan->Generation != __atomic_load_n(&CliCommandGen, __ATOMIC_ACQUIRE)) && (pt->Line == 0))
         {
-            // Normal characters, save argument pointer.
-            if ((flag_arg_head == 0) && (*argc < CLI_ARGC_MAX))
-            {
-                argv[*argc] = &str[i];
-                (*argc)++;
-            }
-            flag_arg_head = 1;
-            break;
+            plan_resolve(plan);
         }
+
+        CLI_TRACE_BEGIN("dispatch");
+        ret = cli_exec(seg);
+        CLI_TRACE_END();
+        if (ret == CLI_PENDING)
+        {
+            pt->Line = __LINE__;
+            job_leave(pt, 1);
+            return CLI_PENDING;
         }
+        pt->Line = 0;
     }
 
-    return NULL;
+    job_leave(pt, 0);
+    return ret;
 }
 
-char *Cli_TimeStampStr(void)
+/*!@brief   Release a plan, the memory is freed when the last owner releases it.
+ *
+ * @param   plan    Plan to release
+ */
+void Cli_PlanFree(CliPlan_TypeDef *plan)
 {
-
-    static char timestamp[16] = { 0 };
-
-    uint32_t tick = cli_gettick();
-
-    sprintf(timestamp, "[%03u.%03u]", tick / 1000, tick % 1000);
-
-    return timestamp;
+    if ((plan != NULL) && (--plan->RefCount == 0))
+    {
+        cli_free(plan);
+    }
 }
 
-/*!@brief   Register a command to CLI.
- * @example Cli_Register("help","show help text",&builtin_help);
- *
- * @param   name      Command name
- * @param   prompt    Command prompt text
- * @param   func      Pointer to function to run when the command is called.
+/*!@brief   Get a plan for a command string, compile it only if it is not cached.
+ *          The least recently used plan is evicted when the cache is full. An
+ *          evicted plan that is still running stays alive until it's released.
  *
- * @retval  index    The index of the command is inserted in the command list.
- * @retval  -1       Command register fail.
+ * @param   cmd     Command string
+ * @return  Pointer to the plan, release it with Cli_PlanFree().
  */
-int Cli_Register(const char *name, const char *prompt, int (*func)(int, char **))
+CliPlan_TypeDef *Cli_PlanGet(const char *cmd)
 {
-    if ((name == NULL) || (prompt == NULL) || func == NULL)
-    {
-        return CLI_FAIL;
-    }
+#if CLI_PLAN_CACHE_SIZE > 0
+    unsigned int hash = plan_hash(cmd);
+    int victim = 0;
 
-    for (int i = 0; i < CLI_COMMAND_SIZE; i++)
+    for (int i = 0; i < CLI_PLAN_CACHE_SIZE; i++)
     {
-        // Find a empty slot to save the command.
-        if ((CliCommandList[i].Name == NULL) && (CliCommandList[i].Func == NULL))
+        CliPlan_TypeDef *plan = CliPlanCache[i];
+
+        if ((plan != NULL) && (plan->Hash == hash) && (strcmp(plan->Source, cmd) == 0))
         {
-            CliCommandList[i].Name = name;
-            CliCommandList[i].Prompt = prompt;
-            CliCommandList[i].Func = func;
+            plan->LastUse = ++CliPlanStamp;
+            plan->RefCount++;
+            return plan;
+        }
 
-            CliNumOfCommands++;
-            return i;
+        // Prefer an empty slot, otherwise the oldest one.
+        if ((CliPlanCache[victim] != NULL)
+            && ((plan == NULL) || (plan->LastUse < CliPlanCache[victim]->LastUse)))
+        {
+            victim = i;
         }
     }
 
-    return CLI_FAIL;
+    CliPlan_TypeDef *plan = Cli_PlanCompile(cmd);
+    if (plan != NULL)
+    {
+        Cli_PlanFree(CliPlanCache[victim]);
+        CliPlanCache[victim] = plan;
+        plan->LastUse = ++CliPlanStamp;
+        plan->RefCount++;
+    }
+    return plan;
+#else
+    return Cli_PlanCompile(cmd);
+#endif
 }
 
-int Cli_Unregister(const char *name)
+/*!@brief   Release all cached plans.
+ */
+static void plan_cache_clear(void)
 {
-    if ((name == NULL) || (name[0] == 0))
+#if CLI_PLAN_CACHE_SIZE > 0
+    for (int i = 0; i < CLI_PLAN_CACHE_SIZE; i++)
     {
-        return CLI_FAIL;
+        Cli_PlanFree(CliPlanCache[i]);
+        CliPlanCache[i] = NULL;
     }
+#endif
+}
 
-    for (int i = 0; i < CLI_COMMAND_SIZE; i++)
+/*!@brief   Start a job that runs a plan, and run it until it yields.
+ *
+ * @param   job     Job to start, must be idle. It's initialized here.
+ * @param   plan    Plan to run, the job takes the reference.
+ * @param   output  Output of the job, NULL for the default.
+ * @return  Return value of the plan, or CLI_PENDING if it's not finished.
+ */
+int Cli_JobStart(CliJob_TypeDef *job, CliPlan_TypeDef *plan, CliOutput_TypeDef *output)
+{
+    if ((job == NULL) || (plan == NULL))
     {
-        // Delete the command
-        if (strcmp(CliCommandList[i].Name, name) == 0)
-        {
-            CliCommandList[i].Name = NULL;
-            CliCommandList[i].Prompt = NULL;
-            CliCommandList[i].Func = NULL;
-
-            CliNumOfCommands--;
-            return i;
-        }
+        return CLI_FAIL;
     }
-    return CLI_FAIL;
+
+    memset(job, 0, sizeof(CliJob_TypeDef));
+    job->Plan = plan;
+    job->Output = output;
+
+    return Cli_JobStep(job);
 }
 
-/*!@brief   Run the CLI by given arguments.
+/*!@brief   Resume a job until it yields again or finishes.
+ *          The plan is released when the job finishes.
  *
- * @param   argc
- * @param   args
- * @return  -1      Run command fail.
+ * @param   job     Job to resume
+ * @return  Return value of the plan, or CLI_PENDING if it's not finished.
  */
-int Cli_RunByArgs(int argc, char **args)
+int Cli_JobStep(CliJob_TypeDef *job)
 {
-    if ((argc == 0) || (args == NULL))
+    if ((job == NULL) || (job->Plan == NULL))
     {
         return CLI_FAIL;
     }
 
-    for (int i = 0; i < CLI_COMMAND_SIZE; i++)
+    CliJob_TypeDef *caller = CliJobCur;
+    CliOutput_TypeDef *output = (job->Output != NULL) ? Cli_SetOutput(job->Output) : NULL;
+    CliJobCur = job;
+    int ret = Cli_PlanRun(job->Plan);
+    CliJobCur = caller;
+    if (job->Output != NULL)
     {
-        if ((CliCommandList[i].Name != NULL) && (CliCommandList[i].Func != NULL))
-        {
-            if (strcmp(CliCommandList[i].Name, args[0]) == 0)
-            {
-                int ret = CliCommandList[i].Func(argc, args);
-                CLI_PRINT("%s\n", ret ? "FAIL" : "OK");
-                return ret;
-            }
-        }
+        Cli_SetOutput(output);
+    }
+
+    if (ret != CLI_PENDING)
+    {
+        Cli_PlanFree(job->Plan);
+        job->Plan = NULL;
     }
 
-    CLI_ERROR("ERROR: Unknown command of [%s], try [help].\n", args[0]);
-    return CLI_FAIL;
+    return ret;
 }
 
 /*!@brief   Run the CLI by given string.
- *          This function will conver the command string to arguments and run
- * Cli_RunByArgs.
+ *          The string is compiled to a plan, or taken from the plan cache if
+ *          the same string has been run recently.
+ *          Blocks until all commands are finished, even if they yield.
  *
  * @param   cmd     Command string, e.g. "test -i 123"
- * @return
+ * @return  Return value of the last command.
  */
 int Cli_RunByString(char *cmd)
 {
@@ -959,90 +3873,470 @@ int Cli_RunByString(char *cmd)
         return CLI_FAIL;
     }
 
-    // Buffer string before run command
-    char *cmd_buf = cli_malloc(strlen(cmd) + 1);
-    strcpy(cmd_buf, cmd);
-
-    // Loop until all string is processed.
-    char *sub_cmd = cmd_buf;
-    do
-    {
-        // String to arguments
-        int argc = 0;
-        char **argv = cli_malloc(sizeof(char *) * CLI_ARGC_MAX);
-        sub_cmd = cli_strtoarg(sub_cmd, &argc, argv);
-
-        // Run by arguments
-        Cli_RunByArgs(argc, argv);
-        cli_free(argv);
-
-    } while (sub_cmd != NULL);
-
-    cli_free(cmd_buf);
-    return CLI_OK;
+    return job_run_blocking(Cli_PlanGet(cmd));
 }
 
 int Cli_Init(void)
 {
     // Clear operation buffers
     StringIdx = 0;
+#if CLI_STATIC_MEM
+    StringPtr = memset(CliStringBuf, 0, sizeof(CliStringBuf));
+    CliTableBuf = memset(CliTableStatic, 0, sizeof(CliTableStatic));
+#else
     StringPtr = cli_malloc(sizeof(char) * CLI_STR_BUF_SIZE);
-    CliCommandList = cli_malloc(sizeof(CliCommand_TypeDef) * CLI_COMMAND_SIZE);
+    CliTableBuf = cli_malloc(sizeof(CliTable_TypeDef) * 2);
+    if ((StringPtr == NULL) || (CliTableBuf == NULL))
+    {
+        return CLI_FAIL;
+    }
+#endif
 
 #if HISTORY_ENABLE
+#if CLI_STATIC_MEM
+    HistoryPtr = memset(CliHistoryBuf, 0, sizeof(CliHistoryBuf));
+#else
     HistoryPtr = cli_malloc(sizeof(char *) * HISTORY_DEPTH);
+#endif
     history_clear();
 #endif
 
+    // Empty command tree
+    CliTable = &CliTableBuf[0];
+    CliTable->Root = NODE_NONE;
+    CliTable->Num = 0;
+    for (int i = 0; i < CLI_COMMAND_HASH_SIZE; i++)
+    {
+        CliTable->Hash[i] = NODE_NONE;
+    }
+
     // Register built-in commands.
+    CliRegBuiltin = 1;
+#if CLI_BUILTIN_ENABLE
     Cli_Register("debug", "Set debug level", &builtin_debug);
+#endif
     Cli_Register("help", "Show list of commands & prompt.", &builtin_help);
+#if CLI_BUILTIN_ENABLE
     Cli_Register("history", "Show command history", &builtin_history);
+#if CLI_GETOPT_ENABLE
     Cli_Register("test", "CLI argument parse example", &builtin_test);
+#endif
     Cli_Register("repeat", "Repeat execute a command", &builtin_repeat);
     Cli_Register("sleep", "Put CLI to sleep for an interval of time", &builtin_sleep);
     Cli_Register("time", "Time command execution", &builtin_time);
+#if CLI_CANCEL_ENABLE
+    Cli_Register("timeout", "Run a command with a time limit", &builtin_timeout);
+#endif
+    Cli_Register("bench", "Run a command many times & show run time statistics", &builtin_bench);
+#if CLI_STREAM_ARG_ENABLE
+    Cli_RegisterStream("hexsum", "Count & sum the bytes of a hex payload of any length",
+                       &builtin_hexsum);
+#endif
+#endif
+    Cli_Register("mode", "Set output mode, text or json", &builtin_mode);
     Cli_Register("version", "Show CLI version", &builtin_version);
-    CliNumOfBuiltin = 8;
+#if CLI_POOL_ENABLE && CLI_BUILTIN_ENABLE
+    Cli_Register("pool", "Show memory pool usage", &builtin_pool);
+#endif
+#if CLI_MEM_ENABLE && CLI_BUILTIN_ENABLE
+    Cli_Register("mem", "Show heap usage by call site", &builtin_mem);
+    Cli_Register("mem list", "List outstanding allocations", &builtin_mem_list);
+    Cli_Register("mem log", "Show the last allocations & frees", &builtin_mem_log);
+#endif
+#if CLI_RX_ENABLE && CLI_BUILTIN_ENABLE
+    Cli_Register("rx", "Show input ring usage", &builtin_rx);
+#endif
+#if CLI_TX_ENABLE && CLI_BUILTIN_ENABLE
+    Cli_Register("tx", "Show output scheduler, or set line rate", &builtin_tx);
+#endif
+#if CLI_TIMER_ENABLE
+    Cli_Register("every", "Run a command periodically", &builtin_every);
+    Cli_Register("after", "Run a command once after a delay", &builtin_after);
+    Cli_Register("cancel", "Cancel a timer of every/after", &builtin_cancel);
+#endif
+#if CLI_RPC_ENABLE
+    Cli_Register("rpc", "Switch console to binary RPC frames", &builtin_rpc);
+#endif
+#if CLI_XFER_ENABLE && CLI_BUILTIN_ENABLE
+    Cli_Register("xfer", "Show file transfer targets & the last transfer", &builtin_xfer);
+    Cli_Register("xfer rx", "Receive a file to a target in binary frames", &builtin_xfer_rx);
+    Cli_Register("xfer tx", "Send a file from a target in binary frames", &builtin_xfer_tx);
+#endif
+#if CLI_PLUGIN_ENABLE && CLI_BUILTIN_ENABLE
+    Cli_Register("plugin", "Show command modules", &builtin_plugin);
+#endif
+#if CLI_SHM_ENABLE
+    Cli_Register("shm", "Shared memory channel for local clients", &builtin_shm);
+    Cli_Register("shm open", "Serve requests on a segment, default " CLI_SHM_NAME, &builtin_shm_open);
+    Cli_Register("shm close", "Stop serving & remove the segment", &builtin_shm_close);
+#endif
+#if CLI_SERVER_ENABLE
+    Cli_Register("server", "Show listening sockets & console sessions", &builtin_server);
+    Cli_Register("server open", "Serve console sessions on unix:<path> or tcp:[host:]port",
+                 &builtin_server_open);
+    Cli_Register("server close", "Stop listening & close all sessions", &builtin_server_close);
+#endif
+#if CLI_TRACE_ENABLE && CLI_BUILTIN_ENABLE
+    Cli_Register("trace", "Show execution trace state", &builtin_trace);
+    Cli_Register("trace start", "Clear the trace and start recording spans", &builtin_trace_start);
+    Cli_Register("trace stop", "Stop recording spans", &builtin_trace_stop);
+    Cli_Register("trace dump", "Write Chrome trace JSON to a file or the output", &builtin_trace_dump);
+#endif
+    CliRegBuiltin = 0;
+
+#if CLI_PLUGIN_ENABLE
+    // Stubs of command modules, they are loaded on first use.
+    cli_plugin_init();
+#endif
     // Initialize IO port
     cli_port_init();
 
-    // Show Version
-    builtin_version(0, NULL);
+    // Show Version, not in machine-readable mode where output is records only.
+    if (gCliMode == CLI_MODE_TEXT)
+    {
+        builtin_version(0, NULL);
+    }
+#if CLI_PASTE_ENABLE
+    // Ask the terminal to mark pasted text, ignored by terminals without it.
+    CLI_ECHO(ANSI_PASTE_ON);
+#endif
     return CLI_OK;
 }
 
 int Cli_Deinit(void)
 {
+#if CLI_PASTE_ENABLE
+    CLI_ECHO(ANSI_PASTE_OFF);
+#endif
+#if CLI_TX_ENABLE
+    cli_tx_flush();
+#endif
     cli_port_deinit();
 
+#if HISTORY_ENABLE
     history_clear();
+#endif
+#if CLI_TIMER_ENABLE
+    cli_timer_deinit();
+#endif
+    plan_cache_clear();
+#if CLI_PLUGIN_ENABLE
+    cli_plugin_deinit();
+#endif
+#if CLI_SHM_ENABLE
+    cli_shm_deinit();
+#endif
+#if CLI_SERVER_ENABLE
+    cli_server_deinit();
+#endif
+    cli_free(CliConsoleRecord.Capture.Buf);
+    CliConsoleRecord.Capture.Buf = NULL;
 
     StringIdx = 0;
+#if CLI_STATIC_MEM == 0
     cli_free(StringPtr);
+#if HISTORY_ENABLE
     cli_free(HistoryPtr);
-    cli_free(CliCommandList);
+#endif
+    cli_free(CliTableBuf);
+#endif
+
+    return CLI_OK;
+}
+
+/*!@brief Run the lines already received by the console that is swapped in,
+ *        a host may send many at once.
+ *
+ * @return  CLI_PENDING while a command line has yielded, else CLI_OK.
+ */
+static int console_run(void)
+{
+    for (int n = 0; n < CLI_RUN_LINES; n++)
+    {
+        int ret = CLI_OK;
+
+        // The port is never taken by a session, only by the console.
+#if CLI_XFER_ENABLE && CLI_BUILTIN_ENABLE
+        // Port is taken by a file transfer after "xfer rx/tx".
+        if ((CliSessionCur == NULL) && cli_xfer_poll())
+        {
+            return CLI_OK;
+        }
+#endif
+#if CLI_RPC_ENABLE
+        // Port is taken by binary frames after "rpc".
+        if ((CliSessionCur == NULL) && cli_rpc_poll())
+        {
+            return CLI_OK;
+        }
+#endif
+
+        // Resume the command line that has yielded, input waits until it's done.
+        if (CliConsoleJob.Plan != NULL)
+        {
+#if CLI_CANCEL_ENABLE
+            cancel_poll();
+#endif
+            ret = Cli_JobStep(&CliConsoleJob);
+        }
+        else
+        {
+            CliLineEditing = 1;
+            char *str = cli_getline();
+            CliLineEditing = 0;
+
+            if (str == NULL)
+            {
+                return CLI_OK;
+            }
+
+            int len = strlen(str);
+            if (len >= 1)
+            {
+                CliPlan_TypeDef *plan = Cli_PlanGet(str);
+                CliOutput_TypeDef *output = Cli_RecordBegin(&CliConsoleRecord, plan);
+#if CLI_CANCEL_ENABLE
+                CancelTick = cli_gettick();
+#endif
+                ret = Cli_JobStart(&CliConsoleJob, plan, output);
+            }
+            memset(str, 0, len + 1);
+        }
+
+        if (ret == CLI_PENDING)
+        {
+            return CLI_PENDING;
+        }
+
+        Cli_RecordEnd(&CliConsoleRecord, ret);
+        CLI_ECHO("%s", CLI_PROMPT_CHAR);
+    }
 
     return CLI_OK;
 }
 
 int Cli_Run(void)
 {
-    char *str = cli_getline();
+#if CLI_TX_ENABLE
+    cli_tx_poll();
+#endif
+#if CLI_TIMER_ENABLE
+    cli_timer_poll();
+#endif
+#if CLI_PLUGIN_ENABLE
+    cli_plugin_poll();
+#endif
+#if CLI_SHM_ENABLE
+    cli_shm_poll();
+#endif
+#if CLI_SERVER_ENABLE
+    cli_server_poll();
+#endif
+
+    console_run();
+
+    return CLI_OK;
+}
+
+#if CLI_SESSION_ENABLE
+#define SESSION_SWAP(s, name)   session_swap(&(s)->name, &(name), sizeof(name))
+
+/*!@brief Exchange the bytes of a session field with its global.
+ */
+static void session_swap(void *field, void *global, unsigned int len)
+{
+    unsigned char *a = field;
+    unsigned char *b = global;
+
+    for (unsigned int i = 0; i < len; i++)
+    {
+        unsigned char t = a[i];
+        a[i] = b[i];
+        b[i] = t;
+    }
+}
+
+/*!@brief Swap the state of a session with the globals of the console, it's
+ *        its own inverse: once to enter the session, once more to leave it.
+ */
+static void session_switch(CliSession_TypeDef *s)
+{
+    SESSION_SWAP(s, StringPtr);
+    SESSION_SWAP(s, StringIdx);
+    SESSION_SWAP(s, KeyEscBuf);
+    SESSION_SWAP(s, KeyEscIdx);
+    SESSION_SWAP(s, KeyEscFlag);
+#if CLI_SUGGEST_ENABLE
+    SESSION_SWAP(s, SuggestLen);
+#endif
+#if CLI_PASTE_ENABLE
+    SESSION_SWAP(s, PasteFlag);
+    SESSION_SWAP(s, PasteTail);
+    SESSION_SWAP(s, PasteEsc);
+#endif
+#if CLI_STREAM_ARG_ENABLE
+    SESSION_SWAP(s, StreamNode);
+    SESSION_SWAP(s, StreamChunk);
+    SESSION_SWAP(s, StreamBuf);
+    SESSION_SWAP(s, StreamLen);
+    SESSION_SWAP(s, StreamRet);
+    SESSION_SWAP(s, StreamCheck);
+    SESSION_SWAP(s, StreamEsc);
+    SESSION_SWAP(s, StreamEscBuf);
+#endif
+#if HISTORY_ENABLE
+    SESSION_SWAP(s, HistoryPtr);
+    SESSION_SWAP(s, HistoryQueueHead);
+    SESSION_SWAP(s, HistoryQueueTail);
+    SESSION_SWAP(s, HistoryPullDepth);
+    SESSION_SWAP(s, HistoryMemUsage);
+#endif
+#if CLI_CANCEL_ENABLE
+    SESSION_SWAP(s, CancelAhead);
+    SESSION_SWAP(s, CancelAheadLen);
+    SESSION_SWAP(s, CancelAheadIdx);
+    SESSION_SWAP(s, CancelTick);
+#endif
+    session_swap(&s->Job, &CliConsoleJob, sizeof(CliConsoleJob));
+    session_swap(&s->Record, &CliConsoleRecord, sizeof(CliConsoleRecord));
+}
+
+/*!@brief   Create a console session, e.g. for a socket connection. It has
+ *          its own line buffer, history & command line job, and shares the
+ *          command table, plan cache & timers with the console.
+ *
+ * @param   getc    Get a byte of input, EOF when there is none for now
+ * @param   arg     Argument of getc
+ * @param   output  Output of the session
+ * @return  The session, or NULL when it's out of memory.
+ */
+CliSession_TypeDef *Cli_SessionNew(int (*getc)(void *arg), void *arg, CliOutput_TypeDef *output)
+{
+    if ((getc == NULL) || (output == NULL))
+    {
+        return NULL;
+    }
+
+    CliSession_TypeDef *s = cli_malloc(sizeof(CliSession_TypeDef));
+    if (s == NULL)
+    {
+        return NULL;
+    }
+    memset(s, 0, sizeof(CliSession_TypeDef));
+    s->Getc = getc;
+    s->Arg = arg;
+    s->Output = output;
+    s->StringPtr = cli_malloc(CLI_STR_BUF_SIZE);
+#if HISTORY_ENABLE
+    s->HistoryPtr = cli_malloc(sizeof(char *) * HISTORY_DEPTH);
+    if (s->HistoryPtr != NULL)
+    {
+        memset(s->HistoryPtr, 0, sizeof(char *) * HISTORY_DEPTH);
+    }
+    else
+    {
+        cli_free(s->StringPtr);
+        s->StringPtr = NULL;
+    }
+#endif
+    if (s->StringPtr == NULL)
+    {
+        cli_free(s);
+        return NULL;
+    }
+    memset(s->StringPtr, 0, CLI_STR_BUF_SIZE);
+#if CLI_STREAM_ARG_ENABLE
+    s->StreamNode = NODE_NONE;
+    s->StreamCheck = 1;
+#endif
+
+    return s;
+}
+
+/*!@brief   Release a session. A command line it's still running is
+ *          cancelled and resumed once to release what it holds, and dropped
+ *          if it keeps yielding. Its output may be written until this returns.
+ *
+ * @param   session Session to release, not the one running
+ */
+void Cli_SessionFree(CliSession_TypeDef *session)
+{
+    if ((session == NULL) || (session == CliSessionCur))
+    {
+        return;
+    }
 
-    if (str != NULL)
+    session_switch(session);
+    CliSessionCur = session;
+    CliOutput_TypeDef *output = Cli_SetOutput(session->Output);
+    if (CliConsoleJob.Plan != NULL)
     {
-        int len = strlen(str);
-        if (len >= 1)
+        CliConsoleJob.Cancel = CLI_CANCEL_USER;
+        Cli_JobStep(&CliConsoleJob);
+        if (CliConsoleJob.Plan != NULL)
         {
-            Cli_RunByString(str);
+            Cli_PlanFree(CliConsoleJob.Plan);
+            CliConsoleJob.Plan = NULL;
         }
-        memset(str, 0, len + 1);
-        CLI_PRINT("%s", CLI_PROMPT_CHAR);
-        fflush(stdout);
     }
+    Cli_PlanFree(CliConsoleRecord.Plan);
+    CliConsoleRecord.Plan = NULL;
+#if CLI_STREAM_ARG_ENABLE
+    if (StreamNode != NODE_NONE)
+    {
+        StreamChunk(CLI_CHUNK_ABORT, NULL, 0);
+        StreamNode = NODE_NONE;
+    }
+#endif
+#if HISTORY_ENABLE
+    history_clear();
+#endif
+    Cli_SetOutput(output);
+    CliSessionCur = NULL;
+    session_switch(session);
 
-    return CLI_OK;
+    cli_free(session->Record.Capture.Buf);
+    cli_free(session->StringPtr);
+#if HISTORY_ENABLE
+    cli_free(session->HistoryPtr);
+#endif
+    cli_free(session);
+}
+
+/*!@brief   Run the lines a session has received, or resume its command line,
+ *          as Cli_Run does for the console. Call it when its input has bytes,
+ *          and on every tick while it returns CLI_PENDING.
+ *
+ * @param   session Session to run
+ * @return  CLI_PENDING while its command line has yielded, CLI_OK when it
+ *          waits for input, CLI_FAIL when another session is running.
+ */
+int Cli_SessionRun(CliSession_TypeDef *session)
+{
+    if ((session == NULL) || (CliSessionCur != NULL))
+    {
+        return CLI_FAIL;
+    }
+
+    session_switch(session);
+    CliSessionCur = session;
+    CliOutput_TypeDef *output = Cli_SetOutput(session->Output);
+    int ret = console_run();
+    Cli_SetOutput(output);
+    CliSessionCur = NULL;
+    session_switch(session);
+
+    return ret;
+}
+
+#endif
+/*!@brief   Get the session that is running now.
+ *
+ * @return  The session, or NULL for the console.
+ */
+CliSession_TypeDef *Cli_SessionSelf(void)
+{
+    return CliSessionCur;
 }
 
 void Cli_Task(void const *arguments)
@@ -1052,7 +4346,7 @@ void Cli_Task(void const *arguments)
     Cli_Init();
     CLI_INFO("%s: Initialize Finish\n", __FUNCTION__);
     cli_sleep(1000); // Wait 1s to start CLI
-    CLI_PRINT(CLI_PROMPT_CHAR);
+    CLI_ECHO(CLI_PROMPT_CHAR);
 
     /* Infinite loop */
     for (;;)
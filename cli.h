@@ -11,6 +11,8 @@
 #define CLI_H_
 
 /*! Includes ----------------------------------------------------------------*/
+#include <stddef.h>
+
 /*! Defines -----------------------------------------------------------------*/
 
 /*!@defgroup ANSI flow control Escape sequence define.
@@ -31,8 +33,14 @@
 #define ANSI_ERASE_LINE_END             "\e[K"
 #define ANSI_ERASE_LINE                 "\e[2K"
 
+#define ANSI_PASTE_ON                   "\e[?2004h"
+#define ANSI_PASTE_OFF                  "\e[?2004l"
+#define ANSI_PASTE_BEGIN                "\e[200~"
+#define ANSI_PASTE_END                  "\e[201~"
+
 #define ANSI_RESET                      "\e[0m"
 #define ANSI_BOLD                       "\e[1m"
+#define ANSI_DIM                        "\e[2m"
 #define ANSI_ITALIC                     "\e[3m"
 #define ANSI_UNDERLINE                  "\e[4m"
 #define ANSI_BLINK                      "\e[5m"
@@ -50,76 +58,554 @@
  */
 #define CLI_OK                  0           //!< General success.
 #define CLI_FAIL                -1          //!< General fail.
+#define CLI_PENDING             -2          //!< Command yielded, it's resumed on next Cli_Run
+#define CLI_CANCELLED           -3          //!< Command line cancelled by Ctrl-C or a timeout
 #define CLI_PROMPT_CHAR         ">"         //!< Prompt string shows at the head of line
 #define CLI_PROMPT_LEN          1           //!< Prompt string length
 #define CLI_STR_BUF_SIZE        256         //!< Maximum command length
 #define CLI_ARGC_MAX            32          //!< Maximum arguments in a command
-#define CLI_COMMAND_SIZE        32          //!< Number of commands in the list
+#ifndef CLI_COMMAND_SIZE
+#define CLI_COMMAND_SIZE        (CLI_BUILTIN_NUM + 24) //!< Commands & groups, built-ins & 24 of users
+#endif
+#define CLI_COMMAND_HASH_SIZE   64          //!< Buckets of command child lookup, power of 2
+#ifndef CLI_PLAN_CACHE_SIZE
+#define CLI_PLAN_CACHE_SIZE     8           //!< Number of compiled command plans kept for reuse
+#endif
+#define CLI_JOB_DEPTH           8           //!< Maximum nesting of resumable commands & plans
 #define CLI_VERSION             "1.0.0"     //!< CLI version string
 
+/*!@defgroup CLI feature & memory defines
+ *          Every switch can be overridden from the compiler command line,
+ *          "make size" uses this to measure the cost of each feature.
+ */
+#ifndef CLI_BUILTIN_ENABLE
+#define CLI_BUILTIN_ENABLE      1           //!< Built-in debug/history/test/repeat/sleep/time
+#endif
+#ifndef CLI_GETOPT_ENABLE
+#define CLI_GETOPT_ENABLE       1           //!< cli_getopt option parser & "test" example
+#endif
+#ifndef CLI_TIMER_ENABLE
+#define CLI_TIMER_ENABLE        1           //!< every/after/cancel timer wheel scheduler
+#endif
+#ifndef CLI_TIMER_NUM
+#define CLI_TIMER_NUM           64          //!< Maximum number of active timers
+#endif
+#ifndef CLI_RPC_ENABLE
+#define CLI_RPC_ENABLE          1           //!< "rpc" binary framed protocol on the console port
+#endif
+#define CLI_RPC_FRAME_SIZE      512         //!< Maximum decoded RPC frame
+#ifndef CLI_XFER_ENABLE
+#define CLI_XFER_ENABLE         1           //!< "xfer" windowed binary file transfer on the console port
+#endif
+#define CLI_XFER_BLOCK          256         //!< Data bytes of a transfer frame
+#define CLI_XFER_WINDOW         8           //!< Frames sent ahead of the acknowledgement
+#define CLI_XFER_TIMEOUT_MS     500         //!< Resend after this long without progress
+#define CLI_XFER_RETRY          10          //!< Resends without progress before giving up
+#define CLI_XFER_TARGET_NUM     4           //!< Maximum number of transfer targets
+#define CLI_XFER_RAM_SIZE       1024        //!< Bytes of the built-in "ram" target
+#ifndef CLI_PLUGIN_ENABLE
+#if defined(__linux__)
+#define CLI_PLUGIN_ENABLE       1           //!< Load command modules from shared objects on use
+#else
+#define CLI_PLUGIN_ENABLE       0
+#endif
+#endif
+#define CLI_PLUGIN_NUM          16          //!< Maximum number of command modules
+#ifndef CLI_PLUGIN_DIR
+#define CLI_PLUGIN_DIR          "./plugins" //!< Directory scanned for "*.so" command modules
+#endif
+#ifndef CLI_PLUGIN_IDLE_MS
+#define CLI_PLUGIN_IDLE_MS      60000       //!< Unload a module idle for this long, 0 to keep
+#endif
+#ifndef CLI_SHM_ENABLE
+#if defined(__linux__)
+#define CLI_SHM_ENABLE          1           //!< Serve commands from a shared memory channel
+#else
+#define CLI_SHM_ENABLE          0
+#endif
+#endif
+#define CLI_SHM_NAME            "/cli"      //!< Default shared memory segment name
+#ifndef CLI_SESSION_ENABLE
+#define CLI_SESSION_ENABLE      1           //!< Consoles with their own line editor & history
+#endif
+#ifndef CLI_SERVER_ENABLE
+#if defined(__linux__) && CLI_SESSION_ENABLE
+#define CLI_SERVER_ENABLE       1           //!< Serve console sessions on sockets from one epoll loop
+#else
+#define CLI_SERVER_ENABLE       0
+#endif
+#endif
+#define CLI_SERVER_LISTEN_NUM   4           //!< Maximum number of listening sockets
+#define CLI_SERVER_SESSION_NUM  4096        //!< Maximum number of sessions
+#define CLI_SERVER_OUT_MAX      65536       //!< Output kept for a slow session, the rest is dropped
+#ifndef CLI_RX_ENABLE
+#define CLI_RX_ENABLE           1           //!< Input ring fed by the port receiver, see cli_rx.c
+#endif
+#ifndef CLI_RX_BUF_SIZE
+#define CLI_RX_BUF_SIZE         1024        //!< Bytes of the input ring, power of 2
+#endif
+#ifndef CLI_TX_ENABLE
+#define CLI_TX_ENABLE           1           //!< Output scheduler for slow links, see cli_tx.c
+#endif
+#ifndef CLI_TX_BAUD
+#define CLI_TX_BAUD             0           //!< Line rate to pace output to, 0 for the pace of the port
+#endif
+#define CLI_TX_BUF_SIZE         2048        //!< Bytes of queued output, power of 2
+#define CLI_TX_FAST_SIZE        256         //!< Bytes of queued echo & prompt, power of 2
+#define CLI_TX_BURST            64          //!< Maximum bytes sent at once when paced
+#ifndef CLI_TX_XONXOFF
+#define CLI_TX_XONXOFF          1           //!< XOFF/XON from the input ring hold the output
+#endif
+#ifndef CLI_TRACE_ENABLE
+#if defined(__linux__)
+#define CLI_TRACE_ENABLE        1           //!< Trace command execution spans, see cli_trace.c
+#else
+#define CLI_TRACE_ENABLE        0
+#endif
+#endif
+#ifndef CLI_TRACE_SIZE
+#define CLI_TRACE_SIZE          1024        //!< Trace events kept, a span takes 2
+#endif
+#ifndef CLI_MEM_ENABLE
+#define CLI_MEM_ENABLE          1           //!< Heap accounting of cli_malloc/cli_free, see cli_mem.c
+#endif
+#ifndef CLI_MEM_TRACK_NUM
+#define CLI_MEM_TRACK_NUM       128         //!< Outstanding allocations kept with size & call site
+#endif
+#define CLI_MEM_SITE_NUM        16          //!< Call sites counted, the last one takes the rest
+#define CLI_MEM_LOG_NUM         32          //!< Last allocations & frees kept in the log
+#ifndef CLI_STATIC_MEM
+#define CLI_STATIC_MEM          0           //!< Allocate every buffer statically, no heap at all
+#endif
+
+#if CLI_STATIC_MEM
+#undef CLI_POOL_ENABLE
+#define CLI_POOL_ENABLE         1           //!< Static mode serves cli_malloc from the pool
+#elif !defined(CLI_POOL_ENABLE)
+#define CLI_POOL_ENABLE         0           //!< Serve cli_malloc from fixed-block pools, no heap
+#endif
+
+/*!@def CLI_POOL_CLASSES
+ *      Pool size classes as X(block size, number of blocks). Defaults are
+ *      sized for history entries, the line buffer, argument vectors, the
+ *      two versions of the command table and compiled plans. In static mode
+ *      the line buffer, command tables & history pointers are not taken from
+ *      the pool.
+ */
+#define CLI_POOL_CLASSES(X)                                                                        \
+    X(16, HISTORY_DEPTH)                                                                           \
+    X(32, HISTORY_DEPTH)                                                                           \
+    X(64, 16)                                                                                      \
+    X(128, 16)                                                                                     \
+    X(CLI_STR_BUF_SIZE, 8)                                                                         \
+    X(CLI_STR_BUF_SIZE * 2, CLI_PLAN_CACHE_SIZE + 4)                                               \
+    X(sizeof(CliTable_TypeDef) * 2, !CLI_STATIC_MEM)                                               \
+    X(CLI_STR_BUF_SIZE * 8, 4)
+
 /*!@defgroup CLI history function defines
  *
  */
+#ifndef HISTORY_ENABLE
 #define HISTORY_ENABLE          1           //!< Enable history function
+#endif
 #define HISTORY_DEPTH           32          //!< Maximum number of command saved in history
 #define HISTORY_MEM_SIZE        256         //!< Maximum RAM usage for history
+#ifndef CLI_SUGGEST_ENABLE
+#define CLI_SUGGEST_ENABLE      1           //!< Suggest the most used command of the prefix typed
+#endif
+#ifndef CLI_SUGGEST_NUM
+#define CLI_SUGGEST_NUM         64          //!< Maximum number of distinct commands indexed
+#endif
+#ifndef CLI_SUGGEST_NODE_NUM
+#define CLI_SUGGEST_NODE_NUM    1024        //!< Characters of the prefix tree, 12 bytes each
+#endif
+
+/*!@defgroup CLI line editor defines
+ *
+ */
+#ifndef CLI_PASTE_ENABLE
+#define CLI_PASTE_ENABLE        1           //!< Bracketed paste, pasted text is inserted without echo
+#endif
+#ifndef CLI_STREAM_ARG_ENABLE
+#define CLI_STREAM_ARG_ENABLE   1           //!< Payload of a stream command is passed in chunks
+#endif
+#define CLI_STREAM_CHUNK_SIZE   64          //!< Bytes of payload passed in one chunk
+#ifndef CLI_CANCEL_ENABLE
+#define CLI_CANCEL_ENABLE       1           //!< Ctrl-C & command timeouts cancel a running command line
+#endif
+#define CLI_CANCEL_AHEAD_SIZE   64          //!< Bytes typed ahead kept while a command line runs
+#define CLI_CANCEL_USER         1           //!< Cli_Cancelled(): Ctrl-C on the console
+#define CLI_CANCEL_TIMEOUT      2           //!< Cli_Cancelled(): a command has timed out
+
+/*!@def CLI_BUILTIN_NUM
+ *      Command & group nodes taken by the built-in commands of the features
+ *      enabled, see Cli_Init(). CLI_COMMAND_SIZE adds the room of users.
+ */
+#define CLI_BUILTIN_NUM                                                                            \
+    (3 + CLI_BUILTIN_ENABLE * (6 + CLI_GETOPT_ENABLE + CLI_CANCEL_ENABLE + CLI_STREAM_ARG_ENABLE   \
+                               + CLI_POOL_ENABLE + CLI_MEM_ENABLE * 3 + CLI_RX_ENABLE              \
+                               + CLI_TX_ENABLE + CLI_XFER_ENABLE * 3 + CLI_PLUGIN_ENABLE           \
+                               + CLI_TRACE_ENABLE * 4)                                             \
+     + CLI_TIMER_ENABLE * 3 + CLI_RPC_ENABLE + CLI_SHM_ENABLE * 3 + CLI_SERVER_ENABLE * 3)
+
+/*!@defgroup CLI output streams & modes
+ *
+ */
+#define CLI_STREAM_OUT          0           //!< Command output
+#define CLI_STREAM_ERR          1           //!< Error messages
+#define CLI_STREAM_ECHO         2           //!< Echo, prompt & OK/FAIL for an interactive terminal
+#define CLI_STREAM_RAW          3           //!< Protocol frames, written by the port as is & at once
+#define CLI_STREAM_LOG          4           //!< WARNING/INFO logs, may be dropped on a busy link
+#define CLI_MODE_TEXT           0           //!< Interactive terminal with echo, prompt & colors
+#define CLI_MODE_JSON           1           //!< One JSON record per command line, no echo/ANSI
+#define CLI_CAPTURE_SIZE        1024        //!< Output captured for one JSON record
+#define CLI_RUN_LINES           16          //!< Maximum command lines run by one Cli_Run()
+
+/*!@def CLI_CHUNK_xxx
+ *          Events of a stream command, see Cli_RegisterStream().
+ */
+#define CLI_CHUNK_BEGIN         0           //!< Payload starts
+#define CLI_CHUNK_DATA          1           //!< Next bytes of the payload
+#define CLI_CHUNK_END           2           //!< Payload is complete, return the command result
+#define CLI_CHUNK_ABORT         3           //!< Line is cancelled or a chunk has failed
 
 // General Print
 #define CLI_PRINT(msg, args...)                                                                    \
     if (gCliDebugLevel >= 0)                                                                       \
     {                                                                                              \
-        fprintf(stdout, msg, ##args);                                                              \
+        Cli_Printf(CLI_STREAM_OUT, msg, ##args);                                                   \
+    }
+
+// Terminal echo & prompt, dropped in machine-readable mode.
+#define CLI_ECHO(msg, args...)                                                                     \
+    if (gCliDebugLevel >= 0)                                                                       \
+    {                                                                                              \
+        Cli_Printf(CLI_STREAM_ECHO, msg, ##args);                                                  \
     }
 
 // Error Message output, with RED color.
 #define CLI_ERROR(msg, args...)                                                                    \
     if (gCliDebugLevel >= 1)                                                                       \
     {                                                                                              \
-        fprintf(stderr, ANSI_RED "%s <%s:%d> " msg ANSI_RESET,                                     \
-                Cli_TimeStampStr(), __FILE__, __LINE__,                                            \
-                ##args);                                                                           \
+        Cli_Log(1, __FILE__, __LINE__, msg, ##args);                                               \
     }
 
 // Warning Message output, with Yellow color.
 #define CLI_WARNING(msg, args...)                                                                  \
     if (gCliDebugLevel >= 2)                                                                       \
     {                                                                                              \
-        fprintf(stdout, ANSI_YELLOW "%s <%s:%d> " msg ANSI_RESET,                                  \
-                Cli_TimeStampStr(), __FILE__, __LINE__,                                            \
-                ##args);                                                                           \
+        Cli_Log(2, __FILE__, __LINE__, msg, ##args);                                               \
     }
 
 // Warning Message output, with Green color.
 #define CLI_INFO(msg, args...)                                                                     \
     if (gCliDebugLevel >= 3)                                                                       \
     {                                                                                              \
-        fprintf(stdout, ANSI_MAGENTE"%s " msg ANSI_RESET,                                          \
-                Cli_TimeStampStr(),                                                                \
-                ##args);                                                                           \
+        Cli_Log(3, __FILE__, __LINE__, msg, ##args);                                               \
     }
 
+// Trace span, costs a test of gCliTraceOn when tracing is off.
+#if CLI_TRACE_ENABLE
+#define CLI_TRACE_BEGIN(name)                                                                      \
+    if (gCliTraceOn)                                                                               \
+    {                                                                                              \
+        Cli_TraceBegin(name);                                                                      \
+    }
+#define CLI_TRACE_END()                                                                            \
+    if (gCliTraceOn)                                                                               \
+    {                                                                                              \
+        Cli_TraceEnd();                                                                            \
+    }
+#else
+#define CLI_TRACE_BEGIN(name)
+#define CLI_TRACE_END()
+#endif
+
 /*!@typedef CliCommand_TypeDef
- *          Structure for a CLI command.
+ *          Structure for a CLI command. Commands form a tree, a group like
+ *          "net" holds sub commands like "net if show". Name points to the
+ *          word of this node inside the registered name.
  */
 typedef struct
 {
     const char *Name;                   //!< Command Name
     const char *Prompt;                 //!< Prompt text
-    int (*Func)(int argc, char **argv); //!< Function call
+    int (*Func)(int argc, char **argv); //!< Function call, NULL for a group
+#if CLI_STREAM_ARG_ENABLE
+    int (*Chunk)(int event, const char *buf, int len); //!< Payload consumer of a stream command
+#endif
+#if CLI_CANCEL_ENABLE
+    unsigned int Timeout;               //!< Time limit in ms, 0 for none
+#endif
+    unsigned char NameLen;              //!< Length of Name
+    unsigned char Builtin;              //!< Registered by Cli_Init()
+    short Parent;                       //!< Parent node, -1 for top level
+    short Child;                        //!< First sub command, -1 for none
+    short Sibling;                      //!< Next command with the same parent
+    short HashNext;                     //!< Next command in the same lookup bucket
 } CliCommand_TypeDef;
 
+/*!@typedef CliTable_TypeDef
+ *          A version of the command table. Dispatch reads the published
+ *          version without lock, Cli_Register & Cli_Unregister change a copy
+ *          and publish it, see table_write_begin() in cli.c.
+ */
+typedef struct
+{
+    CliCommand_TypeDef List[CLI_COMMAND_SIZE];  //!< Command nodes, by index
+    short Hash[CLI_COMMAND_HASH_SIZE];          //!< Child lookup buckets, by hash of parent & name
+    short Root;                                 //!< First top level command
+    unsigned short Num;                         //!< Number of commands & groups
+} CliTable_TypeDef;
+
 /*!@typedef CliOption_TypeDef
  *          Structure for a CLI command options. It's a implement of the
  *          "getopt" & "getopt_long" function.
- * @example see "builtin_test" function
+ *          With a value type it's also a schema for Cli_ParseOptions(), which
+ *          checks the value and stores it at Offset of the caller's struct.
+ *          Type CLI_OPT_ARG marks a positional argument, LongName is its name
+ *          in the help text. The table ends with ReturnVal 0, its Help is the
+ *          usage of the arguments left after the parse, e.g. "command".
+ * @example see "builtin_test" & "builtin_bench" function
  */
 typedef struct
 {
     const char ShortName;   //!< Short name work with "-", e.g. 'h'
     const char *LongName;  //!< Long name work with "--", e.g. "help"
     const int ReturnVal;    //!< Return value . Use short name would be the simplest way.
+    unsigned char Type;     //!< Value type CLI_OPT_xxx, CLI_OPT_NONE for cli_getopt only
+    unsigned short Offset;  //!< Offset of the value in the caller's struct
+    const char *Help;       //!< Help text
+    const char *Default;    //!< Default value as typed, NULL for 0
+    const char *Enum;       //!< Names of CLI_OPT_ENUM values separated by '|'
+    long Min;               //!< Range of a number, no check when Min >= Max
+    long Max;
 } CliOption_TypeDef;
 
+/*!@def CLI_OPT_xxx
+ *          Value types of CliOption_TypeDef & the C type stored for them.
+ */
+#define CLI_OPT_NONE            0           //!< Not parsed by Cli_ParseOptions
+#define CLI_OPT_FLAG            1           //!< int, 1 when the option is given
+#define CLI_OPT_INT             2           //!< int
+#define CLI_OPT_UINT            3           //!< unsigned int
+#define CLI_OPT_FLOAT           4           //!< float
+#define CLI_OPT_ENUM            5           //!< int, index of the name in Enum
+#define CLI_OPT_STRING          6           //!< char *, points into the arguments
+#define CLI_OPT_ARG             0x80        //!< Positional argument, OR with a type
+
+// Table entries of Cli_ParseOptions, e.g.
+// CLI_OPTION('n', "runs", CLI_OPT_UINT, Bench_TypeDef, Runs, "1000", 0, 1000000, "Runs to measure")
+#define CLI_OPTION(s, l, type, st, member, def, min, max, help)                                    \
+    { (s), (l), (s) ? (s) : 1, (type), offsetof(st, member), (help), (def), NULL, (min), (max) }
+#define CLI_OPTION_ENUM(s, l, st, member, def, names, help)                                        \
+    { (s), (l), (s) ? (s) : 1, CLI_OPT_ENUM, offsetof(st, member), (help), (def), (names), 0, 0 }
+#define CLI_ARGUMENT(name, type, st, member, def, min, max, help)                                  \
+    { 0, (name), 1, (type) | CLI_OPT_ARG, offsetof(st, member), (help), (def), NULL, (min), (max) }
+#define CLI_OPTION_END(usage)                                                                      \
+    { 0, NULL, 0, CLI_OPT_NONE, 0, (usage), NULL, NULL, 0, 0 }
+
+/*!@typedef CliOutput_TypeDef
+ *          Destination of CLI output, see Cli_SetOutput().
+ */
+typedef struct
+{
+    int (*Write)(void *arg, int stream, const char *buf, int len); //!< Write function
+    void *Arg;                                                     //!< Argument of Write
+} CliOutput_TypeDef;
+
+/*!@typedef CliXfer_TypeDef
+ *          One end of a windowed binary transfer, see cli_xfer.c. The owner
+ *          sets Send, Arg and Write (receiver) or Read (sender), then feeds
+ *          the bytes from the link to cli_xfer_input() & calls cli_xfer_step().
+ */
+#define CLI_XFER_RX             0           //!< Receive a file & write it to the target
+#define CLI_XFER_TX             1           //!< Read a file from the target & send it
+#define CLI_XFER_FRAME_SIZE     (CLI_XFER_BLOCK + 9)            //!< Type, Seq, data & CRC32
+#define CLI_XFER_COBS_SIZE      (CLI_XFER_FRAME_SIZE + CLI_XFER_FRAME_SIZE / 254 + 2)
+typedef struct
+{
+    int (*Send)(void *arg, const unsigned char *buf, int len);  //!< Write bytes to the link
+    void *Arg;                                                  //!< Argument of Send
+    int (*Write)(unsigned int offset, const unsigned char *buf, int len); //!< Store received data
+    int (*Read)(unsigned int offset, unsigned char *buf, int len);        //!< Get data to send
+    unsigned char Role;             //!< CLI_XFER_RX or CLI_XFER_TX
+    unsigned char State;            //!< Protocol state
+    unsigned char Window;           //!< Frames sent ahead, the smaller of both ends
+    unsigned char Nak;              //!< NAK sent for the current gap
+    unsigned int Ack;               //!< Blocks stored since the last ACK
+    unsigned int Base;              //!< Next block expected, or oldest block not acknowledged
+    unsigned int Next;              //!< Next block to send
+    unsigned int High;              //!< Blocks read from the target so far
+    unsigned int Last;              //!< Number of blocks, when the end of the file is known
+    unsigned int Size;              //!< File bytes so far
+    unsigned int Crc;               //!< CRC32 of the file so far
+    unsigned int Start;             //!< Time the transfer has started
+    unsigned int Tick;              //!< Time of the last progress
+    unsigned int Ping;              //!< Time READY or END was sent last
+    unsigned int Retry;             //!< Timeouts without progress
+    unsigned int Resent;            //!< Blocks sent again
+    unsigned int Errors;            //!< Bad frames received
+    int Result;                     //!< CLI_PENDING while running, then 0 or CLI_FAIL
+    unsigned int RxLen;             //!< Bytes in RxBuf
+    unsigned char RxBuf[CLI_XFER_COBS_SIZE];    //!< Encoded frame being received
+    unsigned char TxBuf[CLI_XFER_COBS_SIZE];    //!< Encoded frame to send
+} CliXfer_TypeDef;
+
+/*!@typedef CliSession_TypeDef
+ *          A console with its own line editor, history & command line job,
+ *          e.g. a socket connection. It's opaque, see Cli_SessionNew().
+ */
+typedef struct CliSession CliSession_TypeDef;
+
+/*!@typedef CliCapture_TypeDef
+ *          Output that is kept in a buffer, ANSI escape sequences are removed.
+ */
+typedef struct
+{
+    CliOutput_TypeDef Output;   //!< Output that writes to this capture
+    char *Buf;                  //!< Capture buffer
+    int Size;                   //!< Size of the buffer
+    int Len;                    //!< Bytes captured
+    int Lost;                   //!< Bytes dropped because the buffer is full
+    int Esc;                    //!< Inside an escape sequence
+} CliCapture_TypeDef;
+
+/*!@typedef CliPlanSegment_TypeDef
+ *          One ';' separated command inside a compiled plan.
+ */
+typedef struct
+{
+    int Argc;                           //!< Argument count
+    char **Argv;                        //!< Argument vector, points into the plan buffer
+    int (*Func)(int argc, char **argv); //!< Resolved function call, NULL for unknown command
+    short Node;                         //!< Resolved command node, -1 for unknown command
+    short Skip;                         //!< Arguments of parent groups, not passed to Func
+#if CLI_CANCEL_ENABLE
+    unsigned int Timeout;               //!< Resolved time limit in ms, 0 for none
+#endif
+} CliPlanSegment_TypeDef;
+
+/*!@typedef CliPlan_TypeDef
+ *          A command string tokenized & resolved once, so it can be run many
+ *          times without copying, parsing or searching the command list again.
+ *          Plans are reference counted, release them with Cli_PlanFree().
+ */
+typedef struct
+{
+    unsigned int Hash;                  //!< Hash of the source string
+    unsigned int Generation;            //!< Command list generation segments are resolved with
+    unsigned int RefCount;              //!< Number of owners
+    unsigned int LastUse;               //!< LRU stamp used by the plan cache
+    int NumOfSegments;                  //!< Number of segments
+    CliPlanSegment_TypeDef *Segments;   //!< Segment list
+    char *Source;                       //!< Original command string
+} CliPlan_TypeDef;
+
+/*!@typedef CliPt_TypeDef
+ *          Resume state of a resumable command, protothread style. Local
+ *          variables are lost when a command yields, keep state in here.
+ */
+typedef struct
+{
+    unsigned int Line;          //!< Resume point, 0 for a fresh call
+    int Seg;                    //!< Scratch index, used by plans for the running segment
+    unsigned int Tick;          //!< Scratch for deadlines
+    unsigned int Count;         //!< Scratch for loop counters
+    void *Ptr;                  //!< Scratch pointer, e.g. a compiled plan
+    int (*Func)(int argc, char **argv); //!< Command the level runs, resolved when it starts
+    short Node;                 //!< Command node of Func
+    short Skip;                 //!< Arguments of parent groups, not passed to Func
+#if CLI_CANCEL_ENABLE
+    unsigned int Start;         //!< Time the level has started, for its timeout
+    unsigned int Timeout;       //!< Time limit of the level in ms, 0 for none
+#endif
+} CliPt_TypeDef;
+
+/*!@typedef CliJob_TypeDef
+ *          A plan in execution with the resume state of every nesting level.
+ */
+typedef struct
+{
+    CliPlan_TypeDef *Plan;              //!< Plan being run, NULL when idle
+    CliOutput_TypeDef *Output;          //!< Output of the job, NULL for the default
+    int Depth;                          //!< Current nesting level
+    int Cancel;                         //!< CLI_CANCEL_USER once cancelled, 0 while running
+    CliPt_TypeDef Frame[CLI_JOB_DEPTH]; //!< Resume state of each nesting level
+} CliJob_TypeDef;
+
+/*!@typedef CliRecord_TypeDef
+ *          A command line framed as one JSON record in machine-readable mode:
+ *          {"cmd":"...","ret":0,"us":12,"out":"..."}
+ *          "trunc" gives the bytes lost when output is larger than capture,
+ *          "timer" gives the ID when the line is fired by a timer.
+ */
+typedef struct
+{
+    CliCapture_TypeDef Capture;         //!< Output of the command line
+    CliPlan_TypeDef *Plan;              //!< Command line, NULL when no record is open
+    unsigned long long Start;           //!< Start time in ns
+    unsigned int Timer;                 //!< ID of the timer that fired it, 0 for none
+} CliRecord_TypeDef;
+
+/*!@defgroup Resumable command macros
+ *          A command that has to wait yields back to Cli_Run instead of
+ *          blocking, and it's called again with the same arguments on next
+ *          tick until it returns something else than CLI_PENDING.
+ * @example
+ *          int cmd_wait(int argc, char **argv)
+ *          {
+ *              CliPt_TypeDef *pt = Cli_PtSelf();
+ *              CLI_PT_BEGIN(pt);
+ *              pt->Tick = cli_gettick() + 500;
+ *              CLI_PT_WAIT_UNTIL(pt, (int) (cli_gettick() - pt->Tick) >= 0);
+ *              CLI_PT_END(pt);
+ *              return 0;
+ *          }
+ */
+#define CLI_PT_BEGIN(pt)                                                                           \
+    switch ((pt)->Line)                                                                            \
+    {                                                                                              \
+    case 0:
+
+#define CLI_PT_END(pt)                                                                             \
+    }                                                                                              \
+    (pt)->Line = 0
+
+// Yield once, resume after this line on next tick.
+#define CLI_PT_YIELD(pt)                                                                           \
+    do                                                                                             \
+    {                                                                                              \
+        (pt)->Line = __LINE__;                                                                     \
+        return CLI_PENDING;                                                                        \
+    case __LINE__:;                                                                                \
+    } while (0)
+
+// Yield until the condition is true.
+#define CLI_PT_WAIT_UNTIL(pt, cond)                                                                \
+    do                                                                                             \
+    {                                                                                              \
+        (pt)->Line = __LINE__;                                                                     \
+    case __LINE__:                                                                                 \
+        if (!(cond))                                                                               \
+        {                                                                                          \
+            return CLI_PENDING;                                                                    \
+        }                                                                                          \
+    } while (0)
+
+// Call a resumable function (e.g. Cli_PlanRun) and yield until it finishes.
+#define CLI_PT_SPAWN(pt, ret, call)                                                                \
+    do                                                                                             \
+    {                                                                                              \
+        (pt)->Line = __LINE__;                                                                     \
+    case __LINE__:                                                                                 \
+        (ret) = (call);                                                                            \
+        if ((ret) == CLI_PENDING)                                                                  \
+        {                                                                                          \
+            return CLI_PENDING;                                                                    \
+        }                                                                                          \
+    } while (0)
+
 /*! Variables ---------------------------------------------------------------*/
 
 /*!@def gCliDebugLevel
@@ -131,13 +617,84 @@ typedef struct
  */
 extern int gCliDebugLevel;
 
+/*!@def gCliMode
+ *      CLI_MODE_TEXT or CLI_MODE_JSON, see Cli_SetMode().
+ */
+extern int gCliMode;
+
+/*!@def gCliTraceOn
+ *      1 while spans are recorded, see Cli_TraceStart().
+ */
+extern int gCliTraceOn;
+
 /*! Functions ---------------------------------------------------------------*/
 char *Cli_TimeStampStr(void);
+int Cli_Write(int stream, const char *buf, int len);
+int Cli_Printf(int stream, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void Cli_Log(int level, const char *file, int line, const char *format, ...)
+        __attribute__((format(printf, 4, 5)));
+CliOutput_TypeDef *Cli_SetOutput(CliOutput_TypeDef *output);
+void Cli_CaptureInit(CliCapture_TypeDef *capture, char *buf, int size);
+void Cli_SetMode(int mode);
+CliOutput_TypeDef *Cli_RecordBegin(CliRecord_TypeDef *record, CliPlan_TypeDef *plan);
+void Cli_RecordEnd(CliRecord_TypeDef *record, int ret);
 int Cli_Register(const char *name, const char *prompt, int (*func)(int, char **));
 int Cli_Unregister(const char *name);
+int Cli_RegisterStream(const char *name, const char *prompt,
+                       int (*chunk)(int event, const char *buf, int len));
+int Cli_RegisterTimeout(const char *name, const char *prompt, int (*func)(int, char **),
+                        unsigned int timeout);
 int Cli_RunByArgs(int argcount, char **argbuf);
 int Cli_RunByString(char *cmd);
+CliPlan_TypeDef *Cli_PlanCompile(const char *cmd);
+CliPlan_TypeDef *Cli_PlanCompileArgs(int argc, char **argv);
+CliPlan_TypeDef *Cli_PlanGet(const char *cmd);
+int Cli_PlanRun(CliPlan_TypeDef *plan);
+void Cli_PlanFree(CliPlan_TypeDef *plan);
+int Cli_CommandSelf(void);
+int Cli_Cancelled(void);
+CliSession_TypeDef *Cli_SessionNew(int (*getc)(void *arg), void *arg, CliOutput_TypeDef *output);
+void Cli_SessionFree(CliSession_TypeDef *session);
+int Cli_SessionRun(CliSession_TypeDef *session);
+CliSession_TypeDef *Cli_SessionSelf(void);
+int Cli_ParseOptions(int argc, char **args, const CliOption_TypeDef options[], void *out);
+void Cli_PrintOptions(const char *name, const CliOption_TypeDef options[]);
+CliPt_TypeDef *Cli_PtSelf(void);
+int Cli_JobStart(CliJob_TypeDef *job, CliPlan_TypeDef *plan, CliOutput_TypeDef *output);
+int Cli_JobStep(CliJob_TypeDef *job);
+int Cli_PluginScan(const char *dir);
+int Cli_ShmOpen(const char *name);
+int Cli_ShmClose(void);
+void Cli_ShmWait(int ms);
+int Cli_ServerOpen(const char *addr);
+int Cli_ServerClose(void);
+void Cli_ServerWait(int ms);
+void Cli_TraceStart(void);
+void Cli_TraceStop(void);
+void Cli_TraceBegin(const char *name);
+void Cli_TraceEnd(void);
+int Cli_TraceDump(const char *path);
+unsigned int Cli_MemLive(void);
+void cli_mem_track(void *ptr, size_t size, void *site);
+void cli_mem_untrack(void *ptr);
+int cli_port_isr_putc(char c);
+int cli_port_isr_write(const char *buf, int len);
+int cli_rx_getc(void);
+unsigned int cli_rx_overflow(void);
+unsigned int cli_rx_room(void);
+void cli_tx_hold(int hold);
+void cli_rx_raw(int raw);
+int Cli_XferRegister(const char *name, int (*write)(unsigned int offset, const unsigned char *buf, int len),
+                     int (*read)(unsigned int offset, unsigned char *buf, int len));
+void cli_xfer_start(CliXfer_TypeDef *x, int role);
+void cli_xfer_input(CliXfer_TypeDef *x, const unsigned char *buf, int len);
+int cli_xfer_step(CliXfer_TypeDef *x);
+void cli_xfer_abort(CliXfer_TypeDef *x);
+int cli_port_record(const char *path);
+int cli_port_replay(const char *path, int fast);
+int cli_port_replaying(void);
 int Cli_Init(void);
+int Cli_Deinit(void);
 int Cli_Run(void);
 void Cli_Task(void const *arguments);
 
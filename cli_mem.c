@@ -0,0 +1,292 @@
+/******************************************************************************
+ * @file    cli_mem.c
+ * @brief   Heap accounting of the Command Line Interface (CLI).
+ *          The port reports every cli_malloc/cli_free here, with the return
+ *          address of the caller as its call site. Live & peak bytes, counts
+ *          per call site, the outstanding allocations and a log of the last
+ *          allocations & frees are kept in static tables, so heap growth on a
+ *          long-running device can be traced back to the code that holds it.
+ *
+ *          void *cli_malloc(size_t size)
+ *          {
+ *              void *ptr = malloc(size);
+ *              cli_mem_track(ptr, size, __builtin_return_address(0));
+ *              return ptr;
+ *          }
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cli.h"
+
+#if CLI_MEM_ENABLE
+
+/** Private defines ---------------------------------------------------------*/
+#define MEM_SITE_NONE       0xFFFF  // Site of a free that was not tracked
+
+/** Private types -----------------------------------------------------------*/
+typedef struct
+{
+    void *Ptr;                  //!< Allocated memory, NULL for a free entry
+    unsigned int Size;          //!< Bytes requested
+    unsigned int Seq;           //!< Allocation number
+    unsigned short Site;        //!< Index of the call site
+} MemBlock_TypeDef;
+
+typedef struct
+{
+    void *Addr;                 //!< Return address of the cli_malloc caller
+    unsigned int Allocs;        //!< Allocations made
+    unsigned int Frees;         //!< Allocations freed
+    unsigned int Bytes;         //!< Bytes outstanding
+    unsigned int Peak;          //!< Maximum bytes outstanding
+} MemSite_TypeDef;
+
+typedef struct
+{
+    unsigned int Tick;          //!< Time of the event in ms
+    void *Ptr;                  //!< Memory allocated or freed
+    unsigned int Size;          //!< Bytes allocated
+    unsigned short Site;        //!< Index of the call site
+    char Op;                    //!< 'A' allocation or 'F' free
+} MemLog_TypeDef;
+
+/** Private function prototypes ---------------------------------------------*/
+extern unsigned int cli_gettick(void);
+
+/** Variables ---------------------------------------------------------------*/
+static MemBlock_TypeDef MemBlock[CLI_MEM_TRACK_NUM];    // Outstanding allocations
+static MemSite_TypeDef MemSite[CLI_MEM_SITE_NUM];       // Call sites, the last one takes the rest
+static MemLog_TypeDef MemLog[CLI_MEM_LOG_NUM];          // Last allocations & frees
+static unsigned int MemLogIdx = 0;                      // Events logged
+static unsigned int MemLive = 0;                        // Bytes outstanding
+static unsigned int MemPeak = 0;                        // Maximum bytes outstanding
+static unsigned int MemAllocs = 0;                      // Allocations made
+static unsigned int MemFrees = 0;                       // Allocations freed
+static unsigned int MemFails = 0;                       // Allocations failed
+static unsigned int MemUntracked = 0;                   // Allocations not in MemBlock, table full
+static unsigned int MemUnknown = 0;                     // Frees of memory not in MemBlock
+
+/** Functions ---------------------------------------------------------------*/
+static unsigned short mem_site(void *addr)
+{
+    for (int i = 0; i < CLI_MEM_SITE_NUM; i++)
+    {
+        if ((MemSite[i].Addr == addr) || (MemSite[i].Addr == NULL))
+        {
+            MemSite[i].Addr = addr;
+            return i;
+        }
+    }
+    return CLI_MEM_SITE_NUM - 1;
+}
+
+static void mem_log(char op, void *ptr, unsigned int size, unsigned short site)
+{
+    MemLog_TypeDef *log = &MemLog[MemLogIdx++ % CLI_MEM_LOG_NUM];
+
+    log->Tick = cli_gettick();
+    log->Ptr = ptr;
+    log->Size = size;
+    log->Site = site;
+    log->Op = op;
+}
+
+/*!@brief Account an allocation, called by cli_malloc of the port.
+ *
+ * @param ptr   Allocated memory, NULL if the allocation failed
+ * @param size  Bytes requested
+ * @param site  Call site, e.g. __builtin_return_address(0)
+ */
+void cli_mem_track(void *ptr, size_t size, void *site)
+{
+    unsigned short idx = mem_site(site);
+
+    if (ptr == NULL)
+    {
+        MemFails++;
+        return;
+    }
+
+    MemAllocs++;
+    MemLive += size;
+    if (MemLive > MemPeak)
+    {
+        MemPeak = MemLive;
+    }
+
+    MemSite_TypeDef *ms = &MemSite[idx];
+    ms->Allocs++;
+    ms->Bytes += size;
+    if (ms->Bytes > ms->Peak)
+    {
+        ms->Peak = ms->Bytes;
+    }
+    mem_log('A', ptr, size, idx);
+
+    for (int i = 0; i < CLI_MEM_TRACK_NUM; i++)
+    {
+        if (MemBlock[i].Ptr == NULL)
+        {
+            MemBlock[i].Ptr = ptr;
+            MemBlock[i].Size = size;
+            MemBlock[i].Site = idx;
+            MemBlock[i].Seq = MemAllocs;
+            return;
+        }
+    }
+
+    // The size is lost, live bytes stay high by this much after it's freed.
+    MemUntracked++;
+}
+
+/*!@brief Account a free, called by cli_free of the port.
+ *
+ * @param ptr   Memory to be freed, NULL is ignored
+ */
+void cli_mem_untrack(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    MemFrees++;
+    for (int i = 0; i < CLI_MEM_TRACK_NUM; i++)
+    {
+        MemBlock_TypeDef *mb = &MemBlock[i];
+        if (mb->Ptr == ptr)
+        {
+            MemLive -= mb->Size;
+            MemSite[mb->Site].Frees++;
+            MemSite[mb->Site].Bytes -= mb->Size;
+            mem_log('F', ptr, mb->Size, mb->Site);
+            mb->Ptr = NULL;
+            return;
+        }
+    }
+
+    MemUnknown++;
+    mem_log('F', ptr, 0, MEM_SITE_NONE);
+}
+
+/*!@brief Bytes allocated through cli_malloc and not freed yet.
+ */
+unsigned int Cli_MemLive(void)
+{
+    return MemLive;
+}
+
+#if CLI_BUILTIN_ENABLE
+/*!@brief Print a call site as "function+offset", or "module+offset" for
+ *        addr2line when the function has no symbol.
+ */
+static void mem_print_site(unsigned short site)
+{
+    if (site == MEM_SITE_NONE)
+    {
+        CLI_PRINT("?");
+        return;
+    }
+
+    void *addr = MemSite[site].Addr;
+#if defined(__linux__)
+    Dl_info info;
+    if (dladdr(addr, &info))
+    {
+        if (info.dli_sname != NULL)
+        {
+            CLI_PRINT("%s+0x%lx", info.dli_sname, (unsigned long) ((char *) addr - (char *) info.dli_saddr));
+            return;
+        }
+        const char *name = strrchr(info.dli_fname, '/');
+        CLI_PRINT("%s+0x%lx", name ? name + 1 : info.dli_fname,
+                  (unsigned long) ((char *) addr - (char *) info.dli_fbase));
+        return;
+    }
+#endif
+    CLI_PRINT("%p", addr);
+}
+
+/*!@brief Built-in command of "mem", show the heap footprint by call site.
+ *
+ */
+int builtin_mem(int argc, char **args)
+{
+    CLI_PRINT("Live     = %u bytes\n", MemLive);
+    CLI_PRINT("Peak     = %u bytes\n", MemPeak);
+    CLI_PRINT("Allocs   = %u, %u freed, %u outstanding, %u failed\n", MemAllocs, MemFrees,
+              MemAllocs - MemFrees, MemFails);
+    if (MemUntracked || MemUnknown)
+    {
+        CLI_PRINT("Untracked= %u allocs, %u unknown frees, raise CLI_MEM_TRACK_NUM\n",
+                  MemUntracked, MemUnknown);
+    }
+
+    CLI_PRINT("Allocs Frees  Live   Peak   Site\n");
+    CLI_PRINT("----------------------------------\n");
+    for (int i = 0; (i < CLI_MEM_SITE_NUM) && (MemSite[i].Addr != NULL); i++)
+    {
+        MemSite_TypeDef *ms = &MemSite[i];
+        CLI_PRINT("%-6u %-6u %-6u %-6u ", ms->Allocs, ms->Frees, ms->Bytes, ms->Peak);
+        mem_print_site(i);
+        CLI_PRINT("\n");
+    }
+    return 0;
+}
+
+/*!@brief Built-in command of "mem list", list the outstanding allocations.
+ *
+ */
+int builtin_mem_list(int argc, char **args)
+{
+    unsigned int num = 0;
+
+    CLI_PRINT("Seq    Address            Size   Site\n");
+    CLI_PRINT("--------------------------------------\n");
+    for (int i = 0; i < CLI_MEM_TRACK_NUM; i++)
+    {
+        MemBlock_TypeDef *mb = &MemBlock[i];
+        if (mb->Ptr != NULL)
+        {
+            CLI_PRINT("%-6u %-18p %-6u ", mb->Seq, mb->Ptr, mb->Size);
+            mem_print_site(mb->Site);
+            CLI_PRINT("\n");
+            num++;
+        }
+    }
+    CLI_PRINT("%u allocations, %u bytes\n", num, MemLive);
+    return 0;
+}
+
+/*!@brief Built-in command of "mem log", show the last allocations & frees.
+ *
+ */
+int builtin_mem_log(int argc, char **args)
+{
+    unsigned int first = (MemLogIdx > CLI_MEM_LOG_NUM) ? MemLogIdx - CLI_MEM_LOG_NUM : 0;
+
+    CLI_PRINT("Tick       Op    Address            Size   Site\n");
+    CLI_PRINT("------------------------------------------------\n");
+    for (unsigned int i = first; i < MemLogIdx; i++)
+    {
+        MemLog_TypeDef *log = &MemLog[i % CLI_MEM_LOG_NUM];
+        CLI_PRINT("%-10u %-5s %-18p %-6u ", log->Tick, (log->Op == 'A') ? "alloc" : "free",
+                  log->Ptr, log->Size);
+        mem_print_site(log->Site);
+        CLI_PRINT("\n");
+    }
+    return 0;
+}
+#endif /* CLI_BUILTIN_ENABLE */
+
+#endif /* CLI_MEM_ENABLE */
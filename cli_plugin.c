@@ -0,0 +1,322 @@
+/******************************************************************************
+ * @file    cli_plugin.c
+ * @brief   Lazily loaded command plugins for the Command Line Interface (CLI).
+ *          Every "<name>.so" in CLI_PLUGIN_DIR is registered as a stub command
+ *          "<name>" at start up, without opening the file. The first call of
+ *          the stub loads the module, registers its commands in place of the
+ *          stub and runs the command line again. A module idle for
+ *          CLI_PLUGIN_IDLE_MS is unloaded and the stub comes back.
+ *
+ *          A module exports a table of its commands, ended by a NULL name.
+ *          Names must be "<name>" or start with "<name> ":
+ *
+ *          const CliCommand_TypeDef cli_plugin_commands[] = {
+ *              { "demo", "Demo plugin", &demo },
+ *              { "demo hello", "Say hello", &demo_hello },
+ *              { NULL }
+ *          };
+ *
+ *          Link the CLI with -rdynamic so modules can use the CLI API.
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cli.h"
+
+#if CLI_PLUGIN_ENABLE
+#include <dirent.h>
+#include <dlfcn.h>
+
+/** Private defines ---------------------------------------------------------*/
+#define PLUGIN_NAME_SIZE    32
+#define PLUGIN_PATH_SIZE    256
+#define PLUGIN_TABLE_SYMBOL "cli_plugin_commands"
+
+/** Private types -----------------------------------------------------------*/
+typedef struct
+{
+    char Name[PLUGIN_NAME_SIZE];        //!< Command name, file name without ".so"
+    char Prompt[PLUGIN_PATH_SIZE];      //!< Prompt of the stub, also the file path
+    void *Handle;                       //!< dlopen handle, NULL when not loaded
+    const CliCommand_TypeDef *Table;    //!< Command table of the loaded module
+    unsigned int LastUse;               //!< Tick of the last call
+    unsigned int Busy;                  //!< Commands of the module that have yielded
+    unsigned int Loads;                 //!< Number of times loaded
+} CliPlugin_TypeDef;
+
+/** Private function prototypes ---------------------------------------------*/
+extern unsigned int cli_gettick(void);
+static int plugin_stub(int argc, char **args);
+
+/** Variables ---------------------------------------------------------------*/
+static CliPlugin_TypeDef PluginList[CLI_PLUGIN_NUM];                // Installed modules
+static unsigned int PluginNum = 0;                                  // Number of modules
+static signed char PluginOwner[CLI_COMMAND_SIZE];                   // Module of each command, -1 for none
+static int (*PluginFunc[CLI_COMMAND_SIZE])(int argc, char **argv);  // Function in the module
+
+/** Functions ---------------------------------------------------------------*/
+/*!@brief Call a command of a module. Use of the module is tracked here so an
+ *        idle module can be unloaded while none of its commands is running.
+ *        A command that yields once cancelled ends here, not dropped later.
+ */
+static int plugin_call(int argc, char **args)
+{
+    int node = Cli_CommandSelf();
+    CliPlugin_TypeDef *plugin = &PluginList[PluginOwner[node]];
+    CliPt_TypeDef *pt = Cli_PtSelf();
+    int resumed = (pt->Line != 0);
+
+    plugin->LastUse = cli_gettick();
+    int ret = PluginFunc[node](argc, args);
+    if ((ret == CLI_PENDING) && (pt->Line != 0) && Cli_Cancelled())
+    {
+        // cli_exec would resume it once more & drop it, unseen here. The
+        // last resume is given here instead, so it ends & frees the module.
+        PluginFunc[node](argc, args);
+        ret = CLI_CANCELLED;
+    }
+    int pending = (ret == CLI_PENDING) && (pt->Line != 0);
+
+    plugin->Busy += pending - resumed;
+    return ret;
+}
+
+/*!@brief Register a command of a plugin, or the stub.
+ */
+static int plugin_register(int idx, const char *name, const char *prompt,
+                           int (*func)(int, char **))
+{
+    int node = Cli_Register(name, prompt, (func == plugin_stub) ? func : plugin_call);
+
+    if (node >= 0)
+    {
+        PluginOwner[node] = idx;
+        PluginFunc[node] = func;
+    }
+    return node;
+}
+
+/*!@brief Open a module and replace its stub by the commands it exports.
+ *
+ * @return CLI_OK or CLI_FAIL, the stub stays when it fails.
+ */
+static int plugin_load(int idx)
+{
+    CliPlugin_TypeDef *plugin = &PluginList[idx];
+    int len = strlen(plugin->Name);
+
+    void *handle = dlopen(plugin->Prompt, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL)
+    {
+        CLI_ERROR("ERROR: %s\n", dlerror());
+        return CLI_FAIL;
+    }
+
+    const CliCommand_TypeDef *table = dlsym(handle, PLUGIN_TABLE_SYMBOL);
+    if (table == NULL)
+    {
+        CLI_ERROR("ERROR: no %s in [%s]\n", PLUGIN_TABLE_SYMBOL, plugin->Prompt);
+        dlclose(handle);
+        return CLI_FAIL;
+    }
+
+    plugin->Handle = handle;
+    plugin->Table = table;
+    plugin->Loads++;
+    plugin->LastUse = cli_gettick();
+    Cli_Unregister(plugin->Name);
+
+    for (const CliCommand_TypeDef *cmd = table; cmd->Name != NULL; cmd++)
+    {
+        // A module can only add commands under its own name.
+        if ((strncmp(cmd->Name, plugin->Name, len) != 0)
+            || ((cmd->Name[len] != 0) && (cmd->Name[len] != ' ')))
+        {
+            CLI_WARNING("WARNING: [%s] is out of plugin [%s]\n", cmd->Name, plugin->Name);
+            continue;
+        }
+
+        if (plugin_register(idx, cmd->Name, cmd->Prompt, cmd->Func) < 0)
+        {
+            CLI_WARNING("WARNING: can not register [%s]\n", cmd->Name);
+        }
+    }
+
+    return CLI_OK;
+}
+
+/*!@brief Remove the commands of a module, close it and put the stub back.
+ */
+static void plugin_unload(int idx)
+{
+    CliPlugin_TypeDef *plugin = &PluginList[idx];
+
+    // Sub commands first, a group is removed with its last sub command.
+    const CliCommand_TypeDef *last = plugin->Table;
+    while (last->Name != NULL)
+    {
+        last++;
+    }
+    while (last-- != plugin->Table)
+    {
+        Cli_Unregister(last->Name);
+    }
+
+    for (int i = 0; i < CLI_COMMAND_SIZE; i++)
+    {
+        if (PluginOwner[i] == idx)
+        {
+            PluginOwner[i] = -1;
+            PluginFunc[i] = NULL;
+        }
+    }
+
+    dlclose(plugin->Handle);
+    plugin->Handle = NULL;
+    plugin->Table = NULL;
+    plugin_register(idx, plugin->Name, plugin->Prompt, plugin_stub);
+}
+
+/*!@brief Stub of a module that is not loaded. Loads it and runs the command
+ *        line again, now resolved to the commands of the module.
+ */
+static int plugin_stub(int argc, char **args)
+{
+    CliPt_TypeDef *pt = Cli_PtSelf();
+    int ret = CLI_OK;
+
+    CLI_PT_BEGIN(pt);
+
+    int idx = PluginOwner[Cli_CommandSelf()];
+    if (plugin_load(idx) != CLI_OK)
+    {
+        return CLI_FAIL;
+    }
+
+    pt->Ptr = Cli_PlanCompileArgs(argc, args);
+    if (pt->Ptr == NULL)
+    {
+        return CLI_FAIL;
+    }
+
+    CLI_PT_SPAWN(pt, ret, Cli_PlanRun(pt->Ptr));
+    Cli_PlanFree(pt->Ptr);
+
+    CLI_PT_END(pt);
+    return ret;
+}
+
+/*!@brief Register a stub for every module in a directory, modules are not
+ *        opened here.
+ *
+ * @param dir   Directory of "*.so" modules
+ * @return      Number of modules found.
+ */
+int Cli_PluginScan(const char *dir)
+{
+    DIR *d = opendir(dir);
+    struct dirent *ent;
+    int num = 0;
+
+    if (d == NULL)
+    {
+        return 0;
+    }
+
+    while (((ent = readdir(d)) != NULL) && (PluginNum < CLI_PLUGIN_NUM))
+    {
+        int len = strlen(ent->d_name);
+        if ((len <= 3) || (len - 3 >= PLUGIN_NAME_SIZE) || (strcmp(&ent->d_name[len - 3], ".so") != 0))
+        {
+            continue;
+        }
+
+        CliPlugin_TypeDef *plugin = &PluginList[PluginNum];
+        memset(plugin, 0, sizeof(CliPlugin_TypeDef));
+        memcpy(plugin->Name, ent->d_name, len - 3);
+        if (snprintf(plugin->Prompt, sizeof(plugin->Prompt), "%s/%s", dir, ent->d_name)
+            >= (int) sizeof(plugin->Prompt))
+        {
+            continue;
+        }
+
+        if (plugin_register(PluginNum, plugin->Name, plugin->Prompt, plugin_stub) >= 0)
+        {
+            PluginNum++;
+            num++;
+        }
+    }
+
+    closedir(d);
+    return num;
+}
+
+/*!@brief Scan CLI_PLUGIN_DIR, called from Cli_Init.
+ */
+void cli_plugin_init(void)
+{
+    memset(PluginOwner, -1, sizeof(PluginOwner));
+    PluginNum = 0;
+    Cli_PluginScan(CLI_PLUGIN_DIR);
+}
+
+/*!@brief Unload modules that have been idle, called from Cli_Run.
+ */
+void cli_plugin_poll(void)
+{
+#if CLI_PLUGIN_IDLE_MS > 0
+    unsigned int now = cli_gettick();
+
+    for (int i = 0; i < PluginNum; i++)
+    {
+        CliPlugin_TypeDef *plugin = &PluginList[i];
+        if ((plugin->Handle != NULL) && (plugin->Busy == 0)
+            && (now - plugin->LastUse >= CLI_PLUGIN_IDLE_MS))
+        {
+            plugin_unload(i);
+        }
+    }
+#endif
+}
+
+/*!@brief Unload all modules, called from Cli_Deinit.
+ */
+void cli_plugin_deinit(void)
+{
+    for (int i = 0; i < PluginNum; i++)
+    {
+        if (PluginList[i].Handle != NULL)
+        {
+            plugin_unload(i);
+        }
+    }
+}
+
+#if CLI_BUILTIN_ENABLE
+/*!@brief Built-in command of "plugin", show installed modules.
+ *
+ */
+int builtin_plugin(int argc, char **args)
+{
+    unsigned int now = cli_gettick();
+
+    CLI_PRINT("Name             State    Loads  Busy   Idle(ms)  Path\n");
+    CLI_PRINT("--------------------------------------------------------\n");
+    for (int i = 0; i < PluginNum; i++)
+    {
+        CliPlugin_TypeDef *plugin = &PluginList[i];
+        CLI_PRINT("%-16s %-8s %-6u %-6u %-9u %s\n", plugin->Name,
+                  (plugin->Handle != NULL) ? "loaded" : "stub", plugin->Loads, plugin->Busy,
+                  (plugin->Handle != NULL) ? now - plugin->LastUse : 0, plugin->Prompt);
+    }
+
+    return 0;
+}
+#endif /* CLI_BUILTIN_ENABLE */
+
+#endif /* CLI_PLUGIN_ENABLE */
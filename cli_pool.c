@@ -0,0 +1,223 @@
+/******************************************************************************
+ * @file    cli_pool.c
+ * @brief   Fixed-block pool allocator for the Command Line Interface (CLI).
+ *          Memory is carved from one static arena into size classes defined
+ *          by CLI_POOL_CLASSES in cli.h. Allocation & free are O(1) through
+ *          a free list per class, and an exhausted pool fails at once.
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cli.h"
+
+#if CLI_POOL_ENABLE
+
+/** Private defines ---------------------------------------------------------*/
+#define POOL_ALIGN(size)            (((size) + 7) & ~7)
+#define POOL_ARENA_SUM(size, num)   +POOL_ALIGN(size) * (num)
+#define POOL_COUNT_SUM(size, num)   +(num)
+#define POOL_CLASS_DESC(size, num)  { POOL_ALIGN(size), (num) },
+
+#define POOL_ARENA_SIZE             (0 CLI_POOL_CLASSES(POOL_ARENA_SUM))
+#define POOL_BLOCK_NUM              (0 CLI_POOL_CLASSES(POOL_COUNT_SUM))
+
+/** Private types -----------------------------------------------------------*/
+typedef struct
+{
+    unsigned int BlockSize;     //!< Size of each block
+    unsigned int NumOfBlocks;   //!< Number of blocks in this class
+} PoolClassDesc_TypeDef;
+
+typedef struct
+{
+    uint8_t *Base;              //!< First block of the class in the arena
+    void *FreeList;             //!< Singly linked list of free blocks
+    unsigned int FirstBlock;    //!< Index of the first block in PoolReqSize
+    unsigned int InUse;         //!< Blocks allocated now
+    unsigned int HighWater;     //!< Maximum blocks allocated at the same time
+    unsigned int Spill;         //!< Requests served by a larger class
+    unsigned int Fail;          //!< Requests failed when this class was the best fit
+} PoolClass_TypeDef;
+
+/** Variables ---------------------------------------------------------------*/
+static const PoolClassDesc_TypeDef PoolDesc[] = { CLI_POOL_CLASSES(POOL_CLASS_DESC) };
+#define POOL_CLASS_NUM (sizeof(PoolDesc) / sizeof(PoolDesc[0]))
+
+static uint64_t PoolArena[POOL_ARENA_SIZE / sizeof(uint64_t)];    // Backing store of all blocks
+static uint16_t PoolReqSize[POOL_BLOCK_NUM];                      // Requested size of each block
+static PoolClass_TypeDef PoolClass[POOL_CLASS_NUM];               // Runtime state of each class
+static unsigned int PoolReady = 0;      // Arena has been carved
+static unsigned int PoolBytesUsed = 0;  // Bytes of blocks in use
+static unsigned int PoolBytesReq = 0;   // Bytes requested by callers
+static unsigned int PoolBytesPeak = 0;  // High-water mark of PoolBytesUsed
+
+/** Functions ---------------------------------------------------------------*/
+/*!@brief Carve the arena into classes and link the free lists.
+ */
+static void pool_init(void)
+{
+    uint8_t *base = (uint8_t *) PoolArena;
+    unsigned int first = 0;
+
+    for (unsigned int c = 0; c < POOL_CLASS_NUM; c++)
+    {
+        PoolClass_TypeDef *pc = &PoolClass[c];
+        memset(pc, 0, sizeof(PoolClass_TypeDef));
+        pc->Base = base;
+        pc->FirstBlock = first;
+
+        // Link from the last block so the free list starts at the lowest address.
+        for (int i = PoolDesc[c].NumOfBlocks - 1; i >= 0; i--)
+        {
+            void **block = (void **) (base + i * PoolDesc[c].BlockSize);
+            *block = pc->FreeList;
+            pc->FreeList = block;
+        }
+
+        base += PoolDesc[c].BlockSize * PoolDesc[c].NumOfBlocks;
+        first += PoolDesc[c].NumOfBlocks;
+    }
+
+    PoolReady = 1;
+}
+
+/*!@brief Allocate a block from the smallest class that has a free block.
+ *
+ * @param size  Bytes requested
+ * @return      Pointer to the block or NULL when no class can serve it.
+ */
+void *cli_pool_alloc(size_t size)
+{
+    int best = -1;
+    int pick = -1;
+
+    if (PoolReady == 0)
+    {
+        pool_init();
+    }
+
+    // Best fit is the smallest class that could hold it, pick is the smallest
+    // one that still has a free block.
+    for (unsigned int c = 0; c < POOL_CLASS_NUM; c++)
+    {
+        if (PoolDesc[c].BlockSize < size)
+        {
+            continue;
+        }
+
+        if ((best < 0) || (PoolDesc[c].BlockSize < PoolDesc[best].BlockSize))
+        {
+            best = c;
+        }
+
+        if ((PoolClass[c].FreeList != NULL)
+            && ((pick < 0) || (PoolDesc[c].BlockSize < PoolDesc[pick].BlockSize)))
+        {
+            pick = c;
+        }
+    }
+
+    if (pick < 0)
+    {
+        if (best >= 0)
+        {
+            PoolClass[best].Fail++;
+        }
+        return NULL;
+    }
+
+    PoolClass_TypeDef *pc = &PoolClass[pick];
+    void **block = pc->FreeList;
+    pc->FreeList = *block;
+
+    if (pick != best)
+    {
+        PoolClass[best].Spill++;
+    }
+    if (++pc->InUse > pc->HighWater)
+    {
+        pc->HighWater = pc->InUse;
+    }
+
+    PoolReqSize[pc->FirstBlock + ((uint8_t *) block - pc->Base) / PoolDesc[pick].BlockSize] = size;
+    PoolBytesReq += size;
+    PoolBytesUsed += PoolDesc[pick].BlockSize;
+    if (PoolBytesUsed > PoolBytesPeak)
+    {
+        PoolBytesPeak = PoolBytesUsed;
+    }
+
+    return block;
+}
+
+/*!@brief Return a block to its class.
+ *
+ * @param ptr   Pointer returned by cli_pool_alloc(), NULL is ignored.
+ */
+void cli_pool_free(void *ptr)
+{
+    uint8_t *p = ptr;
+
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    for (unsigned int c = 0; c < POOL_CLASS_NUM; c++)
+    {
+        PoolClass_TypeDef *pc = &PoolClass[c];
+        unsigned int span = PoolDesc[c].BlockSize * PoolDesc[c].NumOfBlocks;
+
+        if ((p >= pc->Base) && (p < pc->Base + span))
+        {
+            unsigned int idx = pc->FirstBlock + (p - pc->Base) / PoolDesc[c].BlockSize;
+
+            PoolBytesReq -= PoolReqSize[idx];
+            PoolBytesUsed -= PoolDesc[c].BlockSize;
+            PoolReqSize[idx] = 0;
+            pc->InUse--;
+
+            *(void **) ptr = pc->FreeList;
+            pc->FreeList = ptr;
+            return;
+        }
+    }
+}
+
+#if CLI_BUILTIN_ENABLE
+/*!@brief Built-in command of "pool", show pool usage & fragmentation.
+ *
+ */
+int builtin_pool(int argc, char **args)
+{
+    if (PoolReady == 0)
+    {
+        pool_init();
+    }
+
+    CLI_PRINT("Class  Size   Blocks Used   Peak   Spill  Fail\n");
+    CLI_PRINT("----------------------------------------------\n");
+    for (unsigned int c = 0; c < POOL_CLASS_NUM; c++)
+    {
+        PoolClass_TypeDef *pc = &PoolClass[c];
+        CLI_PRINT("%-6d %-6u %-6u %-6u %-6u %-6u %-6u\n", c, PoolDesc[c].BlockSize,
+                  PoolDesc[c].NumOfBlocks, pc->InUse, pc->HighWater, pc->Spill, pc->Fail);
+    }
+
+    // Internal fragmentation: bytes of blocks in use that callers did not ask for.
+    unsigned int waste = PoolBytesUsed - PoolBytesReq;
+    CLI_PRINT("Arena = %u, Used = %u, Peak = %u, Requested = %u\n", (unsigned int) POOL_ARENA_SIZE,
+              PoolBytesUsed, PoolBytesPeak, PoolBytesReq);
+    CLI_PRINT("Fragmentation = %u bytes (%u%%)\n", waste,
+              PoolBytesUsed ? waste * 100 / PoolBytesUsed : 0);
+
+    return 0;
+}
+#endif /* CLI_BUILTIN_ENABLE */
+
+#endif /* CLI_POOL_ENABLE */
@@ -2,7 +2,7 @@
  * @file    cli_porting_mac.c
  * @brief   A simple Command Line Interface (CLI) for MCU.
  *          This file contains the API that needs to port for your system.
- *          This file give a example for MacOS.
+ *          This file give a example for MacOS, it builds on Linux too.
  *
  * @author  Nick Yang
  * @date    2018/11/01
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #ifdef __APPLE__
 #include "TargetConditionals.h"
@@ -20,13 +21,48 @@
 #include <termios.h>
 #include <unistd.h>
 #endif
+#elif defined(__linux__)
+#include <fcntl.h>
+#include <sys/timeb.h>
+#include <termios.h>
+#include <unistd.h>
 #endif
 
 #include "cli.h"
 
-void cli_sleep(float s)
+#if CLI_TX_ENABLE
+extern int cli_tx_write(int stream, const char *buf, int len);
+#endif
+#if CLI_POOL_ENABLE
+extern void *cli_pool_alloc(size_t size);
+extern void cli_pool_free(void *ptr);
+#endif
+
+/*!@def SESSION_MAGIC
+ *      Recorded session file: the magic, then one record per input byte,
+ *      time since the previous byte in us as a LEB128 varint & the byte.
+ */
+#define SESSION_MAGIC       "CLIR\x01"
+#define SESSION_MAGIC_LEN   5
+
+static FILE *RecordFile = NULL;             // Session being recorded
+static unsigned long long RecordLast = 0;   // Time of the last recorded byte in us
+static FILE *ReplayFile = NULL;             // Session being replayed
+static int ReplayFast = 0;                  // Replay without the recorded timing
+static int ReplayNext = EOF;                // Byte read ahead, EOF for none
+static unsigned long long ReplayStart = 0;  // Time the replay has started in ns
+static unsigned long long ReplayDue = 0;    // Time the next byte is due in ns
+static unsigned int ReplayBytes = 0;        // Bytes replayed
+static unsigned int ReplayLines = 0;        // Lines replayed
+static int ReplayPrev = EOF;                // Last byte replayed
+
+/*!@brief Sleep for an interval.
+ *
+ * @param ms    Interval in ms.
+ */
+void cli_sleep(int ms)
 {
-    usleep(s * 1000000);
+    usleep(ms * 1000);
 }
 
 /*!@brief Get system tick in ms.
@@ -40,21 +76,51 @@ unsigned int cli_gettick(void)
     return (unsigned int) (tm.time * 1000 + tm.millitm);
 }
 
+/*!@brief Get monotonic time in ns, for durations.
+ *
+ * @return
+ */
+unsigned long long cli_getnanos(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*!@brief Allocate zeroed memory for CLI.
+ *        With CLI_MEM_ENABLE the allocation is accounted to the caller.
+ *
+ * @param size  Bytes to allocate
+ * @return      Pointer to the memory or NULL when it's out of memory.
+ */
 void *cli_malloc(size_t size)
 {
+#if CLI_POOL_ENABLE
+    void *ptr = cli_pool_alloc(size);
+#else
+    void *ptr = malloc(size);
+#endif
 
-    void *ptr = NULL;
-    while (ptr == NULL)
+#if CLI_MEM_ENABLE
+    cli_mem_track(ptr, size, __builtin_return_address(0));
+#endif
+    if (ptr != NULL)
     {
-        ptr = malloc(size);
+        memset(ptr, 0, size);
     }
-    memset(ptr, 0, size);
     return ptr;
 }
 
 void cli_free(void *ptr)
 {
+#if CLI_MEM_ENABLE
+    cli_mem_untrack(ptr);
+#endif
+#if CLI_POOL_ENABLE
+    cli_pool_free(ptr);
+#else
     free(ptr);
+#endif
 }
 
 int cli_port_init()
@@ -85,10 +151,253 @@ int cli_port_init()
 
 void cli_port_deinit()
 {
-    ;
+    cli_port_record(NULL);
 }
 
-int cli_port_getc(void)
+#if CLI_RX_ENABLE
+/*!@brief Move bytes the terminal has received to the input ring, as far as
+ *        it has room. STDIN stands in for a UART with DMA, this is its
+ *        receive callback. Called by port_input() when the ring runs empty,
+ *        and by the output scheduler while it waits, so XON gets through.
+ */
+void cli_port_rx_poll(void)
 {
+    char buf[256];
+    unsigned int room = cli_rx_room();
+
+    if ((ReplayFile != NULL) || (room == 0))
+    {
+        return;
+    }
+
+    int len = read(STDIN_FILENO, buf, (room < sizeof(buf)) ? room : sizeof(buf));
+    if (len > 0)
+    {
+        cli_port_isr_write(buf, len);
+    }
+}
+
+#endif
+/*!@brief Get a byte of input from the terminal, see cli_port_rx_poll().
+ */
+static int port_input(void)
+{
+#if CLI_RX_ENABLE
+    int c = cli_rx_getc();
+    if (c == EOF)
+    {
+        cli_port_rx_poll();
+        c = cli_rx_getc();
+    }
+    return c;
+#else
     return getchar();
+#endif
+}
+
+static void varint_put(FILE *f, unsigned long long val)
+{
+    while (val >= 0x80)
+    {
+        fputc((int) (val & 0x7F) | 0x80, f);
+        val >>= 7;
+    }
+    fputc((int) val, f);
+}
+
+static int varint_get(FILE *f, unsigned long long *val)
+{
+    *val = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int c = fgetc(f);
+        if (c == EOF)
+        {
+            return -1;
+        }
+        *val |= (unsigned long long) (c & 0x7F) << shift;
+        if ((c & 0x80) == 0)
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*!@brief Record every input byte to a file, to replay the session later.
+ *
+ * @param path  File to write, NULL to stop recording
+ * @return      0 or -1 if the file can't be opened.
+ */
+int cli_port_record(const char *path)
+{
+    if (RecordFile != NULL)
+    {
+        fclose(RecordFile);
+        RecordFile = NULL;
+    }
+    if (path == NULL)
+    {
+        return 0;
+    }
+
+    RecordFile = fopen(path, "wb");
+    if (RecordFile == NULL)
+    {
+        return -1;
+    }
+    fwrite(SESSION_MAGIC, 1, SESSION_MAGIC_LEN, RecordFile);
+    RecordLast = cli_getnanos() / 1000;
+    return 0;
+}
+
+static void record_putc(int c)
+{
+    unsigned long long now = cli_getnanos() / 1000;
+
+    varint_put(RecordFile, now - RecordLast);
+    fputc(c, RecordFile);
+    RecordLast = now;
+
+    // Keep the file complete up to the last line, the process may be killed.
+    if ((c == '\n') || (c == '\r'))
+    {
+        fflush(RecordFile);
+    }
 }
+
+/*!@brief Feed input from a recorded file instead of the terminal. Terminal
+ *        input is used again when the file ends.
+ *
+ * @param path  File written by cli_port_record()
+ * @param fast  0 to keep the recorded timing, 1 for as fast as possible
+ * @return      0 or -1 if it's not a recorded session.
+ */
+int cli_port_replay(const char *path, int fast)
+{
+    char magic[SESSION_MAGIC_LEN];
+
+    ReplayFile = fopen(path, "rb");
+    if (ReplayFile == NULL)
+    {
+        return -1;
+    }
+    if ((fread(magic, 1, sizeof(magic), ReplayFile) != sizeof(magic))
+        || (memcmp(magic, SESSION_MAGIC, sizeof(magic)) != 0))
+    {
+        fclose(ReplayFile);
+        ReplayFile = NULL;
+        return -1;
+    }
+
+    ReplayFast = fast;
+    ReplayBytes = 0;
+    ReplayLines = 0;
+    ReplayStart = cli_getnanos();
+    ReplayDue = ReplayStart;
+    ReplayNext = EOF;
+    ReplayPrev = EOF;
+    return 0;
+}
+
+/*!@brief Check if a replay is running.
+ */
+int cli_port_replaying(void)
+{
+    return (ReplayFile != NULL);
+}
+
+static int replay_getc(void)
+{
+    // Read ahead the next record to know when it's due.
+    if (ReplayNext == EOF)
+    {
+        unsigned long long delta;
+        if ((varint_get(ReplayFile, &delta) != 0) || ((ReplayNext = fgetc(ReplayFile)) == EOF))
+        {
+            unsigned long long ns = cli_getnanos() - ReplayStart;
+            fclose(ReplayFile);
+            ReplayFile = NULL;
+            fprintf(stderr, "\nReplay: %u bytes, %u lines in %.3f ms, %.0f lines/s, %.0f bytes/s\n",
+                    ReplayBytes, ReplayLines, ns / 1e6, ReplayLines * 1e9 / ns,
+                    ReplayBytes * 1e9 / ns);
+            return EOF;
+        }
+        ReplayDue += delta * 1000;
+    }
+
+    if (!ReplayFast && ((long long) (cli_getnanos() - ReplayDue) < 0))
+    {
+        return EOF;
+    }
+
+    int c = ReplayNext;
+    ReplayNext = EOF;
+    ReplayBytes++;
+    ReplayLines += (c == '\r') || ((c == '\n') && (ReplayPrev != '\r'));
+    ReplayPrev = c;
+    return c;
+}
+
+/*!@brief Get a byte of input, from the terminal or a replayed session.
+ *        Bytes are recorded here when a recording is on.
+ *
+ * @return The byte, or EOF for no input.
+ */
+int cli_port_getc(void)
+{
+    int c = (ReplayFile != NULL) ? replay_getc() : port_input();
+
+    if ((c != EOF) && (RecordFile != NULL))
+    {
+        record_putc(c);
+    }
+    return c;
+}
+
+/*!@brief Write CLI output to the terminal.
+ *        With CLI_TX_ENABLE output is queued to the scheduler, which sends it
+ *        with cli_port_tx(), all streams share the one link.
+ *
+ * @param stream    CLI_STREAM_OUT/ERR/ECHO/RAW/LOG
+ * @param buf       Bytes to write
+ * @param len       Number of bytes
+ * @return          Number of bytes written.
+ */
+int cli_port_write(int stream, const char *buf, int len)
+{
+#if CLI_TX_ENABLE
+    return cli_tx_write(stream, buf, len);
+#else
+    if (stream == CLI_STREAM_ERR)
+    {
+        return fwrite(buf, 1, len, stderr);
+    }
+
+    int ret = fwrite(buf, 1, len, stdout);
+
+    // Echo & frames have to show up at once, not when the line is complete.
+    if ((stream == CLI_STREAM_ECHO) || (stream == CLI_STREAM_RAW))
+    {
+        fflush(stdout);
+    }
+    return ret;
+#endif
+}
+
+#if CLI_TX_ENABLE
+/*!@brief Send bytes on the link, without blocking.
+ *        A UART port fills the TX FIFO or starts a DMA transfer here and
+ *        returns how much it has taken.
+ *
+ * @param buf       Bytes to send
+ * @param len       Number of bytes
+ * @return          Number of bytes taken.
+ */
+int cli_port_tx(const char *buf, int len)
+{
+    int ret = fwrite(buf, 1, len, stdout);
+    fflush(stdout);
+    return ret;
+}
+#endif
@@ -0,0 +1,465 @@
+/******************************************************************************
+ * @file    cli_rpc.c
+ * @brief   Binary framed RPC for the Command Line Interface (CLI).
+ *          "rpc" switches the console port from text to binary frames, so a
+ *          host sends commands pre-tokenized and gets results without echo,
+ *          prompt or line parsing. Commands are dispatched to the same command
+ *          list as the text console.
+ *
+ *          Every frame is COBS encoded and ends with a 0x00 delimiter. The
+ *          decoded frame is:
+ *
+ *          | Seq (2) | Type (1) | Body (n) | CRC16 (2) |
+ *
+ *          Seq & CRC16 are little endian, CRC16 is CCITT (0x1021, init 0xFFFF)
+ *          over Seq, Type & Body. Requests & bodies:
+ *
+ *          RPC_REQ_CMD     Argc (1), then Argc NUL terminated arguments
+ *          RPC_REQ_PING    Any bytes, echoed back
+ *          RPC_REQ_EXIT    Empty, back to text console after the response
+ *
+ *          A response has the request Seq and Type | 0x80:
+ *
+ *          RPC_RSP_CMD     Ret (4, little endian), Flags (1), output text
+ *          RPC_RSP_PING    Bytes of the request
+ *          RPC_RSP_EXIT    Empty
+ *          RPC_RSP_ERROR   Error code (1), for a frame that can't be used
+ *          RPC_RSP_LOG     Stream (1), text printed outside of a command, Seq 0
+ *          RPC_RSP_HELLO   Version (1), maximum frame size (2), Seq 0, sent
+ *                          once when RPC starts
+ *
+ *          Requests are handled in order, a host may send many of them
+ *          without waiting for responses. A command that yields holds back
+ *          the following requests until it's finished.
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cli.h"
+
+#if CLI_RPC_ENABLE || CLI_XFER_ENABLE
+/** Functions ---------------------------------------------------------------*/
+/*!@brief COBS encode a frame and append the 0x00 delimiter, shared with cli_xfer.c.
+ *
+ * @return Encoded length including the delimiter.
+ */
+unsigned int cli_cobs_encode(const uint8_t *src, unsigned int len, uint8_t *dst)
+{
+    unsigned int code_idx = 0;
+    unsigned int out = 1;
+    uint8_t code = 1;
+
+    for (unsigned int i = 0; i < len; i++)
+    {
+        if (src[i] != 0)
+        {
+            dst[out++] = src[i];
+            code++;
+        }
+
+        if ((src[i] == 0) || (code == 0xFF))
+        {
+            dst[code_idx] = code;
+            code_idx = out++;
+            code = 1;
+        }
+    }
+
+    dst[code_idx] = code;
+    dst[out++] = 0;
+    return out;
+}
+
+/*!@brief COBS decode a frame in place, without the delimiter.
+ *
+ * @return Decoded length, or -1 for a bad frame.
+ */
+int cli_cobs_decode(uint8_t *buf, unsigned int len)
+{
+    unsigned int in = 0;
+    unsigned int out = 0;
+
+    while (in < len)
+    {
+        uint8_t code = buf[in++];
+
+        if ((code == 0) || (in + code - 1 > len))
+        {
+            return -1;
+        }
+
+        for (unsigned int i = 1; i < code; i++)
+        {
+            buf[out++] = buf[in++];
+        }
+
+        // A full block has no implied zero, neither does the last block.
+        if ((code != 0xFF) && (in < len))
+        {
+            buf[out++] = 0;
+        }
+    }
+
+    return out;
+}
+#endif /* CLI_RPC_ENABLE || CLI_XFER_ENABLE */
+
+#if CLI_RPC_ENABLE
+
+/** Private defines ---------------------------------------------------------*/
+#define RPC_VERSION         1
+#define RPC_HEAD_SIZE       3       // Seq & Type
+#define RPC_CRC_SIZE        2
+#define RPC_CMD_HEAD_SIZE   5       // Ret & Flags of RPC_RSP_CMD
+#define RPC_COBS_SIZE(n)    ((n) + (n) / 254 + 2)
+
+#define RPC_REQ_CMD         0x01
+#define RPC_REQ_PING        0x02
+#define RPC_REQ_EXIT        0x03
+#define RPC_RSP_CMD         0x81
+#define RPC_RSP_PING        0x82
+#define RPC_RSP_EXIT        0x83
+#define RPC_RSP_HELLO       0xF0
+#define RPC_RSP_LOG         0xF1
+#define RPC_RSP_ERROR       0xFF
+
+#define RPC_ERR_CRC         1       // CRC mismatch
+#define RPC_ERR_FORMAT      2       // Bad COBS, too short or bad arguments
+#define RPC_ERR_OVERFLOW    3       // Frame larger than CLI_RPC_FRAME_SIZE
+#define RPC_ERR_TYPE        4       // Unknown request type
+#define RPC_ERR_NOMEM       5       // No memory for the command
+
+#define RPC_FLAG_TRUNC      0x01    // Output did not fit in the response
+
+/** Private function prototypes ---------------------------------------------*/
+extern int cli_port_getc(void);
+extern int cli_port_write(int stream, const char *buf, int len);
+
+/** Variables ---------------------------------------------------------------*/
+static uint8_t RpcRxBuf[RPC_COBS_SIZE(CLI_RPC_FRAME_SIZE)];   // Encoded request being received
+static unsigned int RpcRxLen = 0;                           // Bytes in RpcRxBuf
+static unsigned int RpcRxOverflow = 0;                      // Current request is too large
+static uint8_t RpcTxBuf[RPC_COBS_SIZE(CLI_RPC_FRAME_SIZE)]; // Encoded response
+static char RpcOutBuf[CLI_RPC_FRAME_SIZE - RPC_HEAD_SIZE - RPC_CMD_HEAD_SIZE - RPC_CRC_SIZE];
+static CliCapture_TypeDef RpcCapture;                       // Output of the running command
+static CliJob_TypeDef RpcJob = { 0 };                       // Job of the running command
+static unsigned int RpcJobSeq = 0;                          // Seq of the running command
+static unsigned int RpcActive = 0;                          // 1 to start, 2 in binary mode
+static CliOutput_TypeDef *RpcPrevOutput = NULL;             // Output before RPC started
+
+/** Functions ---------------------------------------------------------------*/
+/*!@brief CRC16-CCITT, 4 bit table is a good trade off of size & speed on MCU.
+ */
+static uint16_t rpc_crc16(const uint8_t *buf, unsigned int len)
+{
+    static const uint16_t table[16] = { 0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5,
+                                        0x60C6, 0x70E7, 0x8108, 0x9129, 0xA14A, 0xB16B,
+                                        0xC18C, 0xD1AD, 0xE1CE, 0xF1EF };
+    uint16_t crc = 0xFFFF;
+
+    for (unsigned int i = 0; i < len; i++)
+    {
+        crc = (crc << 4) ^ table[(crc >> 12) ^ (buf[i] >> 4)];
+        crc = (crc << 4) ^ table[(crc >> 12) ^ (buf[i] & 0x0F)];
+    }
+
+    return crc;
+}
+
+/*!@brief Send a response frame.
+ *
+ * @param seq   Sequence ID of the request
+ * @param type  Response type
+ * @param head  First part of the body, may be NULL
+ * @param hlen  Length of head
+ * @param body  Second part of the body, may be NULL
+ * @param blen  Length of body
+ */
+static void rpc_send(unsigned int seq, uint8_t type, const void *head, unsigned int hlen,
+                     const void *body, unsigned int blen)
+{
+    uint8_t frame[CLI_RPC_FRAME_SIZE];
+    unsigned int len = 0;
+
+    if (RPC_HEAD_SIZE + hlen + RPC_CRC_SIZE > sizeof(frame))
+    {
+        hlen = sizeof(frame) - RPC_HEAD_SIZE - RPC_CRC_SIZE;
+    }
+    if (RPC_HEAD_SIZE + hlen + blen + RPC_CRC_SIZE > sizeof(frame))
+    {
+        blen = sizeof(frame) - RPC_HEAD_SIZE - hlen - RPC_CRC_SIZE;
+    }
+
+    frame[len++] = seq & 0xFF;
+    frame[len++] = (seq >> 8) & 0xFF;
+    frame[len++] = type;
+    if (hlen != 0)
+    {
+        memcpy(&frame[len], head, hlen);
+        len += hlen;
+    }
+    if (blen != 0)
+    {
+        memcpy(&frame[len], body, blen);
+        len += blen;
+    }
+
+    uint16_t crc = rpc_crc16(frame, len);
+    frame[len++] = crc & 0xFF;
+    frame[len++] = crc >> 8;
+
+    len = cli_cobs_encode(frame, len, RpcTxBuf);
+    cli_port_write(CLI_STREAM_RAW, (const char *) RpcTxBuf, len);
+}
+
+static void rpc_send_error(unsigned int seq, uint8_t code)
+{
+    rpc_send(seq, RPC_RSP_ERROR, &code, 1, NULL, 0);
+}
+
+/*!@brief Output of text printed outside of a command while RPC is active,
+ *        e.g. by a timer in text mode. It's sent as log frames so it can't
+ *        break the framing. Echo is dropped.
+ */
+static int rpc_log_write(void *arg, int stream, const char *buf, int len)
+{
+    uint8_t s = stream;
+
+    if (stream != CLI_STREAM_ECHO)
+    {
+        rpc_send(0, RPC_RSP_LOG, &s, 1, buf, len);
+    }
+    return len;
+}
+
+static CliOutput_TypeDef RpcLogOutput = { rpc_log_write, NULL };
+
+/*!@brief Send the response of the finished command.
+ */
+static void rpc_finish(int ret)
+{
+    uint8_t head[RPC_CMD_HEAD_SIZE];
+
+    head[0] = ret & 0xFF;
+    head[1] = (ret >> 8) & 0xFF;
+    head[2] = (ret >> 16) & 0xFF;
+    head[3] = (ret >> 24) & 0xFF;
+    head[4] = (RpcCapture.Lost != 0) ? RPC_FLAG_TRUNC : 0;
+
+    rpc_send(RpcJobSeq, RPC_RSP_CMD, head, sizeof(head), RpcCapture.Buf, RpcCapture.Len);
+}
+
+/*!@brief Start a command from pre-tokenized arguments.
+ *
+ * @return CLI_PENDING if the command has yielded.
+ */
+static int rpc_command(unsigned int seq, uint8_t *body, unsigned int len)
+{
+    char *argv[CLI_ARGC_MAX];
+    unsigned int argc = (len > 0) ? body[0] : 0;
+    unsigned int pos = 1;
+
+    if ((argc == 0) || (argc > CLI_ARGC_MAX))
+    {
+        rpc_send_error(seq, RPC_ERR_FORMAT);
+        return CLI_FAIL;
+    }
+
+    // Arguments are used in place, each one must be NUL terminated.
+    for (unsigned int i = 0; i < argc; i++)
+    {
+        uint8_t *end = (pos < len) ? memchr(&body[pos], 0, len - pos) : NULL;
+        if (end == NULL)
+        {
+            rpc_send_error(seq, RPC_ERR_FORMAT);
+            return CLI_FAIL;
+        }
+        argv[i] = (char *) &body[pos];
+        pos = end - body + 1;
+    }
+
+    CliPlan_TypeDef *plan = Cli_PlanCompileArgs(argc, argv);
+    if (plan == NULL)
+    {
+        rpc_send_error(seq, RPC_ERR_NOMEM);
+        return CLI_FAIL;
+    }
+
+    RpcCapture.Len = 0;
+    RpcCapture.Lost = 0;
+    RpcCapture.Esc = 0;
+    RpcJobSeq = seq;
+
+    int ret = Cli_JobStart(&RpcJob, plan, &RpcCapture.Output);
+    if (ret != CLI_PENDING)
+    {
+        rpc_finish(ret);
+    }
+    return ret;
+}
+
+/*!@brief Handle one received frame.
+ *
+ * @return CLI_PENDING if a command has yielded.
+ */
+static int rpc_frame(uint8_t *buf, unsigned int len)
+{
+    int n = cli_cobs_decode(buf, len);
+
+    if ((n < 0) || (n < RPC_HEAD_SIZE + RPC_CRC_SIZE))
+    {
+        // A lone delimiter is used by hosts to resync, don't answer it.
+        if (len != 0)
+        {
+            rpc_send_error(0, RPC_ERR_FORMAT);
+        }
+        return CLI_OK;
+    }
+
+    unsigned int seq = buf[0] | (buf[1] << 8);
+    if (n > CLI_RPC_FRAME_SIZE)
+    {
+        // The receive buffer holds the COBS overhead, a frame may decode larger.
+        rpc_send_error(seq, RPC_ERR_OVERFLOW);
+        return CLI_OK;
+    }
+
+    uint8_t type = buf[2];
+    uint16_t crc = buf[n - 2] | (buf[n - 1] << 8);
+    uint8_t *body = &buf[RPC_HEAD_SIZE];
+    unsigned int blen = n - RPC_HEAD_SIZE - RPC_CRC_SIZE;
+
+    if (rpc_crc16(buf, n - RPC_CRC_SIZE) != crc)
+    {
+        rpc_send_error(seq, RPC_ERR_CRC);
+        return CLI_OK;
+    }
+
+    switch (type)
+    {
+    case RPC_REQ_CMD:
+        return rpc_command(seq, body, blen);
+    case RPC_REQ_PING:
+        rpc_send(seq, RPC_RSP_PING, body, blen, NULL, 0);
+        break;
+    case RPC_REQ_EXIT:
+        rpc_send(seq, RPC_RSP_EXIT, NULL, 0, NULL, 0);
+        RpcActive = 0;
+        Cli_SetOutput(RpcPrevOutput);
+#if CLI_RX_ENABLE
+        cli_rx_raw(0);
+#endif
+        break;
+    default:
+        rpc_send_error(seq, RPC_ERR_TYPE);
+        break;
+    }
+
+    return CLI_OK;
+}
+
+/*!@brief Serve RPC requests from the port, called from Cli_Run.
+ *
+ * @return 1 if the port is in binary mode and text input must not be read.
+ */
+int cli_rpc_poll(void)
+{
+    if (RpcActive == 0)
+    {
+        return 0;
+    }
+
+    if (RpcActive == 1)
+    {
+        uint8_t hello[3] = { RPC_VERSION, CLI_RPC_FRAME_SIZE & 0xFF, CLI_RPC_FRAME_SIZE >> 8 };
+
+        Cli_CaptureInit(&RpcCapture, RpcOutBuf, sizeof(RpcOutBuf));
+        RpcRxLen = 0;
+        RpcRxOverflow = 0;
+        RpcActive = 2;
+
+        // Text from now on would break the framing, send it as log frames.
+        // A lone delimiter ends the text before, so a host can sync on it.
+        RpcPrevOutput = Cli_SetOutput(&RpcLogOutput);
+#if CLI_RX_ENABLE
+        cli_rx_raw(1);
+#endif
+        cli_port_write(CLI_STREAM_RAW, "", 1);
+        rpc_send(0, RPC_RSP_HELLO, hello, sizeof(hello), NULL, 0);
+    }
+
+    // Resume the command that has yielded, requests wait until it's done.
+    if (RpcJob.Plan != NULL)
+    {
+        int ret = Cli_JobStep(&RpcJob);
+        if (ret == CLI_PENDING)
+        {
+            return 1;
+        }
+        rpc_finish(ret);
+    }
+
+    for (int frames = 0; (frames < CLI_RUN_LINES) && RpcActive;)
+    {
+        int c = cli_port_getc();
+
+        if (c < 0)
+        {
+            break;
+        }
+
+        if (c != 0)
+        {
+            if (RpcRxLen < sizeof(RpcRxBuf))
+            {
+                RpcRxBuf[RpcRxLen++] = c;
+            }
+            else
+            {
+                RpcRxOverflow = 1;
+            }
+            continue;
+        }
+
+        // Delimiter, a frame is complete.
+        unsigned int len = RpcRxLen;
+        RpcRxLen = 0;
+        frames++;
+        if (RpcRxOverflow)
+        {
+            RpcRxOverflow = 0;
+            rpc_send_error(0, RPC_ERR_OVERFLOW);
+            continue;
+        }
+
+        if (rpc_frame(RpcRxBuf, len) == CLI_PENDING)
+        {
+            break;
+        }
+    }
+
+    return 1;
+}
+
+/*!@brief Built-in command of "rpc", switch the console port to binary frames.
+ *
+ */
+int builtin_rpc(int argc, char **args)
+{
+    // Frames go on the console port, a session can't switch it.
+    if (RpcActive || (Cli_SessionSelf() != NULL))
+    {
+        return CLI_FAIL;
+    }
+
+    // Binary mode starts from next poll, after this command line is finished.
+    RpcActive = 1;
+    return 0;
+}
+
+#endif /* CLI_RPC_ENABLE */
@@ -0,0 +1,195 @@
+/******************************************************************************
+ * @file    cli_rx.c
+ * @brief   Input ring of the Command Line Interface (CLI).
+ *          A lock-free single producer, single consumer byte ring between the
+ *          receiver of the port (a UART interrupt or DMA callback) and the CLI
+ *          task. The producer only writes RxHead and the counters, the consumer
+ *          only writes RxTail, so no lock or interrupt masking is needed.
+ *
+ *          void USART1_IRQHandler(void)
+ *          {
+ *              cli_port_isr_putc(USART1->DR);
+ *          }
+ *
+ *          int cli_port_getc(void)
+ *          {
+ *              return cli_rx_getc();
+ *          }
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cli.h"
+
+#if CLI_RX_ENABLE
+
+/** Private defines ---------------------------------------------------------*/
+#define RX_MASK             (CLI_RX_BUF_SIZE - 1)
+#define RX_XON              '\x11'
+#define RX_XOFF             '\x13'
+
+#if (CLI_RX_BUF_SIZE & RX_MASK) != 0
+#error "CLI_RX_BUF_SIZE must be a power of 2"
+#endif
+
+/** Variables ---------------------------------------------------------------*/
+static uint8_t RxBuf[CLI_RX_BUF_SIZE];      // Ring storage
+static unsigned int RxHead = 0;             // Bytes written, by the producer only
+static unsigned int RxTail = 0;             // Bytes read, by the consumer only
+static unsigned int RxTotal = 0;            // Bytes received, by the producer only
+static unsigned int RxOverflow = 0;         // Bytes dropped on a full ring, by the producer only
+static unsigned int RxPeak = 0;             // Maximum bytes waiting, by the producer only
+static volatile unsigned int RxRaw = 0;     // XOFF/XON are data of a binary protocol
+
+/** Functions ---------------------------------------------------------------*/
+/*!@brief Put a received byte to the ring, safe to call from an interrupt.
+ *
+ * @param c     Received byte
+ * @return      0, or -1 if the ring is full and the byte is dropped.
+ */
+int cli_port_isr_putc(char c)
+{
+#if CLI_TX_ENABLE && CLI_TX_XONXOFF
+    // Flow control of the output, not input.
+    if (!RxRaw && ((c == RX_XOFF) || (c == RX_XON)))
+    {
+        cli_tx_hold(c == RX_XOFF);
+        return 0;
+    }
+#endif
+
+    unsigned int head = RxHead;
+    unsigned int used = head - __atomic_load_n(&RxTail, __ATOMIC_ACQUIRE);
+
+    RxTotal++;
+    if (used >= CLI_RX_BUF_SIZE)
+    {
+        RxOverflow++;
+        return -1;
+    }
+
+    RxBuf[head & RX_MASK] = c;
+    __atomic_store_n(&RxHead, head + 1, __ATOMIC_RELEASE);
+
+    if (used + 1 > RxPeak)
+    {
+        RxPeak = used + 1;
+    }
+    return 0;
+}
+
+/*!@brief Put a block of received bytes to the ring, e.g. from a DMA half or
+ *        full transfer callback. The block is published at once, bytes that
+ *        don't fit are dropped.
+ *
+ * @param buf   Received bytes
+ * @param len   Number of bytes
+ * @return      Number of bytes put to the ring.
+ */
+int cli_port_isr_write(const char *buf, int len)
+{
+#if CLI_TX_ENABLE && CLI_TX_XONXOFF
+    if (!RxRaw && ((memchr(buf, RX_XOFF, len) != NULL) || (memchr(buf, RX_XON, len) != NULL)))
+    {
+        int num = 0;
+        for (int i = 0; i < len; i++)
+        {
+            num += (cli_port_isr_putc(buf[i]) == 0);
+        }
+        return num;
+    }
+#endif
+
+    unsigned int head = RxHead;
+    unsigned int used = head - __atomic_load_n(&RxTail, __ATOMIC_ACQUIRE);
+    unsigned int num = CLI_RX_BUF_SIZE - used;
+
+    RxTotal += len;
+    if (num > (unsigned int) len)
+    {
+        num = len;
+    }
+    RxOverflow += len - num;
+
+    // Copy in up to two pieces when the block wraps.
+    unsigned int pos = head & RX_MASK;
+    unsigned int first = (num < CLI_RX_BUF_SIZE - pos) ? num : CLI_RX_BUF_SIZE - pos;
+    memcpy(&RxBuf[pos], buf, first);
+    memcpy(&RxBuf[0], buf + first, num - first);
+    __atomic_store_n(&RxHead, head + num, __ATOMIC_RELEASE);
+
+    if (used + num > RxPeak)
+    {
+        RxPeak = used + num;
+    }
+    return num;
+}
+
+/*!@brief Get a byte from the ring, called by the CLI task.
+ *
+ * @return The byte, or EOF when the ring is empty.
+ */
+int cli_rx_getc(void)
+{
+    unsigned int tail = RxTail;
+
+    if (tail == __atomic_load_n(&RxHead, __ATOMIC_ACQUIRE))
+    {
+        return EOF;
+    }
+
+    uint8_t c = RxBuf[tail & RX_MASK];
+    __atomic_store_n(&RxTail, tail + 1, __ATOMIC_RELEASE);
+    return c;
+}
+
+/*!@brief Pass XOFF/XON to the CLI as data, while the port carries binary
+ *        frames of "rpc" or "xfer".
+ *
+ * @param raw   1 for binary frames, 0 for text with flow control
+ */
+void cli_rx_raw(int raw)
+{
+    RxRaw = raw;
+#if CLI_TX_ENABLE
+    cli_tx_hold(0);
+#endif
+}
+
+/*!@brief Number of bytes the ring can take now, called by the CLI task.
+ */
+unsigned int cli_rx_room(void)
+{
+    return CLI_RX_BUF_SIZE - (__atomic_load_n(&RxHead, __ATOMIC_ACQUIRE) - RxTail);
+}
+
+/*!@brief Number of bytes the producer has dropped so far.
+ */
+unsigned int cli_rx_overflow(void)
+{
+    return RxOverflow;
+}
+
+#if CLI_BUILTIN_ENABLE
+/*!@brief Built-in command of "rx", show the input ring.
+ *
+ */
+int builtin_rx(int argc, char **args)
+{
+    unsigned int head = __atomic_load_n(&RxHead, __ATOMIC_ACQUIRE);
+
+    CLI_PRINT("Size     = %u\n", (unsigned int) CLI_RX_BUF_SIZE);
+    CLI_PRINT("Waiting  = %u\n", head - RxTail);
+    CLI_PRINT("Peak     = %u\n", RxPeak);
+    CLI_PRINT("Received = %u\n", RxTotal);
+    CLI_PRINT("Overflow = %u\n", RxOverflow);
+    return 0;
+}
+#endif /* CLI_BUILTIN_ENABLE */
+
+#endif /* CLI_RX_ENABLE */
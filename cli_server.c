@@ -0,0 +1,698 @@
+/******************************************************************************
+ * @file    cli_server.c
+ * @brief   Socket server of the Command Line Interface (CLI).
+ *          Every connection to a listening Unix or local TCP socket is a
+ *          console session with its own line editor, history & command line
+ *          job, see Cli_SessionNew(). All sockets are served from one epoll
+ *          instance polled by Cli_Run, with no thread per client: input is
+ *          read into a small buffer per session, output goes to a buffer per
+ *          session that's written as the socket takes it. Only the sessions
+ *          with input, output or a command line to resume are visited, an
+ *          idle one costs its memory & a file descriptor.
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cli.h"
+
+#if CLI_SERVER_ENABLE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/** Private defines ---------------------------------------------------------*/
+#define SERVER_EVENTS       256     // Maximum events handled by one poll
+#define SERVER_IN_SIZE      512     // Input buffer of a session
+#define SERVER_OUT_MIN      1024    // First output buffer of a session
+#define SERVER_OUT_HIGH     (CLI_SERVER_OUT_MAX / 2) // Session waits for its output above it
+#define SERVER_BACKLOG      1024    // Connections waiting to be accepted
+#define SERVER_LISTENER     0x80000000u // Event tag of a listening socket
+
+/** Private types -----------------------------------------------------------*/
+/*!@typedef ServerListen_TypeDef
+ *          A listening socket.
+ */
+typedef struct
+{
+    int Fd;                             //!< Socket, -1 when not used
+    char Addr[108];                     //!< Address as given, e.g. "unix:/tmp/cli"
+} ServerListen_TypeDef;
+
+/*!@typedef ServerConn_TypeDef
+ *          A connection & its console session.
+ */
+typedef struct ServerConn
+{
+    int Fd;                             //!< Socket
+    unsigned int Id;                    //!< Session ID, counts up from 1
+    unsigned int Slot;                  //!< Index in ServerConn
+    CliSession_TypeDef *Session;        //!< Console session of the connection
+    CliOutput_TypeDef Output;           //!< Output of the session to Out
+    char In[SERVER_IN_SIZE];            //!< Input not taken by the session yet
+    unsigned int InLen;                 //!< Bytes in In
+    unsigned int InIdx;                 //!< Bytes of In taken
+    char *Out;                          //!< Output not sent yet, NULL when empty
+    unsigned int OutSize;               //!< Size of Out, grows up to CLI_SERVER_OUT_MAX
+    unsigned int OutLen;                //!< Bytes in Out
+    unsigned int OutIdx;                //!< Bytes of Out sent
+    unsigned int Dropped;               //!< Output bytes dropped as Out was full
+    unsigned int Events;                //!< Events the socket is watched for
+    unsigned int Pending;               //!< Command line has yielded
+    unsigned int Eof;                   //!< Peer has shut down its side
+    unsigned int Ready;                 //!< In the ready list
+    struct ServerConn *Next;            //!< Next in the ready list
+} ServerConn_TypeDef;
+
+/** Private function prototypes ---------------------------------------------*/
+extern void cli_sleep(int ms);
+extern void * cli_malloc(size_t size);
+extern void cli_free(void *ptr);
+
+/** Variables ---------------------------------------------------------------*/
+static int ServerEpoll = -1;                // Epoll instance, -1 when closed
+static ServerListen_TypeDef ServerListen[CLI_SERVER_LISTEN_NUM]; // Listening sockets
+static ServerConn_TypeDef *ServerConn[CLI_SERVER_SESSION_NUM]; // Connections by slot
+static ServerConn_TypeDef *ServerReady = NULL; // Sessions to run on next poll
+static unsigned int ServerNum = 0;          // Number of connections
+static unsigned int ServerPeak = 0;         // Most connections at once
+static unsigned int ServerId = 0;           // ID of the last session
+static unsigned int ServerAccepted = 0;     // Connections accepted
+static unsigned int ServerRefused = 0;      // Connections closed as the table was full
+static unsigned int ServerDropped = 0;      // Output bytes dropped of closed sessions
+static unsigned int ServerCloseReq = 0;     // Close when the running session is done
+
+/** Functions ---------------------------------------------------------------*/
+/*!@brief Input of a session, the bytes read from its socket.
+ */
+static int conn_getc(void *arg)
+{
+    ServerConn_TypeDef *c = arg;
+
+    if (c->InIdx >= c->InLen)
+    {
+        c->InIdx = 0;
+        c->InLen = 0;
+        return EOF;
+    }
+    return (unsigned char) c->In[c->InIdx++];
+}
+
+/*!@brief Output of a session, kept until the socket takes it. Out grows by
+ *        doubling up to CLI_SERVER_OUT_MAX, output beyond is dropped & counted.
+ */
+static int conn_write(void *arg, int stream, const char *buf, int len)
+{
+    ServerConn_TypeDef *c = arg;
+
+    if (c->OutIdx == c->OutLen)
+    {
+        c->OutIdx = 0;
+        c->OutLen = 0;
+    }
+    if ((c->OutLen + len > c->OutSize) && (c->OutSize < CLI_SERVER_OUT_MAX))
+    {
+        unsigned int size = (c->OutSize == 0) ? SERVER_OUT_MIN : c->OutSize;
+        while ((size < c->OutLen + len) && (size < CLI_SERVER_OUT_MAX))
+        {
+            size *= 2;
+        }
+        size = (size > CLI_SERVER_OUT_MAX) ? CLI_SERVER_OUT_MAX : size;
+        char *out = cli_malloc(size);
+        if (out != NULL)
+        {
+            memcpy(out, c->Out + c->OutIdx, c->OutLen - c->OutIdx);
+            cli_free(c->Out);
+            c->Out = out;
+            c->OutSize = size;
+            c->OutLen -= c->OutIdx;
+            c->OutIdx = 0;
+        }
+    }
+    if ((c->OutLen + len > c->OutSize) && (c->OutIdx > 0))
+    {
+        memmove(c->Out, c->Out + c->OutIdx, c->OutLen - c->OutIdx);
+        c->OutLen -= c->OutIdx;
+        c->OutIdx = 0;
+    }
+
+    int n = (c->OutLen + len > c->OutSize) ? c->OutSize - c->OutLen : len;
+    if (n > 0)
+    {
+        memcpy(c->Out + c->OutLen, buf, n);
+        c->OutLen += n;
+    }
+    c->Dropped += len - n;
+    return len;
+}
+
+/*!@brief Watch the socket for input while the session may take it, and for
+ *        room while it has output to send.
+ */
+static void conn_watch(ServerConn_TypeDef *c)
+{
+    unsigned int events = 0;
+
+    if (!c->Eof && (c->InLen < sizeof(c->In)) && (c->OutLen - c->OutIdx < SERVER_OUT_HIGH))
+    {
+        events |= EPOLLIN;
+    }
+    if (c->OutIdx < c->OutLen)
+    {
+        events |= EPOLLOUT;
+    }
+    if (events != c->Events)
+    {
+        struct epoll_event ev = { .events = events, .data.u32 = c->Slot };
+        epoll_ctl(ServerEpoll, EPOLL_CTL_MOD, c->Fd, &ev);
+        c->Events = events;
+    }
+}
+
+/*!@brief Put a session in the list to run on this or next poll.
+ */
+static void conn_ready(ServerConn_TypeDef *c)
+{
+    if (!c->Ready)
+    {
+        c->Ready = 1;
+        c->Next = ServerReady;
+        ServerReady = c;
+    }
+}
+
+/*!@brief Send what the socket takes of the output, the buffer is released
+ *        once it's all sent so an idle session doesn't keep it.
+ *
+ * @return 0, or -1 when the connection is broken.
+ */
+static int conn_flush(ServerConn_TypeDef *c)
+{
+    while (c->OutIdx < c->OutLen)
+    {
+        ssize_t n = send(c->Fd, c->Out + c->OutIdx, c->OutLen - c->OutIdx, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? 0 : -1;
+        }
+        c->OutIdx += n;
+    }
+
+    cli_free(c->Out);
+    c->Out = NULL;
+    c->OutSize = 0;
+    c->OutLen = 0;
+    c->OutIdx = 0;
+    return 0;
+}
+
+static void conn_close(ServerConn_TypeDef *c)
+{
+    // A command line still running writes to Out while it's cancelled.
+    Cli_SessionFree(c->Session);
+    epoll_ctl(ServerEpoll, EPOLL_CTL_DEL, c->Fd, NULL);
+    close(c->Fd);
+
+    if (c->Ready)
+    {
+        ServerConn_TypeDef **p = &ServerReady;
+        while (*p != c)
+        {
+            p = &(*p)->Next;
+        }
+        *p = c->Next;
+    }
+    ServerConn[c->Slot] = NULL;
+    ServerNum--;
+    ServerDropped += c->Dropped;
+    cli_free(c->Out);
+    cli_free(c);
+}
+
+/*!@brief Start a session on an accepted socket, and greet it with a prompt.
+ */
+static void conn_open(int fd)
+{
+    ServerConn_TypeDef *c = NULL;
+    unsigned int slot = 0;
+
+    while ((slot < CLI_SERVER_SESSION_NUM) && (ServerConn[slot] != NULL))
+    {
+        slot++;
+    }
+    if (slot < CLI_SERVER_SESSION_NUM)
+    {
+        c = cli_malloc(sizeof(ServerConn_TypeDef));
+    }
+    if (c != NULL)
+    {
+        memset(c, 0, sizeof(ServerConn_TypeDef));
+        c->Output.Write = conn_write;
+        c->Output.Arg = c;
+        c->Session = Cli_SessionNew(conn_getc, c, &c->Output);
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = slot };
+    if ((c == NULL) || (c->Session == NULL) || (epoll_ctl(ServerEpoll, EPOLL_CTL_ADD, fd, &ev) != 0))
+    {
+        if (c != NULL)
+        {
+            Cli_SessionFree(c->Session);
+            cli_free(c);
+        }
+        close(fd);
+        ServerRefused++;
+        return;
+    }
+
+    c->Fd = fd;
+    c->Id = ++ServerId;
+    c->Slot = slot;
+    c->Events = EPOLLIN;
+    ServerConn[slot] = c;
+    ServerNum++;
+    ServerAccepted++;
+    ServerPeak = (ServerNum > ServerPeak) ? ServerNum : ServerPeak;
+
+    CliOutput_TypeDef *output = Cli_SetOutput(&c->Output);
+    CLI_ECHO("CLI session %u\n%s", c->Id, CLI_PROMPT_CHAR);
+    Cli_SetOutput(output);
+    conn_flush(c);
+    conn_watch(c);
+}
+
+/*!@brief Accept the connections waiting on a listening socket.
+ */
+static void server_accept(ServerListen_TypeDef *l)
+{
+    for (;;)
+    {
+        int fd = accept4(l->Fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            // EMFILE & the like leave the connection waiting, it's tried next poll.
+            return;
+        }
+        if (strncmp(l->Addr, "tcp:", 4) == 0)
+        {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        conn_open(fd);
+    }
+}
+
+/*!@brief Read what the socket has for the input of a session.
+ */
+static void conn_read(ServerConn_TypeDef *c)
+{
+    if (c->InIdx == c->InLen)
+    {
+        c->InIdx = 0;
+        c->InLen = 0;
+    }
+    while (!c->Eof && (c->InLen < sizeof(c->In)))
+    {
+        ssize_t n = recv(c->Fd, c->In + c->InLen, sizeof(c->In) - c->InLen, 0);
+        if (n > 0)
+        {
+            c->InLen += n;
+            continue;
+        }
+        if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)))
+        {
+            break;
+        }
+        c->Eof = 1;
+    }
+}
+
+/*!@brief Open the epoll instance & allow a file descriptor per session.
+ */
+static int server_init(void)
+{
+    if (ServerEpoll >= 0)
+    {
+        return CLI_OK;
+    }
+
+    ServerEpoll = epoll_create1(EPOLL_CLOEXEC);
+    if (ServerEpoll < 0)
+    {
+        return CLI_FAIL;
+    }
+    for (int i = 0; i < CLI_SERVER_LISTEN_NUM; i++)
+    {
+        ServerListen[i].Fd = -1;
+    }
+
+    struct rlimit rl;
+    if ((getrlimit(RLIMIT_NOFILE, &rl) == 0) && (rl.rlim_cur < CLI_SERVER_SESSION_NUM + 64))
+    {
+        rl.rlim_cur = (rl.rlim_max < CLI_SERVER_SESSION_NUM + 64) ? rl.rlim_max
+                                                                   : CLI_SERVER_SESSION_NUM + 64;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    return CLI_OK;
+}
+
+/*!@brief Make a listening socket for an address.
+ *
+ * @param addr  "unix:<path>" or "tcp:[host:]port", host defaults to 127.0.0.1
+ * @return      The socket or -1.
+ */
+static int server_listen(const char *addr)
+{
+    int fd = -1;
+
+    if (strncmp(addr, "unix:", 5) == 0)
+    {
+        struct sockaddr_un sa = { .sun_family = AF_UNIX };
+        if ((addr[5] == 0) || (strlen(addr + 5) >= sizeof(sa.sun_path)))
+        {
+            return -1;
+        }
+        strcpy(sa.sun_path, addr + 5);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        // A socket file left by a previous run would fail the bind.
+        unlink(sa.sun_path);
+        if ((fd >= 0) && (bind(fd, (struct sockaddr *) &sa, sizeof(sa)) != 0))
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    else if (strncmp(addr, "tcp:", 4) == 0)
+    {
+        struct sockaddr_in sa = { .sin_family = AF_INET };
+        char host[64] = "127.0.0.1";
+        const char *port = strrchr(addr + 4, ':');
+        if (port != NULL)
+        {
+            snprintf(host, sizeof(host), "%.*s", (int) (port - addr - 4), addr + 4);
+            port++;
+        }
+        else
+        {
+            port = addr + 4;
+        }
+        char *end = NULL;
+        unsigned long num = strtoul(port, &end, 10);
+        if ((*port == 0) || (*end != 0) || (num > 65535) || (inet_pton(AF_INET, host, &sa.sin_addr) != 1))
+        {
+            return -1;
+        }
+        sa.sin_port = htons(num);
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        if ((fd >= 0) && ((setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0)
+                          || (bind(fd, (struct sockaddr *) &sa, sizeof(sa)) != 0)))
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    if ((fd >= 0) && (listen(fd, SERVER_BACKLOG) != 0))
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/*!@brief Start serving console sessions on a socket, more sockets may be
+ *        opened up to CLI_SERVER_LISTEN_NUM.
+ *
+ * @param addr  "unix:<path>" or "tcp:[host:]port", host defaults to 127.0.0.1
+ * @return      CLI_OK or CLI_FAIL.
+ */
+int Cli_ServerOpen(const char *addr)
+{
+    if ((addr == NULL) || (server_init() != CLI_OK))
+    {
+        return CLI_FAIL;
+    }
+
+    ServerListen_TypeDef *l = NULL;
+    for (int i = 0; i < CLI_SERVER_LISTEN_NUM; i++)
+    {
+        if (ServerListen[i].Fd < 0)
+        {
+            l = &ServerListen[i];
+            break;
+        }
+    }
+    if ((l == NULL) || (strlen(addr) >= sizeof(l->Addr)))
+    {
+        CLI_ERROR("ERROR: can not listen on [%s]\n", addr);
+        return CLI_FAIL;
+    }
+
+    int fd = server_listen(addr);
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = SERVER_LISTENER | (l - ServerListen) };
+    if ((fd < 0) || (epoll_ctl(ServerEpoll, EPOLL_CTL_ADD, fd, &ev) != 0))
+    {
+        CLI_ERROR("ERROR: can not listen on [%s]\n", addr);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return CLI_FAIL;
+    }
+    l->Fd = fd;
+    strcpy(l->Addr, addr);
+
+    return CLI_OK;
+}
+
+static void server_close(void)
+{
+    for (int i = 0; i < CLI_SERVER_SESSION_NUM; i++)
+    {
+        if (ServerConn[i] != NULL)
+        {
+            conn_flush(ServerConn[i]);
+            conn_close(ServerConn[i]);
+        }
+    }
+    for (int i = 0; i < CLI_SERVER_LISTEN_NUM; i++)
+    {
+        if (ServerListen[i].Fd >= 0)
+        {
+            close(ServerListen[i].Fd);
+            if (strncmp(ServerListen[i].Addr, "unix:", 5) == 0)
+            {
+                unlink(ServerListen[i].Addr + 5);
+            }
+            ServerListen[i].Fd = -1;
+        }
+    }
+    close(ServerEpoll);
+    ServerEpoll = -1;
+    ServerCloseReq = 0;
+}
+
+/*!@brief Stop listening and close all sessions. When called by a session,
+ *        it's done after the session's command line.
+ *
+ * @return CLI_OK or CLI_FAIL if it's not open.
+ */
+int Cli_ServerClose(void)
+{
+    if (ServerEpoll < 0)
+    {
+        return CLI_FAIL;
+    }
+
+    if (Cli_SessionSelf() != NULL)
+    {
+        ServerCloseReq = 1;
+        return CLI_OK;
+    }
+
+    server_close();
+    return CLI_OK;
+}
+
+/*!@brief Idle wait of the main loop. Returns as soon as a socket has an event,
+ *        and doesn't wait while a session has a command line to resume.
+ *
+ * @param ms    Maximum time to wait in ms
+ */
+void Cli_ServerWait(int ms)
+{
+    struct epoll_event ev;
+
+    if ((ServerEpoll < 0) || (ServerReady != NULL))
+    {
+        cli_sleep(ms);
+        return;
+    }
+
+    // Level triggered, the event is still there for cli_server_poll.
+    epoll_wait(ServerEpoll, &ev, 1, ms);
+}
+
+/*!@brief Serve the sockets, called from Cli_Run. Events mark the sessions to
+ *        run, then each of them runs the lines it has or resumes its command
+ *        line once, so a busy session doesn't hold up the others.
+ */
+void cli_server_poll(void)
+{
+    static struct epoll_event ev[SERVER_EVENTS];
+
+    if (ServerEpoll < 0)
+    {
+        return;
+    }
+
+    int num = epoll_wait(ServerEpoll, ev, SERVER_EVENTS, 0);
+    for (int i = 0; i < num; i++)
+    {
+        unsigned int tag = ev[i].data.u32;
+        if (tag & SERVER_LISTENER)
+        {
+            server_accept(&ServerListen[tag & ~SERVER_LISTENER]);
+            continue;
+        }
+
+        ServerConn_TypeDef *c = ServerConn[tag];
+        if (c == NULL)
+        {
+            continue;
+        }
+        if ((ev[i].events & EPOLLOUT) && (conn_flush(c) != 0))
+        {
+            conn_close(c);
+            continue;
+        }
+        if (ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        {
+            conn_read(c);
+        }
+        conn_ready(c);
+    }
+
+    // Sessions made ready while these run wait for next poll.
+    ServerConn_TypeDef *list = ServerReady;
+    ServerReady = NULL;
+    while (list != NULL)
+    {
+        ServerConn_TypeDef *c = list;
+        list = c->Next;
+        c->Ready = 0;
+
+        // A session waits while its output is high, the socket drains it.
+        if (c->OutLen - c->OutIdx < SERVER_OUT_HIGH)
+        {
+            c->Pending = (Cli_SessionRun(c->Session) == CLI_PENDING);
+        }
+        if (conn_flush(c) != 0)
+        {
+            conn_close(c);
+            continue;
+        }
+        if (c->Eof && !c->Pending && (c->InIdx == c->InLen) && (c->OutIdx == c->OutLen))
+        {
+            conn_close(c);
+            continue;
+        }
+        if ((c->Pending || (c->InIdx < c->InLen)) && (c->OutLen - c->OutIdx < SERVER_OUT_HIGH))
+        {
+            conn_ready(c);
+        }
+        conn_watch(c);
+    }
+
+    if (ServerCloseReq)
+    {
+        server_close();
+    }
+}
+
+/*!@brief Close the sockets & sessions, called from Cli_Deinit.
+ */
+void cli_server_deinit(void)
+{
+    if (ServerEpoll >= 0)
+    {
+        server_close();
+    }
+}
+
+/*!@brief Built-in command of "server", show the sockets & sessions.
+ *
+ */
+int builtin_server(int argc, char **args)
+{
+    if (ServerEpoll < 0)
+    {
+        CLI_PRINT("Server is closed, try [server open <addr>]\n");
+        return 0;
+    }
+
+    for (int i = 0; i < CLI_SERVER_LISTEN_NUM; i++)
+    {
+        if (ServerListen[i].Fd >= 0)
+        {
+            CLI_PRINT("Listen   = %s\n", ServerListen[i].Addr);
+        }
+    }
+    CLI_PRINT("Session  = %u, peak %u\n", ServerNum, ServerPeak);
+    CLI_PRINT("Accepted = %u, %u refused\n", ServerAccepted, ServerRefused);
+
+    unsigned int dropped = ServerDropped;
+    CLI_PRINT("   ID  Fd    In   Out  Dropped State\n");
+    for (int i = 0; i < CLI_SERVER_SESSION_NUM; i++)
+    {
+        ServerConn_TypeDef *c = ServerConn[i];
+        if (c == NULL)
+        {
+            continue;
+        }
+        dropped += c->Dropped;
+        CLI_PRINT("%5u %3d %5u %5u %8u %s%s\n", c->Id, c->Fd, c->InLen - c->InIdx,
+                  c->OutLen - c->OutIdx, c->Dropped, c->Pending ? "running" : "idle",
+                  (c->Session == Cli_SessionSelf()) ? " *" : "");
+    }
+    CLI_PRINT("Dropped  = %u bytes of output\n", dropped);
+    return 0;
+}
+
+/*!@brief Built-in command of "server open", listen on a socket.
+ *
+ */
+int builtin_server_open(int argc, char **args)
+{
+    if (argc < 2)
+    {
+        CLI_PRINT("usage: %s unix:<path> | tcp:[host:]port\n", args[0]);
+        return CLI_FAIL;
+    }
+    return Cli_ServerOpen(args[1]);
+}
+
+/*!@brief Built-in command of "server close", stop listening & close sessions.
+ *
+ */
+int builtin_server_close(int argc, char **args)
+{
+    return Cli_ServerClose();
+}
+
+#endif /* CLI_SERVER_ENABLE */
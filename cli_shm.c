@@ -0,0 +1,278 @@
+/******************************************************************************
+ * @file    cli_shm.c
+ * @brief   Shared memory channel of the Command Line Interface (CLI).
+ *          A local client writes command strings to the request ring of a
+ *          POSIX shared memory segment, and reads the return value & output
+ *          of each command from the response ring. Commands go through the
+ *          plan cache to the dispatcher, with no echo, prompt or terminal IO.
+ *          Layout of the segment is in cli_shm.h.
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cli.h"
+
+#if CLI_SHM_ENABLE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cli_shm.h"
+
+/** Private defines ---------------------------------------------------------*/
+#define SHM_BATCH           256     // Maximum requests served by one poll
+
+/** Private function prototypes ---------------------------------------------*/
+extern void cli_sleep(int ms);
+
+/** Variables ---------------------------------------------------------------*/
+static CliShm_TypeDef *Shm = NULL;          // Mapped segment, NULL when closed
+static char ShmName[64];                    // Name of the segment
+static unsigned int ShmCloseReq = 0;        // Close when the running request is done
+static CliJob_TypeDef ShmJob = { 0 };       // Job of the running request
+static CliCapture_TypeDef ShmCapture;       // Output of the running request
+static char ShmOut[CLI_SHM_MSG_MAX];        // Capture buffer
+static CliShmMsg_TypeDef ShmRsp;            // Header of the response being sent
+static unsigned int ShmRspPending = 0;      // Response waits for room in the ring
+static unsigned int ShmServed = 0;          // Number of requests served
+static unsigned int ShmFull = 0;            // Times the response ring was full
+
+/** Functions ---------------------------------------------------------------*/
+/*!@brief Open the segment and start serving requests.
+ *
+ * @param name  Name of the segment, e.g. "/cli"
+ * @return      CLI_OK or CLI_FAIL.
+ */
+int Cli_ShmOpen(const char *name)
+{
+    if (Shm != NULL)
+    {
+        return CLI_FAIL;
+    }
+
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        CLI_ERROR("ERROR: can not open shared memory [%s]\n", name);
+        return CLI_FAIL;
+    }
+
+    void *ptr = MAP_FAILED;
+    if (ftruncate(fd, sizeof(CliShm_TypeDef)) == 0)
+    {
+        ptr = mmap(NULL, sizeof(CliShm_TypeDef), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (ptr == MAP_FAILED)
+    {
+        CLI_ERROR("ERROR: can not map shared memory [%s]\n", name);
+        shm_unlink(name);
+        return CLI_FAIL;
+    }
+
+    Shm = ptr;
+    memset(Shm, 0, sizeof(CliShm_TypeDef));
+    snprintf(ShmName, sizeof(ShmName), "%s", name);
+    Cli_CaptureInit(&ShmCapture, ShmOut, sizeof(ShmOut));
+    ShmRspPending = 0;
+    ShmCloseReq = 0;
+    __atomic_store_n(&Shm->Magic, CLI_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return CLI_OK;
+}
+
+static void shm_close(void)
+{
+    __atomic_store_n(&Shm->Magic, 0, __ATOMIC_RELEASE);
+    munmap(Shm, sizeof(CliShm_TypeDef));
+    shm_unlink(ShmName);
+    Shm = NULL;
+    ShmCloseReq = 0;
+}
+
+/*!@brief Stop serving and remove the segment. When called by a request, the
+ *        segment is closed after its response is sent.
+ *
+ * @return CLI_OK or CLI_FAIL if it's not open.
+ */
+int Cli_ShmClose(void)
+{
+    if (Shm == NULL)
+    {
+        return CLI_FAIL;
+    }
+
+    if (ShmJob.Plan != NULL)
+    {
+        ShmCloseReq = 1;
+        return CLI_OK;
+    }
+
+    shm_close();
+    return CLI_OK;
+}
+
+/*!@brief Idle wait of the main loop. Returns as soon as a request comes in,
+ *        so requests are served with low latency.
+ *
+ * @param ms    Maximum time to wait in ms
+ */
+void Cli_ShmWait(int ms)
+{
+    if ((Shm == NULL) || (ShmJob.Plan != NULL) || ShmRspPending)
+    {
+        cli_sleep(ms);
+        return;
+    }
+
+    cli_shm_wait(&Shm->Req, ms);
+}
+
+/*!@brief Send the response of the finished request.
+ *
+ * @return 0, or -1 if the response ring is full and it has to be sent later.
+ */
+static int shm_respond(void)
+{
+    if (cli_shm_put(&Shm->Rsp, &ShmRsp, ShmOut, ShmCapture.Len) != 0)
+    {
+        ShmFull++;
+        return -1;
+    }
+
+    ShmRspPending = 0;
+    ShmServed++;
+    return 0;
+}
+
+static int shm_finish(int ret)
+{
+    ShmRsp.Ret = ret;
+    ShmRsp.Flags = (ShmCapture.Lost != 0) ? CLI_SHM_FLAG_TRUNC : 0;
+    ShmRspPending = 1;
+
+    return shm_respond();
+}
+
+/*!@brief Serve requests, called from Cli_Run.
+ */
+void cli_shm_poll(void)
+{
+    if (Shm == NULL)
+    {
+        return;
+    }
+
+    // Resume the request that has yielded, the next ones wait until it's done.
+    if (ShmJob.Plan != NULL)
+    {
+        int ret = Cli_JobStep(&ShmJob);
+        if (ret == CLI_PENDING)
+        {
+            return;
+        }
+        shm_finish(ret);
+    }
+
+    if (ShmRspPending && (shm_respond() != 0))
+    {
+        return;
+    }
+
+    if (ShmCloseReq)
+    {
+        shm_close();
+        return;
+    }
+
+    for (int n = 0; n < SHM_BATCH; n++)
+    {
+        char cmd[CLI_STR_BUF_SIZE];
+        CliShmMsg_TypeDef *msg = cli_shm_peek(&Shm->Req);
+
+        if (msg == NULL)
+        {
+            break;
+        }
+
+        unsigned int len = msg->Len - sizeof(CliShmMsg_TypeDef);
+        if (len > sizeof(cmd) - 1)
+        {
+            len = sizeof(cmd) - 1;
+        }
+        memcpy(cmd, msg + 1, len);
+        cmd[len] = 0;
+        memset(&ShmRsp, 0, sizeof(ShmRsp));
+        ShmRsp.Seq = msg->Seq;
+        cli_shm_pop(&Shm->Req, msg);
+
+        ShmCapture.Len = 0;
+        ShmCapture.Lost = 0;
+        ShmCapture.Esc = 0;
+
+        int ret = Cli_JobStart(&ShmJob, Cli_PlanGet(cmd), &ShmCapture.Output);
+        if ((ret == CLI_PENDING) || (shm_finish(ret) != 0))
+        {
+            return;
+        }
+
+        if (ShmCloseReq)
+        {
+            shm_close();
+            return;
+        }
+    }
+}
+
+/*!@brief Close the segment, called from Cli_Deinit.
+ */
+void cli_shm_deinit(void)
+{
+    if (Shm != NULL)
+    {
+        shm_close();
+    }
+}
+
+/*!@brief Built-in command of "shm", show the shared memory channel.
+ *
+ */
+int builtin_shm(int argc, char **args)
+{
+    if (Shm == NULL)
+    {
+        CLI_PRINT("Shared memory is closed, try [shm open]\n");
+        return 0;
+    }
+
+    CLI_PRINT("Name     = %s\n", ShmName);
+    CLI_PRINT("Client   = %u\n", __atomic_load_n(&Shm->Clients, __ATOMIC_RELAXED));
+    CLI_PRINT("Served   = %u\n", ShmServed);
+    CLI_PRINT("RspFull  = %u\n", ShmFull);
+    CLI_PRINT("Request  = %u bytes queued\n",
+              __atomic_load_n(&Shm->Req.Head, __ATOMIC_RELAXED) - Shm->Req.Tail);
+    return 0;
+}
+
+/*!@brief Built-in command of "shm open", start serving on a segment.
+ *
+ */
+int builtin_shm_open(int argc, char **args)
+{
+    return Cli_ShmOpen((argc > 1) ? args[1] : CLI_SHM_NAME);
+}
+
+/*!@brief Built-in command of "shm close", stop serving.
+ *
+ */
+int builtin_shm_close(int argc, char **args)
+{
+    return Cli_ShmClose();
+}
+
+#endif /* CLI_SHM_ENABLE */
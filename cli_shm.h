@@ -0,0 +1,177 @@
+/******************************************************************************
+ * @file    cli_shm.h
+ * @brief   Shared memory channel of the Command Line Interface (CLI).
+ *          Layout of the segment & ring functions, shared by the CLI process
+ *          (cli_shm.c) and clients in other processes (tools/cli_client.c).
+ *
+ *          The segment holds two single producer, single consumer byte rings:
+ *          requests from the client to the CLI and responses back. Records
+ *          never wrap, a record with Len 0 tells the reader to go to the start.
+ *          A reader that runs out of records sets Wait and sleeps on the futex
+ *          of Head, the writer wakes it after publishing a record.
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#ifndef CLI_SHM_H_
+#define CLI_SHM_H_
+
+/** Includes ----------------------------------------------------------------*/
+#include <linux/futex.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Defines -----------------------------------------------------------------*/
+#define CLI_SHM_MAGIC           0x434C4931  //!< "CLI1"
+#define CLI_SHM_RING_SIZE       65536       //!< Bytes of each ring, power of 2
+#define CLI_SHM_MSG_MAX         4096        //!< Maximum payload of a record
+#define CLI_SHM_FLAG_TRUNC      0x01        //!< Response output was truncated
+
+#define CLI_SHM_ALIGN(n)        (((n) + 15) & ~15u)
+
+/** Types -------------------------------------------------------------------*/
+/*!@typedef CliShmMsg_TypeDef
+ *          Record header, followed by the payload. A request carries a
+ *          command string, a response carries the output of the command.
+ */
+typedef struct
+{
+    uint32_t Len;               //!< Bytes of header & payload, 0 to wrap to the start
+    uint32_t Seq;               //!< Sequence ID of the request, copied to the response
+    int32_t Ret;                //!< Return value of the command
+    uint32_t Flags;             //!< CLI_SHM_FLAG_TRUNC
+} CliShmMsg_TypeDef;
+
+/*!@typedef CliShmRing_TypeDef
+ *          Head is written by the producer and Tail by the consumer, they are
+ *          kept in different cache lines.
+ */
+typedef struct
+{
+    uint32_t Head;              //!< Bytes written, futex word of the consumer
+    uint8_t Pad0[60];
+    uint32_t Tail;              //!< Bytes consumed
+    uint32_t Wait;              //!< Consumer is sleeping on Head
+    uint8_t Pad1[56];
+    uint8_t Data[CLI_SHM_RING_SIZE];
+} CliShmRing_TypeDef;
+
+/*!@typedef CliShm_TypeDef
+ *          The shared segment.
+ */
+typedef struct
+{
+    uint32_t Magic;             //!< CLI_SHM_MAGIC when the CLI is serving
+    uint32_t Clients;           //!< A client is attached
+    uint8_t Pad[56];
+    CliShmRing_TypeDef Req;     //!< Client to CLI
+    CliShmRing_TypeDef Rsp;     //!< CLI to client
+} CliShm_TypeDef;
+
+/** Functions ---------------------------------------------------------------*/
+/*!@brief Write a record to a ring.
+ *
+ * @return 0, or -1 if the ring has no room now.
+ */
+static inline int cli_shm_put(CliShmRing_TypeDef *ring, const CliShmMsg_TypeDef *msg,
+                              const void *data, uint32_t len)
+{
+    uint32_t head = ring->Head;
+    uint32_t tail = __atomic_load_n(&ring->Tail, __ATOMIC_ACQUIRE);
+    uint32_t pos = head & (CLI_SHM_RING_SIZE - 1);
+    uint32_t need = CLI_SHM_ALIGN(sizeof(CliShmMsg_TypeDef) + len);
+    uint32_t skip = (CLI_SHM_RING_SIZE - pos < need) ? CLI_SHM_RING_SIZE - pos : 0;
+
+    if (CLI_SHM_RING_SIZE - (head - tail) < skip + need)
+    {
+        return -1;
+    }
+
+    if (skip != 0)
+    {
+        ((CliShmMsg_TypeDef *) &ring->Data[pos])->Len = 0;
+        head += skip;
+        pos = 0;
+    }
+
+    CliShmMsg_TypeDef *hdr = (CliShmMsg_TypeDef *) &ring->Data[pos];
+    *hdr = *msg;
+    hdr->Len = sizeof(CliShmMsg_TypeDef) + len;
+    memcpy(hdr + 1, data, len);
+
+    __atomic_store_n(&ring->Head, head + need, __ATOMIC_RELEASE);
+
+    // Pairs with the fence of the consumer before it checks Head & sleeps.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->Wait, __ATOMIC_RELAXED))
+    {
+        syscall(SYS_futex, &ring->Head, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+    return 0;
+}
+
+/*!@brief Get the next record of a ring, it stays in the ring until
+ *        cli_shm_pop() is called.
+ *
+ * @return Pointer to the record, or NULL if the ring is empty.
+ */
+static inline CliShmMsg_TypeDef *cli_shm_peek(CliShmRing_TypeDef *ring)
+{
+    uint32_t head = __atomic_load_n(&ring->Head, __ATOMIC_ACQUIRE);
+    uint32_t tail = ring->Tail;
+
+    if (tail == head)
+    {
+        return NULL;
+    }
+
+    CliShmMsg_TypeDef *hdr = (CliShmMsg_TypeDef *) &ring->Data[tail & (CLI_SHM_RING_SIZE - 1)];
+    if (hdr->Len == 0)
+    {
+        tail += CLI_SHM_RING_SIZE - (tail & (CLI_SHM_RING_SIZE - 1));
+        __atomic_store_n(&ring->Tail, tail, __ATOMIC_RELEASE);
+        if (tail == head)
+        {
+            return NULL;
+        }
+        hdr = (CliShmMsg_TypeDef *) &ring->Data[0];
+    }
+
+    return hdr;
+}
+
+/*!@brief Release the record returned by cli_shm_peek().
+ */
+static inline void cli_shm_pop(CliShmRing_TypeDef *ring, CliShmMsg_TypeDef *msg)
+{
+    __atomic_store_n(&ring->Tail, ring->Tail + CLI_SHM_ALIGN(msg->Len), __ATOMIC_RELEASE);
+}
+
+/*!@brief Sleep until a record is written to a ring, or timeout.
+ *
+ * @param ms    Timeout in ms, -1 for no timeout
+ */
+static inline void cli_shm_wait(CliShmRing_TypeDef *ring, int ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    uint32_t head = __atomic_load_n(&ring->Head, __ATOMIC_ACQUIRE);
+
+    if (head != ring->Tail)
+    {
+        return;
+    }
+
+    __atomic_store_n(&ring->Wait, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->Head, __ATOMIC_RELAXED) == head)
+    {
+        syscall(SYS_futex, &ring->Head, FUTEX_WAIT, head, (ms < 0) ? NULL : &ts, NULL, 0);
+    }
+    __atomic_store_n(&ring->Wait, 0, __ATOMIC_RELAXED);
+}
+
+#endif /* CLI_SHM_H_ */
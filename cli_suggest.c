@@ -0,0 +1,366 @@
+/******************************************************************************
+ * @file    cli_suggest.c
+ * @brief   Command suggestion index of the Command Line Interface (CLI).
+ *          Every command line entered is counted in a prefix tree of one
+ *          node per character, so lines sharing a prefix share its nodes and
+ *          a line is stored once however often it's entered. Each node keeps
+ *          the best line of its subtree, the most used one and the latest of
+ *          equals, so the suggestion for a prefix is found by walking the
+ *          prefix and reading the rest of the best line back from its node.
+ *          Counts only grow, so entering a line updates the nodes above it
+ *          and stops at the first one it doesn't win. When the index is full
+ *          the least used line is evicted and its nodes are recycled.
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cli.h"
+
+#if CLI_SUGGEST_ENABLE
+
+/** Private defines ---------------------------------------------------------*/
+#define SUGGEST_TOP         10      // Lines listed by cli_suggest_show
+
+/** Private types -----------------------------------------------------------*/
+/*!@typedef SuggestNode_TypeDef
+ *          A character of the prefix tree, node 0 is the root. Links are
+ *          node indexes and entries are stored plus one, 0 for none.
+ */
+typedef struct
+{
+    char C;                     //!< Character of the edge from the parent
+    uint16_t Parent;            //!< Parent node
+    uint16_t Child;             //!< First child
+    uint16_t Next;              //!< Next sibling, or next free node
+    uint16_t Best;              //!< Best entry + 1 ending in the subtree
+    uint16_t Entry;             //!< Entry + 1 ending at this node
+} SuggestNode_TypeDef;
+
+/*!@typedef SuggestEntry_TypeDef
+ *          A distinct command line, its text is the path to its node.
+ */
+typedef struct
+{
+    unsigned int Count;         //!< Times it's entered, 0 for a free entry
+    unsigned int Stamp;         //!< Time it's entered last, by SuggestClock
+    uint16_t Node;              //!< Node of its last character
+    uint16_t Len;               //!< Length of the line
+} SuggestEntry_TypeDef;
+
+/** Variables ---------------------------------------------------------------*/
+static SuggestNode_TypeDef SuggestNode[CLI_SUGGEST_NODE_NUM];   // Prefix tree
+static SuggestEntry_TypeDef SuggestEntry[CLI_SUGGEST_NUM];      // Distinct lines
+static unsigned int SuggestReady = 0;   // Free list has been linked
+static unsigned int SuggestFree = 0;    // First free node, 0 for none
+static unsigned int SuggestFreeNum = 0; // Number of free nodes
+static unsigned int SuggestNum = 0;     // Number of lines indexed
+static unsigned int SuggestClock = 0;   // Counts lines entered, orders equal counts
+static unsigned int SuggestEvicted = 0; // Lines evicted to make room
+
+/** Functions ---------------------------------------------------------------*/
+/*!@brief Clear the index, all nodes but the root are free.
+ */
+void cli_suggest_clear(void)
+{
+    memset(SuggestNode, 0, sizeof(SuggestNode));
+    memset(SuggestEntry, 0, sizeof(SuggestEntry));
+    for (int i = 1; i < CLI_SUGGEST_NODE_NUM - 1; i++)
+    {
+        SuggestNode[i].Next = i + 1;
+    }
+    SuggestFree = (CLI_SUGGEST_NODE_NUM > 1) ? 1 : 0;
+    SuggestFreeNum = CLI_SUGGEST_NODE_NUM - 1;
+    SuggestNum = 0;
+    SuggestReady = 1;
+}
+
+/*!@brief Check if an entry ranks above another, by count then by recency.
+ *
+ * @param a     Entry + 1, 0 for none
+ * @param b     Entry + 1, 0 for none
+ */
+static int suggest_better(unsigned int a, unsigned int b)
+{
+    if ((a == 0) || (b == 0))
+    {
+        return a != 0;
+    }
+
+    const SuggestEntry_TypeDef *ea = &SuggestEntry[a - 1];
+    const SuggestEntry_TypeDef *eb = &SuggestEntry[b - 1];
+    return (ea->Count > eb->Count) || ((ea->Count == eb->Count) && ((int) (ea->Stamp - eb->Stamp) > 0));
+}
+
+static unsigned int suggest_child(unsigned int node, char c)
+{
+    for (unsigned int i = SuggestNode[node].Child; i != 0; i = SuggestNode[i].Next)
+    {
+        if (SuggestNode[i].C == c)
+        {
+            return i;
+        }
+    }
+    return 0;
+}
+
+/*!@brief Find the node of a prefix.
+ *
+ * @return The node, or 0 when no line starts with it.
+ */
+static unsigned int suggest_walk(const char *str, int len)
+{
+    unsigned int node = 0;
+
+    for (int i = 0; i < len; i++)
+    {
+        node = suggest_child(node, str[i]);
+        if (node == 0)
+        {
+            return 0;
+        }
+    }
+    return node;
+}
+
+/*!@brief Work out the best entry of the nodes from one up to the root again,
+ *        after an entry below has gone. Stops where the best doesn't change.
+ */
+static void suggest_rebest(unsigned int node)
+{
+    for (;;)
+    {
+        unsigned int best = SuggestNode[node].Entry;
+        for (unsigned int i = SuggestNode[node].Child; i != 0; i = SuggestNode[i].Next)
+        {
+            if (suggest_better(SuggestNode[i].Best, best))
+            {
+                best = SuggestNode[i].Best;
+            }
+        }
+        if ((best == SuggestNode[node].Best) || (node == 0))
+        {
+            SuggestNode[node].Best = best;
+            return;
+        }
+        SuggestNode[node].Best = best;
+        node = SuggestNode[node].Parent;
+    }
+}
+
+/*!@brief Evict the least used line, the oldest of equals, and free the nodes
+ *        no other line goes through.
+ *
+ * @return 0, or -1 when the index is empty.
+ */
+static int suggest_evict(void)
+{
+    unsigned int victim = 0;
+
+    for (unsigned int i = 1; i <= CLI_SUGGEST_NUM; i++)
+    {
+        if ((SuggestEntry[i - 1].Count != 0) && ((victim == 0) || suggest_better(victim, i)))
+        {
+            victim = i;
+        }
+    }
+    if (victim == 0)
+    {
+        return -1;
+    }
+
+    unsigned int node = SuggestEntry[victim - 1].Node;
+    memset(&SuggestEntry[victim - 1], 0, sizeof(SuggestEntry_TypeDef));
+    SuggestNode[node].Entry = 0;
+    SuggestNum--;
+    SuggestEvicted++;
+
+    while ((node != 0) && (SuggestNode[node].Child == 0) && (SuggestNode[node].Entry == 0))
+    {
+        unsigned int parent = SuggestNode[node].Parent;
+        uint16_t *link = &SuggestNode[parent].Child;
+        while (*link != node)
+        {
+            link = &SuggestNode[*link].Next;
+        }
+        *link = SuggestNode[node].Next;
+
+        SuggestNode[node].Next = SuggestFree;
+        SuggestFree = node;
+        SuggestFreeNum++;
+        node = parent;
+    }
+    suggest_rebest(node);
+    return 0;
+}
+
+/*!@brief Count a command line entered, called when the line editor gets ENTER.
+ *
+ * @param line  Command line without the line end
+ */
+void cli_suggest_add(const char *line)
+{
+    unsigned int len = strlen(line);
+
+    if (!SuggestReady)
+    {
+        cli_suggest_clear();
+    }
+    if ((len == 0) || (len >= CLI_SUGGEST_NODE_NUM / 2))
+    {
+        return;
+    }
+
+    unsigned int node = suggest_walk(line, len);
+    unsigned int entry = (node != 0) ? SuggestNode[node].Entry : 0;
+    if (entry == 0)
+    {
+        // A new line takes at most a node per character.
+        while ((SuggestNum >= CLI_SUGGEST_NUM) || (SuggestFreeNum < len))
+        {
+            if (suggest_evict() != 0)
+            {
+                return;
+            }
+        }
+        for (entry = 1; SuggestEntry[entry - 1].Count != 0; entry++)
+        {
+        }
+
+        node = 0;
+        for (unsigned int i = 0; i < len; i++)
+        {
+            unsigned int child = suggest_child(node, line[i]);
+            if (child == 0)
+            {
+                child = SuggestFree;
+                SuggestFree = SuggestNode[child].Next;
+                SuggestFreeNum--;
+                memset(&SuggestNode[child], 0, sizeof(SuggestNode_TypeDef));
+                SuggestNode[child].C = line[i];
+                SuggestNode[child].Parent = node;
+                SuggestNode[child].Next = SuggestNode[node].Child;
+                SuggestNode[node].Child = child;
+            }
+            node = child;
+        }
+        SuggestNode[node].Entry = entry;
+        SuggestEntry[entry - 1].Node = node;
+        SuggestEntry[entry - 1].Len = len;
+        SuggestNum++;
+    }
+    SuggestEntry[entry - 1].Count++;
+    SuggestEntry[entry - 1].Stamp = ++SuggestClock;
+
+    // The entry only moved up, ancestors it doesn't win are already right.
+    for (;;)
+    {
+        if (SuggestNode[node].Best != entry)
+        {
+            if (!suggest_better(entry, SuggestNode[node].Best))
+            {
+                break;
+            }
+            SuggestNode[node].Best = entry;
+        }
+        if (node == 0)
+        {
+            break;
+        }
+        node = SuggestNode[node].Parent;
+    }
+}
+
+/*!@brief Copy the text of an entry from a depth of its path on.
+ *
+ * @return Length of the text, may be more than what fits in buf.
+ */
+static int suggest_text(unsigned int entry, int from, char *buf, int size)
+{
+    const SuggestEntry_TypeDef *e = &SuggestEntry[entry - 1];
+    int len = e->Len - from;
+    unsigned int node = e->Node;
+
+    for (int i = len - 1; i >= 0; i--)
+    {
+        if (i < size - 1)
+        {
+            buf[i] = SuggestNode[node].C;
+        }
+        node = SuggestNode[node].Parent;
+    }
+    if (size > 0)
+    {
+        buf[(len < size - 1) ? len : size - 1] = 0;
+    }
+    return len;
+}
+
+/*!@brief Get the rest of the best line starting with a prefix.
+ *
+ * @param prefix    Text typed so far
+ * @param len       Length of the prefix
+ * @param buf       Buffer of the rest
+ * @param size      Size of the buffer, a longer rest gives no suggestion
+ * @return          Length of the rest, 0 for no suggestion.
+ */
+int cli_suggest_find(const char *prefix, int len, char *buf, int size)
+{
+    if (!SuggestReady || (len <= 0))
+    {
+        return 0;
+    }
+
+    unsigned int node = suggest_walk(prefix, len);
+    unsigned int best = SuggestNode[node].Best;
+    if ((node == 0) || (best == 0) || (SuggestEntry[best - 1].Len - len >= size))
+    {
+        return 0;
+    }
+    return suggest_text(best, len, buf, size);
+}
+
+/*!@brief Show usage of the index and the most used lines, for "history -s".
+ */
+void cli_suggest_show(void)
+{
+    char buf[CLI_STR_BUF_SIZE];
+    unsigned int last = 0;
+
+    CLI_PRINT("Suggest  = %u of %u lines, %u evicted\n", SuggestNum, (unsigned int) CLI_SUGGEST_NUM,
+              SuggestEvicted);
+    CLI_PRINT("Node     = %u of %u used\n", (unsigned int) (CLI_SUGGEST_NODE_NUM - 1) - SuggestFreeNum,
+              (unsigned int) CLI_SUGGEST_NODE_NUM - 1);
+    if (SuggestNum == 0)
+    {
+        return;
+    }
+
+    // Rank by the order suggestions take, a selection of the top few.
+    CLI_PRINT("Count    Command\n");
+    for (int n = 0; n < SUGGEST_TOP; n++)
+    {
+        unsigned int top = 0;
+        for (unsigned int i = 1; i <= CLI_SUGGEST_NUM; i++)
+        {
+            if ((SuggestEntry[i - 1].Count != 0) && ((last == 0) || suggest_better(last, i))
+                && suggest_better(i, top))
+            {
+                top = i;
+            }
+        }
+        if (top == 0)
+        {
+            break;
+        }
+        suggest_text(top, 0, buf, sizeof(buf));
+        CLI_PRINT("%-8u %s\n", SuggestEntry[top - 1].Count, buf);
+        last = top;
+    }
+}
+
+#endif /* CLI_SUGGEST_ENABLE */
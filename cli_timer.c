@@ -0,0 +1,468 @@
+/******************************************************************************
+ * @file    cli_timer.c
+ * @brief   Periodic & delayed commands for the Command Line Interface (CLI).
+ *          Timers are kept in a hierarchical timer wheel polled from Cli_Run,
+ *          so scheduling, cancelling & firing are O(1) for any number of
+ *          active timers. Level 0 has one slot per ms tick, higher levels
+ *          hold far timers and cascade them down as time goes on. Timers
+ *          beyond the top level wait in it for more rotations.
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cli.h"
+
+#if CLI_TIMER_ENABLE
+
+/** Private defines ---------------------------------------------------------*/
+#define WHEEL0_BITS         8
+#define WHEEL0_SIZE         (1 << WHEEL0_BITS)
+#define WHEELN_BITS         6
+#define WHEELN_SIZE         (1 << WHEELN_BITS)
+#define WHEELN_LEVELS       3
+#define WHEEL_RANGE         (1u << (WHEEL0_BITS + WHEELN_BITS * WHEELN_LEVELS))
+#define TIMER_MAX_MS        ((1u << 30) - 1)    // Longest delay, deadlines compare as signed ticks
+
+/*!@def WHEELN_INDEX
+ *      Slot of a tick in upper level n (0 based).
+ */
+#define WHEELN_INDEX(tick, n)   (((tick) >> (WHEEL0_BITS + (n) * WHEELN_BITS)) & (WHEELN_SIZE - 1))
+
+/** Private types -----------------------------------------------------------*/
+typedef struct CliTimer
+{
+    struct CliTimer *Next;      //!< Next timer in the same slot, or next free timer
+    struct CliTimer *Prev;      //!< Previous timer in the same slot
+    struct CliTimer **Slot;     //!< Slot list head this timer is linked to
+    unsigned int Id;            //!< Timer ID, 0 when the timer is free
+    unsigned int Expires;       //!< Tick of next deadline
+    unsigned int Interval;      //!< Period in ms, 0 for one shot
+    unsigned int Fired;         //!< Number of runs
+    unsigned int Missed;        //!< Deadlines skipped because CLI was late or busy
+    unsigned int MaxLate;       //!< Maximum lateness of a run in ms
+    CliPlan_TypeDef *Plan;      //!< Command to run
+} CliTimer_TypeDef;
+
+/** Private function prototypes ---------------------------------------------*/
+extern unsigned int cli_gettick(void);
+extern void cli_free(void *ptr);
+
+/** Variables ---------------------------------------------------------------*/
+static CliTimer_TypeDef TimerList[CLI_TIMER_NUM];                   // Timer storage
+static CliTimer_TypeDef *Wheel0[WHEEL0_SIZE];                       // Level 0, 1 tick per slot
+static CliTimer_TypeDef *WheelN[WHEELN_LEVELS][WHEELN_SIZE];        // Upper levels
+static unsigned int WheelTick = 0;      // Next tick to process
+static unsigned int WheelReady = 0;     // WheelTick has been synchronized
+static unsigned int TimerSeq = 0;       // Sequence to make IDs unique
+static unsigned int TimerReady = 0;     // Free list has been linked
+static CliTimer_TypeDef *TimerFree = NULL; // First free timer
+static CliJob_TypeDef TimerJob = { 0 }; // Job of the fired command
+static CliRecord_TypeDef TimerRecord = { 0 }; // JSON record of the fired command
+
+/** Functions ---------------------------------------------------------------*/
+static void timer_link(CliTimer_TypeDef *t, CliTimer_TypeDef **slot)
+{
+    t->Slot = slot;
+    t->Prev = NULL;
+    t->Next = *slot;
+    if (t->Next != NULL)
+    {
+        t->Next->Prev = t;
+    }
+    *slot = t;
+}
+
+static void timer_unlink(CliTimer_TypeDef *t)
+{
+    if (t->Prev != NULL)
+    {
+        t->Prev->Next = t->Next;
+    }
+    else
+    {
+        *t->Slot = t->Next;
+    }
+
+    if (t->Next != NULL)
+    {
+        t->Next->Prev = t->Prev;
+    }
+
+    t->Slot = NULL;
+}
+
+/*!@brief Put a timer to the wheel slot of its deadline.
+ */
+static void timer_insert(CliTimer_TypeDef *t)
+{
+    unsigned int delta = t->Expires - WheelTick;
+
+    // Overdue timers run on the next processed tick.
+    if ((int) delta < 0)
+    {
+        t->Expires = WheelTick;
+        delta = 0;
+    }
+
+    if (delta < WHEEL0_SIZE)
+    {
+        timer_link(t, &Wheel0[t->Expires & (WHEEL0_SIZE - 1)]);
+        return;
+    }
+
+    for (int n = 0; n < WHEELN_LEVELS; n++)
+    {
+        if (delta < (1u << (WHEEL0_BITS + (n + 1) * WHEELN_BITS)))
+        {
+            timer_link(t, &WheelN[n][WHEELN_INDEX(t->Expires, n)]);
+            return;
+        }
+    }
+
+    // Beyond the top level, the current slot of it is cascaded a rotation
+    // later at the earliest, then the timer is put back by its deadline.
+    timer_link(t, &WheelN[WHEELN_LEVELS - 1][WHEELN_INDEX(WheelTick, WHEELN_LEVELS - 1)]);
+}
+
+/*!@brief Move all timers of an upper level slot down to lower levels.
+ *
+ * @return Index of the slot, 0 means the next level has to cascade too.
+ */
+static unsigned int timer_cascade(int n)
+{
+    unsigned int idx = WHEELN_INDEX(WheelTick, n);
+    CliTimer_TypeDef *t = WheelN[n][idx];
+
+    WheelN[n][idx] = NULL;
+    while (t != NULL)
+    {
+        CliTimer_TypeDef *next = t->Next;
+        timer_insert(t);
+        t = next;
+    }
+
+    return idx;
+}
+
+static void timer_release(CliTimer_TypeDef *t)
+{
+    if (t->Slot != NULL)
+    {
+        timer_unlink(t);
+    }
+    Cli_PlanFree(t->Plan);
+    memset(t, 0, sizeof(CliTimer_TypeDef));
+    t->Next = TimerFree;
+    TimerFree = t;
+}
+
+/*!@brief Run the command of an expired timer and schedule its next deadline.
+ *        Periodic deadlines advance by the interval from the previous
+ *        deadline, not from now, so they don't drift.
+ */
+static void timer_fire(CliTimer_TypeDef *t, unsigned int now)
+{
+    unsigned int late = now - t->Expires;
+    unsigned int id = t->Id;
+
+    if (TimerJob.Plan == NULL)
+    {
+        if (late > t->MaxLate)
+        {
+            t->MaxLate = late;
+        }
+        t->Fired++;
+        t->Plan->RefCount++;
+        TimerRecord.Timer = id;
+        CliOutput_TypeDef *output = Cli_RecordBegin(&TimerRecord, t->Plan);
+        int ret = Cli_JobStart(&TimerJob, t->Plan, output);
+        if (ret != CLI_PENDING)
+        {
+            Cli_RecordEnd(&TimerRecord, ret);
+        }
+    }
+    else if (t->Interval == 0)
+    {
+        // Previous command is still running, retry a one shot on next tick.
+        t->Expires = WheelTick + 1;
+        timer_insert(t);
+        return;
+    }
+    else
+    {
+        t->Missed++;
+    }
+
+    if (t->Id != id)
+    {
+        // Cancelled by its own command.
+        return;
+    }
+
+    if (t->Interval == 0)
+    {
+        timer_release(t);
+        return;
+    }
+
+    t->Expires += t->Interval;
+    if ((int) (now - t->Expires) >= 0)
+    {
+        unsigned int skip = (now - t->Expires) / t->Interval + 1;
+        t->Missed += skip;
+        t->Expires += skip * t->Interval;
+    }
+    timer_insert(t);
+}
+
+/*!@brief Process all ticks up to now and fire expired timers.
+ *        Called from Cli_Run.
+ */
+void cli_timer_poll(void)
+{
+    unsigned int now = cli_gettick();
+
+    if (WheelReady == 0)
+    {
+        WheelTick = now;
+        WheelReady = 1;
+    }
+
+    // A fired command that yielded holds back new runs until it finishes.
+    if (TimerJob.Plan != NULL)
+    {
+        int ret = Cli_JobStep(&TimerJob);
+        if (ret != CLI_PENDING)
+        {
+            Cli_RecordEnd(&TimerRecord, ret);
+        }
+    }
+
+    while ((int) (now - WheelTick) >= 0)
+    {
+        unsigned int idx = WheelTick & (WHEEL0_SIZE - 1);
+
+        if (idx == 0)
+        {
+            for (int n = 0; (n < WHEELN_LEVELS) && (timer_cascade(n) == 0); n++)
+            {
+                ;
+            }
+        }
+
+        // Unlink one at a time, a command may cancel or add other timers.
+        while (Wheel0[idx] != NULL)
+        {
+            CliTimer_TypeDef *t = Wheel0[idx];
+            timer_unlink(t);
+            timer_fire(t, now);
+        }
+
+        WheelTick++;
+    }
+}
+
+/*!@brief Add a timer.
+ *
+ * @param delay     Delay of the first run in ms
+ * @param interval  Period in ms, 0 for one shot
+ * @param plan      Command to run, the timer takes the reference.
+ * @return          Timer ID, or 0 for failure.
+ */
+static unsigned int timer_add(unsigned int delay, unsigned int interval, CliPlan_TypeDef *plan)
+{
+    if (plan == NULL)
+    {
+        return 0;
+    }
+
+    if (!TimerReady)
+    {
+        for (int i = CLI_TIMER_NUM - 1; i >= 0; i--)
+        {
+            TimerList[i].Next = TimerFree;
+            TimerFree = &TimerList[i];
+        }
+        TimerReady = 1;
+    }
+
+    CliTimer_TypeDef *t = TimerFree;
+    if (t == NULL)
+    {
+        Cli_PlanFree(plan);
+        return 0;
+    }
+    TimerFree = t->Next;
+
+    // ID encodes the index, so cancel finds it without searching.
+    t->Id = (++TimerSeq) * CLI_TIMER_NUM + (t - TimerList);
+    t->Interval = interval;
+    t->Plan = plan;
+
+    if (WheelReady == 0)
+    {
+        WheelTick = cli_gettick();
+        WheelReady = 1;
+    }
+    t->Expires = cli_gettick() + delay;
+    timer_insert(t);
+    return t->Id;
+}
+
+/*!@brief Release all timers.
+ */
+static void timer_release_all(void)
+{
+    for (unsigned int i = 0; i < CLI_TIMER_NUM; i++)
+    {
+        if (TimerList[i].Id != 0)
+        {
+            timer_release(&TimerList[i]);
+        }
+    }
+}
+
+/*!@brief Release all timers & the record buffer.
+ */
+void cli_timer_deinit(void)
+{
+    timer_release_all();
+    cli_free(TimerRecord.Capture.Buf);
+    TimerRecord.Capture.Buf = NULL;
+}
+
+/*!@brief Parse a time interval, e.g. "100", "100ms", "1.5s".
+ *
+ * @return Interval in ms, more than TIMER_MAX_MS for a longer one, or -1
+ *         for a bad format.
+ */
+static int timer_parse_ms(const char *str)
+{
+    char *end = NULL;
+    float val = strtof(str, &end);
+
+    if ((end == str) || (val < 0))
+    {
+        return -1;
+    }
+
+    if (strcmp(end, "s") == 0)
+    {
+        val *= 1000;
+    }
+    else if ((*end != 0) && (strcmp(end, "ms") != 0))
+    {
+        return -1;
+    }
+
+    return (val < TIMER_MAX_MS) ? (int) val : TIMER_MAX_MS + 1;
+}
+
+/*!@brief Print all active timers.
+ */
+static void timer_report(void)
+{
+    unsigned int now = cli_gettick();
+
+    CLI_PRINT("ID      Interval  Next      Fired     Missed    MaxLate   Command\n");
+    CLI_PRINT("------------------------------------------------------------------\n");
+    for (unsigned int i = 0; i < CLI_TIMER_NUM; i++)
+    {
+        CliTimer_TypeDef *t = &TimerList[i];
+        if (t->Id != 0)
+        {
+            CLI_PRINT("%-7u %-9u %-9d %-9u %-9u %-9u %s\n", t->Id, t->Interval,
+                      (int) (t->Expires - now), t->Fired, t->Missed, t->MaxLate, t->Plan->Source);
+        }
+    }
+}
+
+/*!@brief Shared part of "every" & "after".
+ */
+static int timer_command(int argc, char **args, int periodic)
+{
+    if (argc < 3)
+    {
+        CLI_PRINT("usage: %s [ms|<n>s] \"command\"\n", args[0]);
+        timer_report();
+        return (argc == 1) ? 0 : -1;
+    }
+
+    int ms = timer_parse_ms(args[1]);
+    if ((ms < 0) || (periodic && (ms == 0)))
+    {
+        CLI_ERROR("ERROR: invalid interval of [%s]\n", args[1]);
+        return -1;
+    }
+    if (ms > TIMER_MAX_MS)
+    {
+        CLI_ERROR("ERROR: interval of [%s] is over the maximum of %u ms\n", args[1], TIMER_MAX_MS);
+        return -1;
+    }
+
+    // A single quoted argument may hold several commands split by ';'.
+    CliPlan_TypeDef *plan =
+            (argc == 3) ? Cli_PlanCompile(args[2]) : Cli_PlanCompileArgs(argc - 2, args + 2);
+    unsigned int id = timer_add(ms, periodic ? ms : 0, plan);
+    if (id == 0)
+    {
+        CLI_ERROR("ERROR: no free timer, maximum is %d\n", CLI_TIMER_NUM);
+        return -1;
+    }
+
+    CLI_PRINT("Timer %u\n", id);
+    return 0;
+}
+
+/*!@brief Built-in command of "every", run a command periodically.
+ *
+ */
+int builtin_every(int argc, char **args)
+{
+    return timer_command(argc, args, 1);
+}
+
+/*!@brief Built-in command of "after", run a command once after a delay.
+ *
+ */
+int builtin_after(int argc, char **args)
+{
+    return timer_command(argc, args, 0);
+}
+
+/*!@brief Built-in command of "cancel", remove timers.
+ *
+ */
+int builtin_cancel(int argc, char **args)
+{
+    if (argc < 2)
+    {
+        CLI_PRINT("usage: cancel [id|all]\n");
+        return -1;
+    }
+
+    if (strcmp(args[1], "all") == 0)
+    {
+        timer_release_all();
+        return 0;
+    }
+
+    unsigned int id = strtoul(args[1], NULL, 0);
+    CliTimer_TypeDef *t = &TimerList[id % CLI_TIMER_NUM];
+    if ((id == 0) || (t->Id != id))
+    {
+        CLI_ERROR("ERROR: no timer of [%s]\n", args[1]);
+        return -1;
+    }
+
+    timer_release(t);
+    return 0;
+}
+
+#endif /* CLI_TIMER_ENABLE */
@@ -0,0 +1,302 @@
+/******************************************************************************
+ * @file    cli_trace.c
+ * @brief   Execution trace of the Command Line Interface (CLI).
+ *          Begin/end events of tokenize, dispatch, command functions & output
+ *          flushes are kept in a preallocated buffer, and dumped as Chrome
+ *          trace-event JSON that loads in Perfetto or chrome://tracing.
+ *          Each job (console, timer, shared memory ...) shows up as a thread,
+ *          so a command that yields is a row of slices on its own track.
+ *
+ *          Trace points are CLI_TRACE_BEGIN(name) & CLI_TRACE_END(), they
+ *          only test gCliTraceOn when tracing is off.
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cli.h"
+
+#if CLI_TRACE_ENABLE
+
+/** Private defines ---------------------------------------------------------*/
+#define TRACE_NAME_SIZE     24      // Bytes of a span name, longer names are cut
+#define TRACE_TID_NUM       8       // Jobs told apart, others share the last ID
+
+/** Private types -----------------------------------------------------------*/
+typedef struct
+{
+    unsigned long long Ts;          //!< Time since trace start in ns
+    char Name[TRACE_NAME_SIZE];     //!< Span name, empty for an end event
+    uint8_t Tid;                    //!< Job ID
+    char Ph;                        //!< 'B' begin or 'E' end
+} CliTraceEvent_TypeDef;
+
+/** Private function prototypes ---------------------------------------------*/
+extern unsigned long long cli_getnanos(void);
+extern CliJob_TypeDef *CliJobCur;
+extern CliJob_TypeDef CliConsoleJob;
+
+/** Variables ---------------------------------------------------------------*/
+int gCliTraceOn = 0;                                    // Tracing is on
+static CliTraceEvent_TypeDef TraceBuf[CLI_TRACE_SIZE];  // Event storage
+static unsigned int TraceCount = 0;                     // Events recorded
+static unsigned int TraceOpen = 0;                      // Recorded spans not ended yet
+static unsigned int TraceSkip = 0;                      // Dropped spans not ended yet
+static unsigned int TraceLost = 0;                      // Spans dropped on a full buffer
+static unsigned long long TraceStart = 0;               // Time the trace has started
+static CliJob_TypeDef *TraceJobs[TRACE_TID_NUM];        // Job of each thread ID
+
+/** Functions ---------------------------------------------------------------*/
+/*!@brief Thread ID of the running job, 0 for commands outside of a job.
+ */
+static uint8_t trace_tid(void)
+{
+    if (CliJobCur == NULL)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < TRACE_TID_NUM; i++)
+    {
+        if (TraceJobs[i] == CliJobCur)
+        {
+            return i + 1;
+        }
+        if (TraceJobs[i] == NULL)
+        {
+            TraceJobs[i] = CliJobCur;
+            return i + 1;
+        }
+    }
+    return TRACE_TID_NUM;
+}
+
+/*!@brief Take a slot for a begin event. Room for the end events of all open
+ *        spans is kept, so every recorded span is closed in the buffer.
+ */
+static CliTraceEvent_TypeDef *trace_begin_slot(void)
+{
+    if (TraceCount + TraceOpen + 2 > CLI_TRACE_SIZE)
+    {
+        TraceSkip++;
+        TraceLost++;
+        return NULL;
+    }
+
+    CliTraceEvent_TypeDef *ev = &TraceBuf[TraceCount++];
+    ev->Ts = cli_getnanos() - TraceStart;
+    ev->Tid = trace_tid();
+    ev->Ph = 'B';
+    TraceOpen++;
+    return ev;
+}
+
+/*!@brief Begin a span, use CLI_TRACE_BEGIN() instead.
+ *
+ * @param name  Span name
+ */
+void Cli_TraceBegin(const char *name)
+{
+    CliTraceEvent_TypeDef *ev = trace_begin_slot();
+
+    if (ev != NULL)
+    {
+        strncpy(ev->Name, name, TRACE_NAME_SIZE - 1);
+        ev->Name[TRACE_NAME_SIZE - 1] = 0;
+    }
+}
+
+/*!@brief Begin a span named by the words of a command, e.g. "shm open".
+ */
+void cli_trace_begin_args(int argc, char **argv)
+{
+    CliTraceEvent_TypeDef *ev = trace_begin_slot();
+
+    if (ev != NULL)
+    {
+        int len = 0;
+        for (int i = 0; (i < argc) && (len < TRACE_NAME_SIZE - 1); i++)
+        {
+            len += snprintf(&ev->Name[len], TRACE_NAME_SIZE - len, "%s%s", i ? " " : "", argv[i]);
+        }
+    }
+}
+
+/*!@brief End the span begun last, use CLI_TRACE_END() instead.
+ */
+void Cli_TraceEnd(void)
+{
+    // Spans are nested, the last begin that was dropped is ended first.
+    if (TraceSkip != 0)
+    {
+        TraceSkip--;
+        return;
+    }
+    if (TraceOpen == 0)
+    {
+        return;
+    }
+
+    CliTraceEvent_TypeDef *ev = &TraceBuf[TraceCount++];
+    ev->Ts = cli_getnanos() - TraceStart;
+    ev->Tid = trace_tid();
+    ev->Ph = 'E';
+    ev->Name[0] = 0;
+    TraceOpen--;
+}
+
+/*!@brief Clear the buffer and start tracing.
+ */
+void Cli_TraceStart(void)
+{
+    TraceCount = 0;
+    TraceOpen = 0;
+    TraceSkip = 0;
+    TraceLost = 0;
+    memset(TraceJobs, 0, sizeof(TraceJobs));
+    TraceStart = cli_getnanos();
+    gCliTraceOn = 1;
+}
+
+/*!@brief Stop tracing, the buffer is kept for a dump.
+ *        Open spans are all on the running call stack, they are ended here.
+ */
+void Cli_TraceStop(void)
+{
+    TraceSkip = 0;
+    while (TraceOpen != 0)
+    {
+        Cli_TraceEnd();
+    }
+    gCliTraceOn = 0;
+}
+
+static void trace_write(FILE *file, const char *buf, int len)
+{
+    if (file != NULL)
+    {
+        fwrite(buf, 1, len, file);
+    }
+    else
+    {
+        Cli_Write(CLI_STREAM_OUT, buf, len);
+    }
+}
+
+/*!@brief Write the trace as Chrome trace-event JSON, to load in Perfetto or
+ *        chrome://tracing. Spans still open, from the running call stack, are
+ *        ended at the time of the dump.
+ *
+ * @param path  File to write, NULL for CLI output
+ * @return      0 or -1 if the file can't be opened.
+ */
+int Cli_TraceDump(const char *path)
+{
+    FILE *file = NULL;
+    char buf[128];
+    int on = gCliTraceOn;
+    int len;
+
+    if ((path != NULL) && ((file = fopen(path, "w")) == NULL))
+    {
+        return -1;
+    }
+
+    // Output of the dump itself is not traced.
+    gCliTraceOn = 0;
+    unsigned long long now = cli_getnanos() - TraceStart;
+    int self = trace_tid();
+
+    trace_write(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", 40);
+    for (int i = 0; i <= TRACE_TID_NUM; i++)
+    {
+        if ((i != 0) && (TraceJobs[i - 1] == NULL))
+        {
+            break;
+        }
+        const char *name = (i == 0) ? "main" : (TraceJobs[i - 1] == &CliConsoleJob) ? "console" : "job";
+        len = snprintf(buf, sizeof(buf),
+                       "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                       "\"args\":{\"name\":\"%s %d\"}},\n", i, name, i);
+        trace_write(file, buf, len);
+    }
+
+    for (unsigned int i = 0; i < TraceCount + TraceOpen; i++)
+    {
+        const CliTraceEvent_TypeDef *ev = &TraceBuf[i];
+        unsigned long long ts = (i < TraceCount) ? ev->Ts : now;
+        char ph = (i < TraceCount) ? ev->Ph : 'E';
+        int tid = (i < TraceCount) ? ev->Tid : self;
+
+        len = snprintf(buf, sizeof(buf), "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":1,\"tid\":%d}%s\n",
+                       (i < TraceCount) ? ev->Name : "", ph, ts / 1000,
+                       (unsigned int) (ts % 1000), tid, (i + 1 < TraceCount + TraceOpen) ? "," : "");
+        trace_write(file, buf, len);
+    }
+    trace_write(file, "]}\n", 3);
+
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+    gCliTraceOn = on;
+    return 0;
+}
+
+#if CLI_BUILTIN_ENABLE
+/*!@brief Built-in command of "trace", show the trace state.
+ *
+ */
+int builtin_trace(int argc, char **args)
+{
+    CLI_PRINT("State    = %s\n", gCliTraceOn ? "on" : "off");
+    CLI_PRINT("Events   = %u/%u\n", TraceCount, (unsigned int) CLI_TRACE_SIZE);
+    CLI_PRINT("Lost     = %u spans\n", TraceLost);
+    return 0;
+}
+
+/*!@brief Built-in command of "trace start".
+ *
+ */
+int builtin_trace_start(int argc, char **args)
+{
+    Cli_TraceStart();
+    return 0;
+}
+
+/*!@brief Built-in command of "trace stop".
+ *
+ */
+int builtin_trace_stop(int argc, char **args)
+{
+    Cli_TraceStop();
+    CLI_PRINT("%u events, %u spans lost\n", TraceCount, TraceLost);
+    return 0;
+}
+
+/*!@brief Built-in command of "trace dump [file]", write the trace to CLI
+ *        output or to a file.
+ *
+ */
+int builtin_trace_dump(int argc, char **args)
+{
+    if (argc <= 1)
+    {
+        return Cli_TraceDump(NULL);
+    }
+
+    if (Cli_TraceDump(args[1]) != 0)
+    {
+        CLI_ERROR("ERROR: can not open [%s]\n", args[1]);
+        return CLI_FAIL;
+    }
+    CLI_PRINT("%u events written to %s\n", TraceCount, args[1]);
+    return 0;
+}
+#endif /* CLI_BUILTIN_ENABLE */
+
+#endif /* CLI_TRACE_ENABLE */
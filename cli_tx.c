@@ -0,0 +1,381 @@
+/******************************************************************************
+ * @file    cli_tx.c
+ * @brief   Output scheduler of the Command Line Interface (CLI).
+ *          Output is queued instead of written to the link at once, and sent
+ *          by cli_tx_poll() as fast as the link allows, so a long output does
+ *          not stall the input loop.
+ *
+ *          - Echo of the line editor goes to a fast queue, everything else goes
+ *            to a bulk queue. Between two lines of bulk output the fast queue is
+ *            sent first, the input line is erased before bulk output goes on
+ *            and drawn again when the bulk queue is empty.
+ *          - With CLI_TX_BAUD, bytes are paced by a token bucket so the port
+ *            never gets more than the line can carry.
+ *          - Small writes are coalesced, the link gets one write per run of
+ *            queued bytes.
+ *          - The link is held by XOFF/XON from the input ring, or by the port
+ *            on RTS/CTS with cli_tx_hold().
+ *          - Under pressure WARNING/INFO logs are dropped and counted, a
+ *            summary line is sent once the queue has room again.
+ *
+ *          The port provides cli_port_tx(), a non-blocking link write that
+ *          returns how many bytes it has taken, e.g. a UART FIFO or DMA, and
+ *          cli_port_rx_poll(), which feeds the input ring from a receiver
+ *          that isn't an interrupt, or does nothing.
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cli.h"
+
+#if CLI_TX_ENABLE
+
+/** Private defines ---------------------------------------------------------*/
+#define TX_WAIT_MS          1000    // Wait for room before output is lost
+#define TX_ERASE            "\r" ANSI_ERASE_LINE
+
+#if ((CLI_TX_BUF_SIZE & (CLI_TX_BUF_SIZE - 1)) != 0) || ((CLI_TX_FAST_SIZE & (CLI_TX_FAST_SIZE - 1)) != 0)
+#error "CLI_TX_BUF_SIZE & CLI_TX_FAST_SIZE must be power of 2"
+#endif
+
+/** Private types -----------------------------------------------------------*/
+typedef struct
+{
+    char *Buf;                  //!< Queue storage
+    unsigned int Size;          //!< Size of storage, power of 2
+    unsigned int Head;          //!< Bytes queued
+    unsigned int Tail;          //!< Bytes sent
+} TxQueue_TypeDef;
+
+/** Private function prototypes ---------------------------------------------*/
+extern int cli_port_tx(const char *buf, int len);
+extern unsigned long long cli_getnanos(void);
+extern unsigned int cli_gettick(void);
+extern void cli_sleep(int ms);
+extern void cli_redraw(void);
+extern void cli_port_rx_poll(void);
+extern unsigned int CliLineEditing;
+
+/** Variables ---------------------------------------------------------------*/
+static char TxFastBuf[CLI_TX_FAST_SIZE];
+static char TxBulkBuf[CLI_TX_BUF_SIZE];
+static TxQueue_TypeDef TxFast = { TxFastBuf, CLI_TX_FAST_SIZE, 0, 0 };  // Echo & prompt
+static TxQueue_TypeDef TxBulk = { TxBulkBuf, CLI_TX_BUF_SIZE, 0, 0 };   // Output & logs
+static unsigned int TxBaud = CLI_TX_BAUD;   // Line rate, 0 for the pace of the port
+static unsigned int TxBudget = 0;           // Bytes the line can take now
+static unsigned long long TxLast = 0;       // Time the budget was last refilled in ns
+static volatile unsigned int TxHold = 0;    // Link is held by XOFF or CTS
+static volatile unsigned int TxHoldLost = 0; // Waited in vain while held, output is lost until release
+static unsigned int TxLineOpen = 0;         // Bulk output sent stopped in the middle of a line
+static unsigned int TxJumped = 0;           // Fast bytes were sent ahead of bulk output
+static unsigned int TxRedraw = 0;           // Input line was erased, draw it when bulk is done
+static unsigned int TxLogDrop = 0;          // Logs dropped since the last summary
+static unsigned int TxStatSent = 0;         // Bytes sent
+static unsigned int TxStatWrites = 0;       // Writes to the link
+static unsigned int TxStatJumps = 0;        // Times echo went ahead of bulk output
+static unsigned int TxStatLogDrop = 0;      // Logs dropped
+static unsigned int TxStatLost = 0;         // Bytes lost after waiting for room
+static unsigned int TxStatPeak = 0;         // Maximum bytes in the bulk queue
+
+/** Functions ---------------------------------------------------------------*/
+static unsigned int queue_used(const TxQueue_TypeDef *q)
+{
+    return q->Head - q->Tail;
+}
+
+static void queue_put(TxQueue_TypeDef *q, const char *buf, unsigned int len)
+{
+    unsigned int pos = q->Head & (q->Size - 1);
+    unsigned int first = (len < q->Size - pos) ? len : q->Size - pos;
+
+    memcpy(&q->Buf[pos], buf, first);
+    memcpy(&q->Buf[0], buf + first, len - first);
+    q->Head += len;
+}
+
+/*!@brief Send queued bytes to the link, in one piece up to the end of storage.
+ *
+ * @param q         Queue
+ * @param max       Maximum bytes to send
+ * @param line      Stop after a new line
+ * @return          Bytes taken by the link.
+ */
+static unsigned int queue_send(TxQueue_TypeDef *q, unsigned int max, int line)
+{
+    unsigned int pos = q->Tail & (q->Size - 1);
+    unsigned int len = queue_used(q);
+
+    len = (len < q->Size - pos) ? len : q->Size - pos;
+    len = (len < max) ? len : max;
+    if (line)
+    {
+        char *nl = memchr(&q->Buf[pos], '\n', len);
+        len = (nl != NULL) ? nl - &q->Buf[pos] + 1 : len;
+    }
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    CLI_TRACE_BEGIN("flush");
+    int num = cli_port_tx(&q->Buf[pos], len);
+    CLI_TRACE_END();
+    if (num <= 0)
+    {
+        return 0;
+    }
+
+    if (q == &TxBulk)
+    {
+        TxLineOpen = (q->Buf[pos + num - 1] != '\n');
+    }
+    q->Tail += num;
+    TxStatSent += num;
+    TxStatWrites++;
+    return num;
+}
+
+/*!@brief Refill the token bucket by the time passed.
+ */
+static void tx_refill(void)
+{
+    unsigned long long now = cli_getnanos();
+    unsigned long long rate = TxBaud / 10;              // 10 bits per byte
+
+    // Idle for long, the bucket is full anyway.
+    if (now - TxLast >= 1000000000ull)
+    {
+        TxBudget = CLI_TX_BURST;
+        TxLast = now;
+        return;
+    }
+
+    unsigned long long earn = (now - TxLast) * rate / 1000000000ull;
+    if (earn == 0)
+    {
+        return;
+    }
+
+    if (TxBudget + earn >= CLI_TX_BURST)
+    {
+        TxBudget = CLI_TX_BURST;
+        TxLast = now;
+    }
+    else
+    {
+        TxBudget += earn;
+        TxLast += earn * 1000000000ull / rate;
+    }
+}
+
+/*!@brief Send queued output as far as the link allows, called from Cli_Run
+ *        and after each write.
+ */
+void cli_tx_poll(void)
+{
+    if (TxHold)
+    {
+        return;
+    }
+
+    for (;;)
+    {
+        unsigned int budget = UINT32_MAX;
+        if (TxBaud != 0)
+        {
+            tx_refill();
+            budget = TxBudget;
+        }
+        if (budget == 0)
+        {
+            return;
+        }
+
+        unsigned int num = 0;
+        int bulk = queue_used(&TxBulk);
+
+        // Echo goes first, unless it would break a line of bulk output.
+        if (queue_used(&TxFast) && (!bulk || !TxLineOpen))
+        {
+            TxJumped |= (bulk != 0);
+            TxStatJumps += (bulk != 0);
+            num = queue_send(&TxFast, budget, 0);
+        }
+        else if (bulk)
+        {
+            // Erase the input line shown in between, it's drawn again later.
+            if (TxJumped)
+            {
+                if (budget < strlen(TX_ERASE))
+                {
+                    return;
+                }
+                num = cli_port_tx(TX_ERASE, strlen(TX_ERASE));
+                TxJumped = 0;
+                TxRedraw = 1;
+            }
+            else
+            {
+                num = queue_send(&TxBulk, budget, queue_used(&TxFast) != 0);
+            }
+        }
+        else if (TxLogDrop)
+        {
+            char msg[40];
+            int len = snprintf(msg, sizeof(msg), "[%u log messages dropped]\n", TxLogDrop);
+            TxLogDrop = 0;
+            queue_put(&TxBulk, msg, len);
+            continue;
+        }
+        else if (TxRedraw)
+        {
+            TxRedraw = 0;
+            cli_redraw();
+            continue;
+        }
+
+        if (num == 0)
+        {
+            return;
+        }
+        if (TxBaud != 0)
+        {
+            TxBudget -= (num < TxBudget) ? num : TxBudget;
+        }
+    }
+}
+
+/*!@brief Queue output, called by cli_port_write.
+ *        Echo of the line editor is queued ahead of bulk output, the prompt &
+ *        OK/FAIL of a command stay in order with its output. WARNING/INFO logs are
+ *        dropped when the bulk queue is 3/4 full, other output waits for room
+ *        up to TX_WAIT_MS. Input is polled meanwhile, so XON is seen. Once a
+ *        wait has ended in vain on a held link, output that doesn't fit is
+ *        lost at once until the link is released.
+ *
+ * @param stream    CLI_STREAM_xxx
+ * @param buf       Bytes to write
+ * @param len       Number of bytes
+ * @return          Number of bytes queued.
+ */
+int cli_tx_write(int stream, const char *buf, int len)
+{
+    TxQueue_TypeDef *q = ((stream == CLI_STREAM_ECHO) && CliLineEditing) ? &TxFast : &TxBulk;
+
+    if ((stream == CLI_STREAM_LOG)
+        && (TxHold || (queue_used(q) + len > q->Size * 3 / 4)))
+    {
+        TxLogDrop++;
+        TxStatLogDrop++;
+        return len;
+    }
+
+    unsigned int start = 0;
+    int done = 0;
+    while (done < len)
+    {
+        unsigned int room = q->Size - queue_used(q);
+        unsigned int num = ((unsigned int) (len - done) < room) ? len - done : room;
+
+        queue_put(q, buf + done, num);
+        done += num;
+        if (queue_used(&TxBulk) > TxStatPeak)
+        {
+            TxStatPeak = queue_used(&TxBulk);
+        }
+        cli_tx_poll();
+
+        if (done < len)
+        {
+            // Queue is full, the input loop is held until the link catches up.
+            if (queue_used(q) < q->Size)
+            {
+                continue;
+            }
+            if (TxHold && TxHoldLost)
+            {
+                TxStatLost += len - done;
+                break;
+            }
+            if (start == 0)
+            {
+                start = cli_gettick();
+            }
+            else if (cli_gettick() - start >= TX_WAIT_MS)
+            {
+                TxHoldLost = TxHold;
+                TxStatLost += len - done;
+                break;
+            }
+            cli_sleep(1);
+#if CLI_RX_ENABLE
+            cli_port_rx_poll();
+#endif
+        }
+    }
+
+    return len;
+}
+
+/*!@brief Hold or release the link, for RTS/CTS flow control or XOFF/XON.
+ *        Safe to call from an interrupt.
+ *
+ * @param hold  1 to stop sending, 0 to go on
+ */
+void cli_tx_hold(int hold)
+{
+    TxHold = hold;
+    if (!hold)
+    {
+        TxHoldLost = 0;
+    }
+}
+
+/*!@brief Send all queued output, waiting up to TX_WAIT_MS.
+ */
+void cli_tx_flush(void)
+{
+    unsigned int start = cli_gettick();
+
+    while ((queue_used(&TxFast) + queue_used(&TxBulk) != 0)
+           && (cli_gettick() - start < TX_WAIT_MS))
+    {
+        cli_tx_poll();
+        cli_sleep(1);
+    }
+}
+
+#if CLI_BUILTIN_ENABLE
+/*!@brief Built-in command of "tx", show the output scheduler or set the line
+ *        rate, e.g. "tx 9600", "tx 0" for no pacing.
+ *
+ */
+int builtin_tx(int argc, char **args)
+{
+    if (argc > 1)
+    {
+        cli_tx_flush();
+        TxBaud = strtoul(args[1], NULL, 0);
+        TxBudget = 0;
+        TxLast = cli_getnanos();
+    }
+
+    CLI_PRINT("Baud     = %u%s\n", TxBaud, TxBaud ? "" : " (port pace)");
+    CLI_PRINT("Held     = %u\n", TxHold);
+    CLI_PRINT("Queued   = %u fast, %u bulk, peak %u/%u\n", queue_used(&TxFast),
+              queue_used(&TxBulk), TxStatPeak, (unsigned int) CLI_TX_BUF_SIZE);
+    CLI_PRINT("Sent     = %u bytes in %u writes\n", TxStatSent, TxStatWrites);
+    CLI_PRINT("Jumps    = %u\n", TxStatJumps);
+    CLI_PRINT("LogDrop  = %u\n", TxStatLogDrop);
+    CLI_PRINT("Lost     = %u\n", TxStatLost);
+    return 0;
+}
+#endif /* CLI_BUILTIN_ENABLE */
+
+#endif /* CLI_TX_ENABLE */
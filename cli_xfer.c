@@ -0,0 +1,780 @@
+/******************************************************************************
+ * @file    cli_xfer.c
+ * @brief   Windowed binary file transfer of the Command Line Interface (CLI).
+ *          "xfer rx <target>" & "xfer tx <target>" switch the console port to
+ *          binary frames until a file is received into, or sent from, a target
+ *          registered by Cli_XferRegister(), e.g. a flash writer. The sender
+ *          keeps up to CLI_XFER_WINDOW blocks ahead of the acknowledgements,
+ *          so the link stays busy instead of idling a round trip per block.
+ *
+ *          Frames are COBS encoded like "rpc" and end with a 0x00 delimiter.
+ *          The decoded frame is:
+ *
+ *          | Type (1) | Seq (4) | Body (n) | CRC32 (4) |
+ *
+ *          Seq & CRC32 are little endian, CRC32 is IEEE 802.3 over Type, Seq
+ *          & Body. Frames & bodies:
+ *
+ *          XFER_READY  Receiver, block size (2) & window (1), sent until the
+ *                      first block comes. The sender starts on it.
+ *          XFER_DATA   Sender, Seq is the block number. Every block is full
+ *                      but the last one.
+ *          XFER_END    Sender, Seq is the number of blocks, file size (4) &
+ *                      CRC32 of the file (4).
+ *          XFER_ACK    Receiver, Seq is the next block expected, the blocks
+ *                      before are stored.
+ *          XFER_NAK    Receiver, the same, sent once for a gap or a bad frame.
+ *                      The sender goes back to Seq.
+ *          XFER_DONE   Receiver, result (1), 0 if size & CRC32 of the file
+ *                      match and the target has taken it.
+ *          XFER_ABORT  Either end, reason (1), the transfer is over.
+ *
+ *          The sender goes back to the oldest block not acknowledged when
+ *          there is no progress for CLI_XFER_TIMEOUT_MS, and gives up after
+ *          CLI_XFER_RETRY times. The protocol engine only talks through
+ *          CliXfer_TypeDef, so tools/xfer_sim.c runs both ends of it on a
+ *          simulated link. The console binding is the "xfer" commands.
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cli.h"
+
+#if CLI_XFER_ENABLE
+
+/** Private defines ---------------------------------------------------------*/
+#define XFER_HEAD_SIZE      5       // Type & Seq
+#define XFER_CRC_SIZE       4
+#define XFER_IDLE_MS        10000   // Give up after this long without a valid frame
+#define XFER_LINGER_MS      (CLI_XFER_TIMEOUT_MS * 4) // Receiver answers a resent END
+#define XFER_UNKNOWN        0xFFFFFFFF
+
+#define XFER_READY          0x10
+#define XFER_DATA           0x01
+#define XFER_END            0x02
+#define XFER_ACK            0x81
+#define XFER_NAK            0x82
+#define XFER_DONE           0x83
+#define XFER_ABORT          0xFF
+
+#define XFER_ERR_TARGET     1       // Target has failed to read or write
+#define XFER_ERR_RETRY      2       // No progress after CLI_XFER_RETRY timeouts
+#define XFER_ERR_FORMAT     3       // Block size of the other end doesn't match
+#define XFER_ERR_USER       4       // Cancelled
+
+#define XFER_STATE_WAIT     0       // Sender waits for READY
+#define XFER_STATE_SEND     1       // Sender sends blocks
+#define XFER_STATE_END      2       // Sender has sent END, waits for DONE
+#define XFER_STATE_RECV     3       // Receiver takes blocks
+#define XFER_STATE_LINGER   4       // Receiver has sent DONE, answers a resent END
+#define XFER_STATE_OVER     5       // Finished, Result is final
+
+/** Private function prototypes ---------------------------------------------*/
+extern unsigned int cli_gettick(void);
+extern unsigned int cli_cobs_encode(const uint8_t *src, unsigned int len, uint8_t *dst);
+extern int cli_cobs_decode(uint8_t *buf, unsigned int len);
+
+/** Functions ---------------------------------------------------------------*/
+/*!@brief CRC32 (IEEE 802.3), continued from a previous value or 0.
+ *        4 bit table like the CRC16 of "rpc", it's small on MCU.
+ */
+static uint32_t xfer_crc32(uint32_t crc, const uint8_t *buf, unsigned int len)
+{
+    static const uint32_t table[16] = { 0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+                                        0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+                                        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+                                        0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C };
+
+    crc = ~crc;
+    for (unsigned int i = 0; i < len; i++)
+    {
+        crc = (crc >> 4) ^ table[(crc ^ buf[i]) & 0x0F];
+        crc = (crc >> 4) ^ table[(crc ^ (buf[i] >> 4)) & 0x0F];
+    }
+    return ~crc;
+}
+
+static void xfer_put32(uint8_t *buf, uint32_t val)
+{
+    buf[0] = val & 0xFF;
+    buf[1] = (val >> 8) & 0xFF;
+    buf[2] = (val >> 16) & 0xFF;
+    buf[3] = (val >> 24) & 0xFF;
+}
+
+static uint32_t xfer_get32(const uint8_t *buf)
+{
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t) buf[3] << 24);
+}
+
+/*!@brief Send a frame. The body may already be in place after the head of
+ *        frame, then body is NULL.
+ */
+static void xfer_send(CliXfer_TypeDef *x, uint8_t type, uint32_t seq, uint8_t *frame,
+                      const void *body, unsigned int len)
+{
+    uint8_t buf[XFER_HEAD_SIZE + 8 + XFER_CRC_SIZE];
+
+    if (frame == NULL)
+    {
+        frame = buf;
+    }
+    frame[0] = type;
+    xfer_put32(&frame[1], seq);
+    if (body != NULL)
+    {
+        memcpy(&frame[XFER_HEAD_SIZE], body, len);
+    }
+    xfer_put32(&frame[XFER_HEAD_SIZE + len], xfer_crc32(0, frame, XFER_HEAD_SIZE + len));
+
+    len = cli_cobs_encode(frame, XFER_HEAD_SIZE + len + XFER_CRC_SIZE, x->TxBuf);
+    x->Send(x->Arg, x->TxBuf, len);
+}
+
+static void xfer_finish(CliXfer_TypeDef *x, int ret)
+{
+    x->Result = ret;
+    x->State = XFER_STATE_OVER;
+}
+
+static void xfer_abort(CliXfer_TypeDef *x, uint8_t reason)
+{
+    xfer_send(x, XFER_ABORT, 0, NULL, &reason, 1);
+    xfer_finish(x, CLI_FAIL);
+}
+
+static void xfer_send_ready(CliXfer_TypeDef *x)
+{
+    uint8_t body[3] = { CLI_XFER_BLOCK & 0xFF, CLI_XFER_BLOCK >> 8, CLI_XFER_WINDOW };
+
+    xfer_send(x, XFER_READY, 0, NULL, body, sizeof(body));
+    x->Ping = cli_gettick();
+}
+
+static void xfer_send_end(CliXfer_TypeDef *x)
+{
+    uint8_t body[8];
+
+    xfer_put32(&body[0], x->Size);
+    xfer_put32(&body[4], x->Crc);
+    xfer_send(x, XFER_END, x->Last, NULL, body, sizeof(body));
+    x->Ping = cli_gettick();
+}
+
+/*!@brief Send blocks until the window is full or all blocks are sent.
+ *        Blocks are read from the target again when they are resent, so the
+ *        sender keeps no copy of the window.
+ */
+static void xfer_send_blocks(CliXfer_TypeDef *x)
+{
+    uint8_t frame[CLI_XFER_FRAME_SIZE];
+
+    while ((x->Next < x->Base + x->Window) && (x->Next < x->Last))
+    {
+        int len = x->Read(x->Next * CLI_XFER_BLOCK, &frame[XFER_HEAD_SIZE], CLI_XFER_BLOCK);
+        if ((len < 0) || (len > CLI_XFER_BLOCK))
+        {
+            xfer_abort(x, XFER_ERR_TARGET);
+            return;
+        }
+
+        if (x->Next == x->High)
+        {
+            x->Crc = xfer_crc32(x->Crc, &frame[XFER_HEAD_SIZE], len);
+            x->Size += len;
+            x->High++;
+            if (len < CLI_XFER_BLOCK)
+            {
+                x->Last = (len > 0) ? x->Next + 1 : x->Next;
+            }
+        }
+        else
+        {
+            x->Resent++;
+        }
+
+        if (len == 0)
+        {
+            break;
+        }
+        xfer_send(x, XFER_DATA, x->Next, frame, NULL, len);
+        x->Next++;
+    }
+
+    if (x->Next >= x->Last)
+    {
+        xfer_send_end(x);
+        x->State = XFER_STATE_END;
+    }
+}
+
+/*!@brief Start one end of a transfer. The receiver announces itself with
+ *        READY, the sender waits for it.
+ *
+ * @param x     Transfer, Send, Arg and Write or Read are set by the caller
+ * @param role  CLI_XFER_RX or CLI_XFER_TX
+ */
+void cli_xfer_start(CliXfer_TypeDef *x, int role)
+{
+    x->Role = role;
+    x->Window = CLI_XFER_WINDOW;
+    x->Nak = 0;
+    x->Ack = 0;
+    x->Base = 0;
+    x->Next = 0;
+    x->High = 0;
+    x->Last = XFER_UNKNOWN;
+    x->Size = 0;
+    x->Crc = 0;
+    x->Start = cli_gettick();
+    x->Tick = x->Start;
+    x->Retry = 0;
+    x->Resent = 0;
+    x->Errors = 0;
+    x->Result = CLI_PENDING;
+    x->RxLen = 0;
+
+    if (role == CLI_XFER_RX)
+    {
+        x->State = XFER_STATE_RECV;
+        xfer_send_ready(x);
+    }
+    else
+    {
+        x->State = XFER_STATE_WAIT;
+    }
+}
+
+/*!@brief Handle a frame at the receiver.
+ */
+static void xfer_recv_frame(CliXfer_TypeDef *x, uint8_t type, uint32_t seq, const uint8_t *body,
+                            unsigned int len)
+{
+    switch (type)
+    {
+    case XFER_DATA:
+        if (x->State != XFER_STATE_RECV)
+        {
+            break;
+        }
+        if (seq == x->Base)
+        {
+            if (x->Write(x->Size, body, len) < 0)
+            {
+                xfer_abort(x, XFER_ERR_TARGET);
+                break;
+            }
+            x->Crc = xfer_crc32(x->Crc, body, len);
+            x->Size += len;
+            x->Base++;
+            x->Ack++;
+            x->Nak = 0;
+            x->Tick = cli_gettick();
+        }
+        else if (seq < x->Base)
+        {
+            // The ACK was lost, tell the sender again.
+            x->Ack++;
+        }
+        else if (!x->Nak)
+        {
+            xfer_send(x, XFER_NAK, x->Base, NULL, NULL, 0);
+            x->Nak = 1;
+        }
+        break;
+
+    case XFER_END:
+    {
+        if (x->State == XFER_STATE_RECV)
+        {
+            if ((seq != x->Base) || (len < 8))
+            {
+                xfer_send(x, XFER_NAK, x->Base, NULL, NULL, 0);
+                x->Nak = 1;
+                break;
+            }
+
+            // The target is told the file is complete by a write without data.
+            uint8_t result = (xfer_get32(&body[0]) != x->Size) || (xfer_get32(&body[4]) != x->Crc);
+            if ((result == 0) && (x->Write(x->Size, NULL, 0) < 0))
+            {
+                result = 2;
+            }
+            x->Result = (result == 0) ? 0 : CLI_FAIL;
+            x->State = XFER_STATE_LINGER;
+        }
+        if (x->State == XFER_STATE_LINGER)
+        {
+            uint8_t result = (x->Result == 0) ? 0 : 1;
+            xfer_send(x, XFER_DONE, seq, NULL, &result, 1);
+            x->Tick = cli_gettick();
+        }
+        break;
+    }
+
+    case XFER_ABORT:
+        xfer_finish(x, CLI_FAIL);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/*!@brief Handle a frame at the sender.
+ */
+static void xfer_send_frame(CliXfer_TypeDef *x, uint8_t type, uint32_t seq, const uint8_t *body,
+                            unsigned int len)
+{
+    switch (type)
+    {
+    case XFER_READY:
+        if (x->State != XFER_STATE_WAIT)
+        {
+            break;
+        }
+        if ((len < 3) || ((body[0] | (body[1] << 8)) != CLI_XFER_BLOCK))
+        {
+            xfer_abort(x, XFER_ERR_FORMAT);
+            break;
+        }
+        x->Window = (body[2] < CLI_XFER_WINDOW) ? body[2] : CLI_XFER_WINDOW;
+        x->Window = (x->Window > 0) ? x->Window : 1;
+        x->State = XFER_STATE_SEND;
+        x->Tick = cli_gettick();
+        break;
+
+    case XFER_ACK:
+    case XFER_NAK:
+        if ((x->State != XFER_STATE_SEND) && (x->State != XFER_STATE_END))
+        {
+            break;
+        }
+        if ((seq > x->Base) && (seq <= x->Next))
+        {
+            x->Base = seq;
+            x->Retry = 0;
+            x->Tick = cli_gettick();
+        }
+        // Go back to the first block the receiver is missing.
+        if ((type == XFER_NAK) && (seq == x->Base) && (seq < x->Next))
+        {
+            x->Next = seq;
+            x->State = XFER_STATE_SEND;
+        }
+        else if ((type == XFER_NAK) && (x->State == XFER_STATE_END) && (x->Base == x->Last))
+        {
+            xfer_send_end(x);
+        }
+        break;
+
+    case XFER_DONE:
+        if (x->State == XFER_STATE_END)
+        {
+            xfer_finish(x, ((len >= 1) && (body[0] == 0)) ? 0 : CLI_FAIL);
+        }
+        break;
+
+    case XFER_ABORT:
+        xfer_finish(x, CLI_FAIL);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/*!@brief Check & handle a frame without its delimiter.
+ */
+static void xfer_frame(CliXfer_TypeDef *x, uint8_t *buf, unsigned int len)
+{
+    int n = cli_cobs_decode(buf, len);
+
+    if ((n < XFER_HEAD_SIZE + XFER_CRC_SIZE)
+        || (xfer_crc32(0, buf, n - XFER_CRC_SIZE) != xfer_get32(&buf[n - XFER_CRC_SIZE])))
+    {
+        // Text before the first frame is no error, a damaged block is.
+        if ((x->Role == CLI_XFER_RX) && (x->State == XFER_STATE_RECV) && (x->Base > 0))
+        {
+            x->Errors++;
+            if (!x->Nak)
+            {
+                xfer_send(x, XFER_NAK, x->Base, NULL, NULL, 0);
+                x->Nak = 1;
+            }
+        }
+        else if (x->State != XFER_STATE_WAIT)
+        {
+            x->Errors++;
+        }
+        return;
+    }
+
+    uint8_t type = buf[0];
+    uint32_t seq = xfer_get32(&buf[1]);
+    unsigned int blen = n - XFER_HEAD_SIZE - XFER_CRC_SIZE;
+    if (x->Role == CLI_XFER_RX)
+    {
+        xfer_recv_frame(x, type, seq, &buf[XFER_HEAD_SIZE], blen);
+    }
+    else
+    {
+        xfer_send_frame(x, type, seq, &buf[XFER_HEAD_SIZE], blen);
+    }
+}
+
+/*!@brief Take bytes from the link.
+ *
+ * @param x     Transfer
+ * @param buf   Bytes received
+ * @param len   Number of bytes
+ */
+void cli_xfer_input(CliXfer_TypeDef *x, const unsigned char *buf, int len)
+{
+    for (int i = 0; (i < len) && (x->State != XFER_STATE_OVER); i++)
+    {
+        if (buf[i] != 0)
+        {
+            // A frame too large is cut, it fails the CRC check.
+            if (x->RxLen < sizeof(x->RxBuf))
+            {
+                x->RxBuf[x->RxLen++] = buf[i];
+            }
+            continue;
+        }
+
+        if (x->RxLen != 0)
+        {
+            xfer_frame(x, x->RxBuf, x->RxLen);
+            x->RxLen = 0;
+        }
+    }
+}
+
+/*!@brief Send what is due: blocks, acknowledgements and resends after a
+ *        timeout. Call it after the input of a poll, the receiver sends one
+ *        ACK for all blocks of the poll.
+ *
+ * @return CLI_PENDING while the transfer runs, then 0 or CLI_FAIL.
+ */
+int cli_xfer_step(CliXfer_TypeDef *x)
+{
+    unsigned int now = cli_gettick();
+
+    switch (x->State)
+    {
+    case XFER_STATE_WAIT:
+        if (now - x->Tick >= XFER_IDLE_MS)
+        {
+            xfer_abort(x, XFER_ERR_RETRY);
+        }
+        break;
+
+    case XFER_STATE_SEND:
+    case XFER_STATE_END:
+        if (now - x->Tick >= CLI_XFER_TIMEOUT_MS)
+        {
+            if (++x->Retry > CLI_XFER_RETRY)
+            {
+                xfer_abort(x, XFER_ERR_RETRY);
+                break;
+            }
+            // Go back to the oldest block not acknowledged.
+            x->Next = x->Base;
+            x->State = XFER_STATE_SEND;
+            x->Tick = now;
+        }
+        if (x->State == XFER_STATE_SEND)
+        {
+            xfer_send_blocks(x);
+        }
+        break;
+
+    case XFER_STATE_RECV:
+        if (x->Ack != 0)
+        {
+            xfer_send(x, XFER_ACK, x->Base, NULL, NULL, 0);
+            x->Ack = 0;
+        }
+        if ((x->Base == 0) && (now - x->Ping >= CLI_XFER_TIMEOUT_MS))
+        {
+            xfer_send_ready(x);
+        }
+        if (now - x->Tick >= XFER_IDLE_MS)
+        {
+            xfer_abort(x, XFER_ERR_RETRY);
+        }
+        break;
+
+    case XFER_STATE_LINGER:
+        if (now - x->Tick >= XFER_LINGER_MS)
+        {
+            x->State = XFER_STATE_OVER;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return (x->State == XFER_STATE_OVER) ? x->Result : CLI_PENDING;
+}
+
+/*!@brief Cancel a transfer, the other end is told.
+ */
+void cli_xfer_abort(CliXfer_TypeDef *x)
+{
+    if (x->State != XFER_STATE_OVER)
+    {
+        xfer_abort(x, XFER_ERR_USER);
+    }
+}
+
+#if CLI_BUILTIN_ENABLE
+/** Console binding ---------------------------------------------------------*/
+/*!@typedef XferTarget_TypeDef
+ *          Where a file is written to or read from.
+ */
+typedef struct
+{
+    const char *Name;                                               //!< Target name
+    int (*Write)(unsigned int offset, const unsigned char *buf, int len); //!< NULL if it can't receive
+    int (*Read)(unsigned int offset, unsigned char *buf, int len);        //!< NULL if it can't send
+} XferTarget_TypeDef;
+
+extern int cli_port_getc(void);
+extern int cli_port_write(int stream, const char *buf, int len);
+
+static int xfer_null_write(unsigned int offset, const unsigned char *buf, int len);
+static int xfer_ram_write(unsigned int offset, const unsigned char *buf, int len);
+static int xfer_ram_read(unsigned int offset, unsigned char *buf, int len);
+
+static XferTarget_TypeDef XferTarget[CLI_XFER_TARGET_NUM] = {
+    { "null", xfer_null_write, NULL },
+    { "ram", xfer_ram_write, xfer_ram_read },
+};
+static uint8_t XferRam[CLI_XFER_RAM_SIZE];      // Storage of the "ram" target
+static unsigned int XferRamLen = 0;             // File size in XferRam
+static CliXfer_TypeDef XferPort;                // Transfer on the console port
+static unsigned int XferActive = 0;             // 1 to start, 2 in binary mode
+static int XferLast = 0;                        // Result of the last transfer, 1 for none
+static CliOutput_TypeDef *XferPrevOutput = NULL; // Output before the transfer
+
+static int xfer_null_write(unsigned int offset, const unsigned char *buf, int len)
+{
+    return len;
+}
+
+static int xfer_ram_write(unsigned int offset, const unsigned char *buf, int len)
+{
+    if (offset + len > sizeof(XferRam))
+    {
+        return -1;
+    }
+    if (buf == NULL)
+    {
+        XferRamLen = offset;
+        return 0;
+    }
+    memcpy(&XferRam[offset], buf, len);
+    return len;
+}
+
+static int xfer_ram_read(unsigned int offset, unsigned char *buf, int len)
+{
+    if (offset >= XferRamLen)
+    {
+        return 0;
+    }
+    len = (offset + len > XferRamLen) ? XferRamLen - offset : len;
+    memcpy(buf, &XferRam[offset], len);
+    return len;
+}
+
+/*!@brief Register a target of "xfer rx <name>" & "xfer tx <name>".
+ *        write gets the file in order, then a call with buf NULL & len 0
+ *        when the file is complete & checked. read may be asked for a block
+ *        again when it's resent, and returns less than len at the end of the
+ *        file. Both return the bytes taken or -1 to abort.
+ *
+ * @param name      Target name, it must be kept as long as it's registered
+ * @param write     Store received data, NULL if the target can't receive
+ * @param read      Get data to send, NULL if the target can't send
+ * @return          0 or CLI_FAIL if the table is full.
+ */
+int Cli_XferRegister(const char *name, int (*write)(unsigned int offset, const unsigned char *buf, int len),
+                     int (*read)(unsigned int offset, unsigned char *buf, int len))
+{
+    for (int i = 0; i < CLI_XFER_TARGET_NUM; i++)
+    {
+        if (XferTarget[i].Name == NULL)
+        {
+            XferTarget[i].Name = name;
+            XferTarget[i].Write = write;
+            XferTarget[i].Read = read;
+            return 0;
+        }
+    }
+    return CLI_FAIL;
+}
+
+static int xfer_port_send(void *arg, const unsigned char *buf, int len)
+{
+    return cli_port_write(CLI_STREAM_RAW, (const char *) buf, len);
+}
+
+/*!@brief Text printed during a transfer would break the framing, it's dropped.
+ */
+static int xfer_null_output(void *arg, int stream, const char *buf, int len)
+{
+    return len;
+}
+
+static CliOutput_TypeDef XferNullOutput = { xfer_null_output, NULL };
+
+/*!@brief Run a transfer on the port, called from Cli_Run.
+ *
+ * @return 1 if the port is in binary mode and text input must not be read.
+ */
+int cli_xfer_poll(void)
+{
+    uint8_t buf[64];
+
+    if (XferActive == 0)
+    {
+        return 0;
+    }
+
+    if (XferActive == 1)
+    {
+        // A lone delimiter ends the text before, like "rpc".
+        XferPrevOutput = Cli_SetOutput(&XferNullOutput);
+#if CLI_RX_ENABLE
+        cli_rx_raw(1);
+#endif
+        cli_port_write(CLI_STREAM_RAW, "", 1);
+        cli_xfer_start(&XferPort, XferPort.Role);
+        XferActive = 2;
+    }
+
+    // Take all input waiting, one ACK covers the blocks of the poll.
+    for (int total = 0; total < CLI_XFER_COBS_SIZE * CLI_XFER_WINDOW * 2;)
+    {
+        int len = 0;
+        int c;
+        while ((len < sizeof(buf)) && ((c = cli_port_getc()) >= 0))
+        {
+            buf[len++] = c;
+        }
+        cli_xfer_input(&XferPort, buf, len);
+        total += len;
+        if (len < sizeof(buf))
+        {
+            break;
+        }
+    }
+
+    XferLast = cli_xfer_step(&XferPort);
+    if (XferLast == CLI_PENDING)
+    {
+        return 1;
+    }
+
+#if CLI_RX_ENABLE
+    cli_rx_raw(0);
+#endif
+    Cli_SetOutput(XferPrevOutput);
+    XferActive = 0;
+
+    // The receiver has lingered after the last END it answered.
+    unsigned int end = (XferPort.Role == CLI_XFER_RX) ? XferPort.Tick : cli_gettick();
+    unsigned int ms = end - XferPort.Start;
+    CLI_PRINT("\nxfer: %u bytes in %u ms, %u blocks resent, %u bad frames\n", XferPort.Size, ms,
+              XferPort.Resent, XferPort.Errors);
+    CLI_ECHO("%s\n%s", XferLast ? "FAIL" : "OK", CLI_PROMPT_CHAR);
+    return 1;
+}
+
+/*!@brief Start a transfer on the port, from the next poll on, after this
+ *        command line is finished.
+ */
+static int xfer_begin(int argc, char **args, int role)
+{
+    XferTarget_TypeDef *target = NULL;
+
+    if (argc < 2)
+    {
+        CLI_PRINT("usage: %s <target>\n", args[0]);
+        return CLI_FAIL;
+    }
+    for (int i = 0; i < CLI_XFER_TARGET_NUM; i++)
+    {
+        if ((XferTarget[i].Name != NULL) && (strcmp(XferTarget[i].Name, args[1]) == 0))
+        {
+            target = &XferTarget[i];
+        }
+    }
+    if ((target == NULL) || ((role == CLI_XFER_RX) && (target->Write == NULL))
+        || ((role == CLI_XFER_TX) && (target->Read == NULL)))
+    {
+        CLI_ERROR("ERROR: no target [%s] to %s\n", args[1], (role == CLI_XFER_RX) ? "receive" : "send");
+        return CLI_FAIL;
+    }
+    // Frames go on the console port, a session can't take it.
+    if (XferActive || (Cli_SessionSelf() != NULL))
+    {
+        return CLI_FAIL;
+    }
+
+    XferPort.Send = xfer_port_send;
+    XferPort.Arg = NULL;
+    XferPort.Write = target->Write;
+    XferPort.Read = target->Read;
+    XferPort.Role = role;
+    XferActive = 1;
+    return 0;
+}
+
+/*!@brief Built-in command of "xfer", list the targets & the last transfer.
+ *
+ */
+int builtin_xfer(int argc, char **args)
+{
+    CLI_PRINT("Block    = %u bytes, window %u\n", (unsigned int) CLI_XFER_BLOCK,
+              (unsigned int) CLI_XFER_WINDOW);
+    CLI_PRINT("Targets  =");
+    for (int i = 0; (i < CLI_XFER_TARGET_NUM) && (XferTarget[i].Name != NULL); i++)
+    {
+        CLI_PRINT(" %s(%s%s)", XferTarget[i].Name, XferTarget[i].Write ? "r" : "",
+                  XferTarget[i].Read ? "t" : "");
+    }
+    CLI_PRINT("\n");
+    CLI_PRINT("Last     = %s, %u bytes, %u resent, %u bad frames\n",
+              (XferPort.Send == NULL) ? "none" : XferLast ? "FAIL" : "OK", XferPort.Size,
+              XferPort.Resent, XferPort.Errors);
+    return 0;
+}
+
+/*!@brief Built-in command of "xfer rx <target>", receive a file.
+ *
+ */
+int builtin_xfer_rx(int argc, char **args)
+{
+    return xfer_begin(argc, args, CLI_XFER_RX);
+}
+
+/*!@brief Built-in command of "xfer tx <target>", send a file.
+ *
+ */
+int builtin_xfer_tx(int argc, char **args)
+{
+    return xfer_begin(argc, args, CLI_XFER_TX);
+}
+#endif /* CLI_BUILTIN_ENABLE */
+
+#endif /* CLI_XFER_ENABLE */
@@ -8,15 +8,100 @@
  *****************************************************************************/
 
 #include "stdio.h"
+#include "string.h"
 #include "unistd.h"
 #include <cli.h>
 
 int main(int argc, char* args[])
 {
+    int shm = 0;
+    int fast = 0;
+    const char *listen = NULL;
+    const char *record = NULL;
+    const char *replay = NULL;
+
+    // --json:          machine-readable output for test hosts, see Cli_SetMode().
+    // --shm:           serve local clients on shared memory, see tools/cli_client.c.
+    // --listen <addr>: serve console sessions on unix:<path> or tcp:[host:]port.
+    // --record <file>: record input with timing, to reproduce a session.
+    // --replay <file>: feed a recorded session as input, with its timing.
+    // --fast:          replay as fast as possible & quit, a throughput benchmark.
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(args[i], "--json") == 0)
+        {
+            Cli_SetMode(CLI_MODE_JSON);
+        }
+        else if (strcmp(args[i], "--shm") == 0)
+        {
+            shm = 1;
+        }
+        else if ((strcmp(args[i], "--listen") == 0) && (i + 1 < argc))
+        {
+            listen = args[++i];
+        }
+        else if ((strcmp(args[i], "--record") == 0) && (i + 1 < argc))
+        {
+            record = args[++i];
+        }
+        else if ((strcmp(args[i], "--replay") == 0) && (i + 1 < argc))
+        {
+            replay = args[++i];
+        }
+        else if (strcmp(args[i], "--fast") == 0)
+        {
+            fast = 1;
+        }
+    }
+
     Cli_Init();
+#if CLI_SHM_ENABLE
+    if (shm)
+    {
+        Cli_ShmOpen(CLI_SHM_NAME);
+    }
+#endif
+#if CLI_SERVER_ENABLE
+    if ((listen != NULL) && (Cli_ServerOpen(listen) != CLI_OK))
+    {
+        fprintf(stderr, "can not listen on [%s]\n", listen);
+        return 1;
+    }
+#endif
+    if ((record != NULL) && (cli_port_record(record) != 0))
+    {
+        fprintf(stderr, "can not record to [%s]\n", record);
+    }
+    if ((replay != NULL) && (cli_port_replay(replay, fast) != 0))
+    {
+        fprintf(stderr, "can not replay [%s]\n", replay);
+        return 1;
+    }
 
     while (1) {
         Cli_Run();
+
+        // A fast replay runs back to back and quits at the end of the file.
+        if (fast && (replay != NULL))
+        {
+            if (!cli_port_replaying())
+            {
+                Cli_Deinit();
+                return 0;
+            }
+            continue;
+        }
+#if CLI_SERVER_ENABLE
+        if (listen != NULL)
+        {
+            Cli_ServerWait(1);
+            continue;
+        }
+#endif
+#if CLI_SHM_ENABLE
+        Cli_ShmWait(1);
+#else
         usleep(1000);
+#endif
     }
 }
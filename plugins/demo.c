@@ -0,0 +1,46 @@
+/******************************************************************************
+ * @file    demo.c
+ * @brief   Example of a command module, built to plugins/demo.so by
+ *          "make plugins" and loaded by the CLI on first use of "demo".
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#include <stdio.h>
+
+#include "cli.h"
+
+static int demo(int argc, char **args)
+{
+    CLI_PRINT("Demo plugin, try [help demo]\n");
+    return 0;
+}
+
+static int demo_hello(int argc, char **args)
+{
+    CLI_PRINT("Hello %s\n", (argc > 1) ? args[1] : "world");
+    return 0;
+}
+
+static int demo_wait(int argc, char **args)
+{
+    CliPt_TypeDef *pt = Cli_PtSelf();
+
+    CLI_PT_BEGIN(pt);
+    pt->Count = 0;
+    while (pt->Count < 3)
+    {
+        CLI_PRINT("wait %u\n", pt->Count++);
+        CLI_PT_YIELD(pt);
+    }
+    CLI_PT_END(pt);
+    return 0;
+}
+
+const CliCommand_TypeDef cli_plugin_commands[] = {
+    { "demo", "Demo plugin", &demo },
+    { "demo hello", "Say hello", &demo_hello },
+    { "demo wait", "Yield a few times", &demo_wait },
+    { NULL }
+};
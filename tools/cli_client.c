@@ -0,0 +1,235 @@
+/******************************************************************************
+ * @file    cli_client.c
+ * @brief   Shared memory client of the Command Line Interface (CLI).
+ *          Runs commands in a CLI started with "--shm" (or "shm open") and
+ *          prints their output, or benchmarks the channel with many
+ *          pipelined requests.
+ *
+ *          cli_client [-n name] "command" ...
+ *          cli_client [-n name] -b count [-w window] "command"
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cli.h"
+#include "cli_shm.h"
+
+/** Variables ---------------------------------------------------------------*/
+static CliShm_TypeDef *Shm = NULL;
+
+/** Functions ---------------------------------------------------------------*/
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *) a;
+    unsigned long long y = *(const unsigned long long *) b;
+    return (x > y) - (x < y);
+}
+
+/*!@brief Map the segment and take the client slot.
+ */
+static int client_attach(const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+    {
+        fprintf(stderr, "can not open [%s], is the CLI serving with --shm?\n", name);
+        return -1;
+    }
+
+    Shm = mmap(NULL, sizeof(CliShm_TypeDef), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if ((Shm == MAP_FAILED) || (__atomic_load_n(&Shm->Magic, __ATOMIC_ACQUIRE) != CLI_SHM_MAGIC))
+    {
+        fprintf(stderr, "[%s] is not a CLI segment\n", name);
+        return -1;
+    }
+
+    // Rings are single producer, only one client at a time.
+    uint32_t idle = 0;
+    if (!__atomic_compare_exchange_n(&Shm->Clients, &idle, 1, 0, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_RELAXED))
+    {
+        fprintf(stderr, "[%s] has a client already\n", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void client_detach(void)
+{
+    __atomic_store_n(&Shm->Clients, 0, __ATOMIC_RELEASE);
+    munmap(Shm, sizeof(CliShm_TypeDef));
+}
+
+static int client_send(uint32_t seq, const char *cmd)
+{
+    CliShmMsg_TypeDef msg = { 0, seq, 0, 0 };
+    return cli_shm_put(&Shm->Req, &msg, cmd, strlen(cmd));
+}
+
+/*!@brief Wait for the next response.
+ *
+ * @return Pointer to the response, or NULL if the CLI has stopped serving.
+ */
+static CliShmMsg_TypeDef *client_receive(void)
+{
+    CliShmMsg_TypeDef *msg;
+
+    while ((msg = cli_shm_peek(&Shm->Rsp)) == NULL)
+    {
+        if (__atomic_load_n(&Shm->Magic, __ATOMIC_ACQUIRE) != CLI_SHM_MAGIC)
+        {
+            return NULL;
+        }
+        cli_shm_wait(&Shm->Rsp, 100);
+    }
+
+    return msg;
+}
+
+/*!@brief Run commands one by one and print their output.
+ *
+ * @return Return value of the last command.
+ */
+static int client_run(int argc, char **argv)
+{
+    int ret = 0;
+
+    for (int i = 0; i < argc; i++)
+    {
+        while (client_send(i, argv[i]) != 0)
+        {
+            cli_shm_wait(&Shm->Rsp, 1);
+        }
+
+        CliShmMsg_TypeDef *msg = client_receive();
+        if (msg == NULL)
+        {
+            return -1;
+        }
+
+        fwrite(msg + 1, 1, msg->Len - sizeof(CliShmMsg_TypeDef), stdout);
+        if (msg->Flags & CLI_SHM_FLAG_TRUNC)
+        {
+            fprintf(stderr, "(output truncated)\n");
+        }
+        ret = msg->Ret;
+        cli_shm_pop(&Shm->Rsp, msg);
+    }
+
+    return ret;
+}
+
+/*!@brief Send a command count times, keeping up to window requests in flight,
+ *        and report throughput & latency.
+ */
+static int client_bench(const char *cmd, unsigned int count, unsigned int window)
+{
+    unsigned long long *sent = malloc(sizeof(unsigned long long) * count);
+    unsigned long long *lat = malloc(sizeof(unsigned long long) * count);
+    unsigned int next = 0;
+    unsigned int done = 0;
+    unsigned int fail = 0;
+
+    if ((sent == NULL) || (lat == NULL))
+    {
+        return -1;
+    }
+
+    unsigned long long start = now_ns();
+    while (done < count)
+    {
+        while ((next < count) && (next - done < window))
+        {
+            sent[next] = now_ns();
+            if (client_send(next, cmd) != 0)
+            {
+                break;
+            }
+            next++;
+        }
+
+        CliShmMsg_TypeDef *msg = client_receive();
+        if (msg == NULL)
+        {
+            fprintf(stderr, "CLI has stopped serving\n");
+            return -1;
+        }
+
+        lat[done++] = now_ns() - sent[msg->Seq];
+        fail += (msg->Ret != 0);
+        cli_shm_pop(&Shm->Rsp, msg);
+    }
+    unsigned long long elapsed = now_ns() - start;
+
+    qsort(lat, count, sizeof(lat[0]), cmp_u64);
+    printf("Requests   = %u (%u failed), window = %u\n", count, fail, window);
+    printf("Throughput = %.0f req/s\n", count * 1e9 / elapsed);
+    printf("Latency us = min %.1f, p50 %.1f, p99 %.1f, max %.1f\n", lat[0] / 1e3,
+           lat[count / 2] / 1e3, lat[count * 99 / 100] / 1e3, lat[count - 1] / 1e3);
+
+    free(sent);
+    free(lat);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *name = CLI_SHM_NAME;
+    unsigned int count = 0;
+    unsigned int window = 64;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:b:w:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            name = optarg;
+            break;
+        case 'b':
+            count = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            window = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+
+    if ((optind >= argc) || (window == 0))
+    {
+        fprintf(stderr, "usage: %s [-n name] [-b count] [-w window] \"command\" ...\n", argv[0]);
+        return 2;
+    }
+
+    if (client_attach(name) != 0)
+    {
+        return 2;
+    }
+
+    int ret = (count > 0) ? client_bench(argv[optind], count, window)
+                          : client_run(argc - optind, argv + optind);
+
+    client_detach();
+    return (ret == 0) ? 0 : 1;
+}
@@ -0,0 +1,311 @@
+/******************************************************************************
+ * @file    pty_bench.c
+ * @brief   End-to-end keystroke latency benchmark of the CLI on Linux.
+ *          Runs the cli binary on a pseudo terminal, types scripted keys and
+ *          timestamps the bytes that come back, as an operator would see them:
+ *          typing at the end of line, arrow keys, an insert and a backspace in
+ *          the middle of the line, history recall and Enter. Then the CLI is
+ *          left idle to measure the CPU time its polling loop takes.
+ *
+ *          pty_bench [-n rounds] [-q quiet_ms] [-i idle_s] [cli [args ...]]
+ *
+ *          -n  Rounds of the script (default 100)
+ *          -q  Output is complete when nothing comes for this long (default 5)
+ *          -i  Seconds to stay idle for the CPU usage (default 2)
+ *
+ *          "first" is the time from a key to the first byte of its response,
+ *          the echo. "done" is the time to the last byte, e.g. a redraw, and
+ *          for Enter the time to the next prompt.
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Private defines ---------------------------------------------------------*/
+#define KEY_TIMEOUT_MS      1000        // A key without response is counted as lost
+#define SAMPLE_MAX          8192        // Samples kept of each kind
+
+/** Private types -----------------------------------------------------------*/
+typedef struct
+{
+    const char *Name;                   //!< Kind of key
+    unsigned int Num;                   //!< Samples taken
+    unsigned int Lost;                  //!< Keys without response
+    unsigned long long First[SAMPLE_MAX]; //!< Key to first byte in ns
+    unsigned long long Done[SAMPLE_MAX];  //!< Key to last byte in ns
+} Stat_TypeDef;
+
+enum
+{
+    KEY_TYPE,
+    KEY_ARROW,
+    KEY_INSERT,
+    KEY_BACKSPACE,
+    KEY_HISTORY,
+    KEY_ENTER,
+    KEY_KINDS
+};
+
+/** Variables ---------------------------------------------------------------*/
+static Stat_TypeDef Stat[KEY_KINDS] = {
+    [KEY_TYPE] = { "type" },
+    [KEY_ARROW] = { "arrow" },
+    [KEY_INSERT] = { "insert" },
+    [KEY_BACKSPACE] = { "backspace" },
+    [KEY_HISTORY] = { "history" },
+    [KEY_ENTER] = { "enter" },
+};
+static int Master = -1;                 // Master side of the terminal
+static unsigned int QuietMs = 5;
+
+/** Functions ---------------------------------------------------------------*/
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *) a;
+    unsigned long long y = *(const unsigned long long *) b;
+    return (x > y) - (x < y);
+}
+
+/*!@brief Read what the CLI sends until it's quiet, or until the prompt after
+ *        a command line.
+ *
+ * @param first     Time of the first byte, 0 if none came
+ * @param prompt    Wait for the prompt at the end of output
+ * @return          Time of the last byte, 0 if none came.
+ */
+static unsigned long long drain(unsigned long long *first, int prompt)
+{
+    char buf[4096];
+    char tail = 0;
+    unsigned long long last = 0;
+    int wait = KEY_TIMEOUT_MS;
+
+    *first = 0;
+    for (;;)
+    {
+        struct pollfd pfd = { Master, POLLIN, 0 };
+        if (poll(&pfd, 1, wait) <= 0)
+        {
+            // Quiet, but a command still has to end with the prompt.
+            if (!prompt || (tail == '>') || (last == 0))
+            {
+                return last;
+            }
+            wait = KEY_TIMEOUT_MS;
+            prompt = 0;
+            continue;
+        }
+
+        int len = read(Master, buf, sizeof(buf));
+        if (len <= 0)
+        {
+            return last;
+        }
+        last = now_ns();
+        if (*first == 0)
+        {
+            *first = last;
+        }
+
+        // The prompt is the last byte a command sends.
+        tail = buf[len - 1];
+        wait = (prompt && (tail != '>')) ? KEY_TIMEOUT_MS : QuietMs;
+    }
+}
+
+/*!@brief Send a key and time the response.
+ */
+static void key(int kind, const char *seq)
+{
+    Stat_TypeDef *st = &Stat[kind];
+    unsigned long long first;
+
+    unsigned long long start = now_ns();
+    if (write(Master, seq, strlen(seq)) < 0)
+    {
+        return;
+    }
+    unsigned long long done = drain(&first, kind == KEY_ENTER);
+
+    if (done == 0)
+    {
+        st->Lost++;
+        return;
+    }
+    if (st->Num < SAMPLE_MAX)
+    {
+        st->First[st->Num] = first - start;
+        st->Done[st->Num] = done - start;
+        st->Num++;
+    }
+}
+
+/*!@brief One round of the script.
+ */
+static void script(void)
+{
+    // "versiXon", then fix it in the middle of the line and run it.
+    for (const char *c = "versiXon"; *c != 0; c++)
+    {
+        char seq[2] = { *c, 0 };
+        key(KEY_TYPE, seq);
+    }
+    key(KEY_ARROW, "\e[D");
+    key(KEY_ARROW, "\e[D");
+    key(KEY_BACKSPACE, "\x7F");
+    key(KEY_INSERT, "_");
+    key(KEY_BACKSPACE, "\x7F");
+    key(KEY_ARROW, "\e[C");
+    key(KEY_ARROW, "\e[C");
+    key(KEY_ENTER, "\r");
+
+    // Recall it from history and run it again.
+    key(KEY_HISTORY, "\e[A");
+    key(KEY_ENTER, "\r");
+}
+
+/*!@brief CPU time of a process in clock ticks, from /proc.
+ */
+static long proc_cpu(pid_t pid)
+{
+    char path[64];
+    char buf[1024];
+    long utime = 0;
+    long stime = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        return -1;
+    }
+    int len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[(len > 0) ? len : 0] = 0;
+
+    // Fields after the command name, which may hold spaces: state is the 3rd,
+    // utime & stime are the 14th & 15th.
+    char *p = strrchr(buf, ')');
+    if ((p == NULL) || (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %ld %ld",
+                               &utime, &stime) != 2))
+    {
+        return -1;
+    }
+    return utime + stime;
+}
+
+static void report(Stat_TypeDef *st)
+{
+    if (st->Num == 0)
+    {
+        printf("%-10s no samples, %u lost\n", st->Name, st->Lost);
+        return;
+    }
+
+    qsort(st->First, st->Num, sizeof(st->First[0]), cmp_u64);
+    qsort(st->Done, st->Num, sizeof(st->Done[0]), cmp_u64);
+    for (int i = 0; i < 2; i++)
+    {
+        unsigned long long *lat = i ? st->Done : st->First;
+        printf("%-10s %-6s %7u %9.1f %9.1f %9.1f %9.1f %9.1f %5u\n", i ? "" : st->Name,
+               i ? "done" : "first", st->Num, lat[0] / 1e3, lat[st->Num / 2] / 1e3,
+               lat[st->Num * 9 / 10] / 1e3, lat[st->Num * 99 / 100] / 1e3,
+               lat[st->Num - 1] / 1e3, st->Lost);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int rounds = 100;
+    unsigned int idle = 2;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "+n:q:i:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            rounds = strtoul(optarg, NULL, 0);
+            break;
+        case 'q':
+            QuietMs = strtoul(optarg, NULL, 0);
+            break;
+        case 'i':
+            idle = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n rounds] [-q quiet_ms] [-i idle_s] [cli [args ...]]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    char *def[] = { "./cli", NULL };
+    char **cmd = (optind < argc) ? &argv[optind] : def;
+    struct winsize ws = { 24, 80, 0, 0 };
+
+    pid_t pid = forkpty(&Master, NULL, NULL, &ws);
+    if (pid < 0)
+    {
+        perror("forkpty");
+        return 1;
+    }
+    if (pid == 0)
+    {
+        execv(cmd[0], cmd);
+        perror(cmd[0]);
+        _exit(127);
+    }
+
+    // Banner
+    unsigned long long first;
+    if (drain(&first, 0) == 0)
+    {
+        fprintf(stderr, "no output from %s\n", cmd[0]);
+        kill(pid, SIGTERM);
+        return 1;
+    }
+
+    for (unsigned int i = 0; i < rounds; i++)
+    {
+        script();
+    }
+
+    long hz = sysconf(_SC_CLK_TCK);
+    long cpu = proc_cpu(pid);
+    unsigned long long start = now_ns();
+    sleep(idle);
+    double sec = (now_ns() - start) / 1e9;
+    cpu = proc_cpu(pid) - cpu;
+
+    printf("Key        Time   Samples   min us    p50 us    p90 us    p99 us    max us  Lost\n");
+    printf("-----------------------------------------------------------------------------------\n");
+    for (int k = 0; k < KEY_KINDS; k++)
+    {
+        report(&Stat[k]);
+    }
+    printf("Idle CPU   = %.2f%% over %.1f s (%ld ticks at %ld Hz)\n", cpu * 100.0 / hz / sec, sec,
+           cpu, hz);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return 0;
+}
@@ -0,0 +1,186 @@
+/******************************************************************************
+ * @file    rx_sim.c
+ * @brief   Simulation of a UART fed input ring (cli_rx.c) on Linux.
+ *          A producer thread plays the receive interrupt or DMA callback and
+ *          pushes a pseudo random byte stream at a given baud rate, while the
+ *          main thread plays the CLI task and drains the ring once per poll
+ *          period. Every byte is checked, the run fails if any byte is lost.
+ *
+ *          rx_sim [-r baud] [-t seconds] [-p poll_us] [-b block]
+ *
+ *          -r  Line rate in baud, 10 bits per byte, 0 to push as fast as
+ *              possible (default 4000000)
+ *          -p  Poll period of the consumer in us (default 1000, as main.c)
+ *          -b  Bytes per push, 1 uses cli_port_isr_putc() like a receive
+ *              interrupt, more uses cli_port_isr_write() like DMA (default 1)
+ *
+ *          The ring has to hold the bytes that arrive during the longest gap
+ *          between two polls of the consumer. A desktop scheduler can hold a
+ *          thread off for many ms, so "make rxsim" builds with a larger ring
+ *          than the MCU default, the maximum gap seen is reported.
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cli.h"
+
+/** Variables ---------------------------------------------------------------*/
+static unsigned long Baud = 4000000;
+static unsigned int Seconds = 2;
+static unsigned int PollUs = 1000;
+static unsigned int Block = 1;
+static volatile int Done = 0;
+static unsigned long long Sent = 0;
+
+/** Functions ---------------------------------------------------------------*/
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*!@brief The byte at a position of the stream, the same on both sides.
+ */
+static uint8_t stream_byte(unsigned long long pos)
+{
+    uint32_t x = (uint32_t) pos * 2654435761u;
+    return (uint8_t) ((x >> 24) ^ (pos >> 8));
+}
+
+/*!@brief Producer, pushes the bytes that are due since the start.
+ */
+static void *producer(void *arg)
+{
+    unsigned long long start = now_ns();
+    unsigned long long end = start + Seconds * 1000000000ull;
+    char buf[4096];
+
+    for (unsigned long long now = start; now < end; now = now_ns())
+    {
+        unsigned long long due = (Baud == 0) ? Sent + Block
+                                             : (now - start) * (Baud / 10) / 1000000000ull;
+
+        while (Sent + Block <= due)
+        {
+            if (Block == 1)
+            {
+                cli_port_isr_putc(stream_byte(Sent));
+            }
+            else
+            {
+                for (unsigned int i = 0; i < Block; i++)
+                {
+                    buf[i] = stream_byte(Sent + i);
+                }
+                cli_port_isr_write(buf, Block);
+            }
+            Sent += Block;
+        }
+
+        // Bytes arrive in bursts between wake ups, like a FIFO or DMA
+        // interrupt, and the CPU is left to the consumer meanwhile.
+        if (Baud != 0)
+        {
+            usleep(50);
+        }
+    }
+
+    __atomic_store_n(&Done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:t:p:b:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            Baud = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            Seconds = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            PollUs = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            Block = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r baud] [-t seconds] [-p poll_us] [-b block]\n", argv[0]);
+            return 2;
+        }
+    }
+    if ((Block == 0) || (Block > 4096))
+    {
+        Block = 1;
+    }
+
+    pthread_t thread;
+    unsigned long long start = now_ns();
+    pthread_create(&thread, NULL, producer, NULL);
+
+    // Consumer, skips the stream ahead by the bytes the producer dropped so
+    // loss shows up in the overflow counter rather than as corrupt data.
+    unsigned long long recv = 0;
+    unsigned long long bad = 0;
+    unsigned int lost = 0;
+    unsigned int polls = 0;
+    unsigned long long last = start;
+    unsigned long long gap = 0;
+    int done = 0;
+
+    while (!done)
+    {
+        done = __atomic_load_n(&Done, __ATOMIC_ACQUIRE);
+
+        unsigned long long now = now_ns();
+        gap = (now - last > gap) ? now - last : gap;
+        last = now;
+
+        int c;
+        while ((c = cli_rx_getc()) != EOF)
+        {
+            if (c != stream_byte(recv + lost))
+            {
+                lost = cli_rx_overflow();
+                bad += (c != stream_byte(recv + lost));
+            }
+            recv++;
+        }
+        polls++;
+
+        if (PollUs > 0)
+        {
+            usleep(PollUs);
+        }
+    }
+    pthread_join(thread, NULL);
+
+    double sec = (now_ns() - start) / 1e9;
+    lost = cli_rx_overflow();
+    printf("Rate     = %.2f Mbaud (%llu bytes in %.2f s)\n", Sent * 10 / sec / 1e6, Sent, sec);
+    printf("Ring     = %u bytes, block = %u, poll = %u us (%u polls)\n",
+           (unsigned int) CLI_RX_BUF_SIZE, Block, PollUs, polls);
+    printf("Max gap  = %.2f ms between polls, %.0f bytes at this rate\n", gap / 1e6,
+           gap / 1e9 * Sent / sec);
+    printf("Received = %llu\n", recv);
+    printf("Overflow = %u\n", lost);
+    printf("Corrupt  = %llu\n", bad);
+
+    int pass = (recv == Sent) && (bad == 0);
+    printf("%s\n", pass ? "PASS: no byte lost" : "FAIL");
+    return pass ? 0 : 1;
+}
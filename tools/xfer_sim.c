@@ -0,0 +1,233 @@
+/******************************************************************************
+ * @file    xfer_sim.c
+ * @brief   Loopback simulation of the windowed file transfer of cli_xfer.c.
+ *          A host and a device end run in one thread over two simulated
+ *          serial links, each paced to a baud rate with a delay of one poll.
+ *          The file is a pattern that the receiver checks as it's written.
+ *
+ *          xfer_sim [-s bytes] [-r baud] [-e every] [-d]
+ *
+ *          -s  File size (default 1048576)
+ *          -r  Link rate in baud, 10 bits a byte, 0 for no pacing (default 921600)
+ *          -e  Corrupt one byte of every this many on both links (default 0, none)
+ *          -d  The device sends, the host receives (default host sends)
+ *
+ *          It reports the time, the throughput & the share of the link rate
+ *          the payload takes, and the blocks resent & bad frames.
+ *
+ * @author  Nick Yang
+ * @date    2018/11/01
+ * @version V1.0
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cli.h"
+
+/** Private defines ---------------------------------------------------------*/
+#define LINK_SIZE           (1 << 20)   // Bytes a link may hold in flight
+#define POLL_US             1000        // Time between two polls of each end
+
+/** Private types -----------------------------------------------------------*/
+typedef struct
+{
+    unsigned char Buf[LINK_SIZE];       //!< Bytes in flight
+    unsigned int Head;                  //!< Bytes written
+    unsigned int Tail;                  //!< Bytes delivered
+    unsigned long long Sent;            //!< Bytes written in total
+    unsigned long long Count;           //!< Bytes since the last error
+} Link_TypeDef;
+
+/** Variables ---------------------------------------------------------------*/
+static Link_TypeDef Link[2];            // 0 host to device, 1 device to host
+static unsigned int FileSize = 1048576;
+static unsigned int Baud = 921600;
+static unsigned int ErrEvery = 0;
+static unsigned int Received = 0;       // Bytes the receiver has checked
+static unsigned int Mismatch = 0;       // Bytes not matching the pattern
+static int Committed = 0;               // The receiver has committed the file
+
+/** Functions ---------------------------------------------------------------*/
+static unsigned long long now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+/*!@brief Time in ms for cli_xfer.c, the CLI port is not linked.
+ */
+unsigned int cli_gettick(void)
+{
+    return now_us() / 1000;
+}
+
+static unsigned char pattern(unsigned int offset)
+{
+    return (offset * 7 + (offset >> 8)) & 0xFF;
+}
+
+static int link_send(void *arg, const unsigned char *buf, int len)
+{
+    Link_TypeDef *link = arg;
+
+    for (int i = 0; i < len; i++)
+    {
+        if (link->Head - link->Tail >= LINK_SIZE)
+        {
+            // Overrun, like a receiver that doesn't keep up.
+            return i;
+        }
+        unsigned char c = buf[i];
+        if (ErrEvery && (++link->Count >= ErrEvery))
+        {
+            c ^= 0x5A;
+            link->Count = 0;
+        }
+        link->Buf[link->Head++ % LINK_SIZE] = c;
+    }
+    link->Sent += len;
+    return len;
+}
+
+/*!@brief Deliver what the link carries in elapsed us.
+ */
+static void link_deliver(Link_TypeDef *link, CliXfer_TypeDef *x, unsigned long long us)
+{
+    unsigned int len = link->Head - link->Tail;
+
+    if (Baud != 0)
+    {
+        unsigned long long max = us * Baud / 10 / 1000000;
+        len = (len > max) ? max : len;
+    }
+    while (len > 0)
+    {
+        unsigned int pos = link->Tail % LINK_SIZE;
+        unsigned int n = (pos + len > LINK_SIZE) ? LINK_SIZE - pos : len;
+        cli_xfer_input(x, &link->Buf[pos], n);
+        link->Tail += n;
+        len -= n;
+    }
+}
+
+static int file_read(unsigned int offset, unsigned char *buf, int len)
+{
+    if (offset >= FileSize)
+    {
+        return 0;
+    }
+    len = (offset + len > FileSize) ? FileSize - offset : len;
+    for (int i = 0; i < len; i++)
+    {
+        buf[i] = pattern(offset + i);
+    }
+    return len;
+}
+
+static int file_write(unsigned int offset, const unsigned char *buf, int len)
+{
+    if (buf == NULL)
+    {
+        Committed = (offset == FileSize);
+        return Committed ? 0 : -1;
+    }
+    if (offset != Received)
+    {
+        return -1;
+    }
+    for (int i = 0; i < len; i++)
+    {
+        Mismatch += buf[i] != pattern(offset + i);
+    }
+    Received += len;
+    return len;
+}
+
+int main(int argc, char *argv[])
+{
+    static CliXfer_TypeDef end[2];     // 0 host, 1 device
+    int sender = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:r:e:d")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            FileSize = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            Baud = strtoul(optarg, NULL, 0);
+            break;
+        case 'e':
+            ErrEvery = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            sender = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s bytes] [-r baud] [-e every] [-d]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    CliXfer_TypeDef *tx = &end[sender];
+    CliXfer_TypeDef *rx = &end[!sender];
+    end[0].Send = link_send;
+    end[0].Arg = &Link[0];
+    end[1].Send = link_send;
+    end[1].Arg = &Link[1];
+    tx->Read = file_read;
+    rx->Write = file_write;
+    cli_xfer_start(tx, CLI_XFER_TX);
+    cli_xfer_start(rx, CLI_XFER_RX);
+
+    unsigned long long start = now_us();
+    unsigned long long last = start;
+    unsigned long long done = 0;
+    int ret[2] = { CLI_PENDING, CLI_PENDING };
+    while ((ret[0] == CLI_PENDING) || (ret[1] == CLI_PENDING))
+    {
+        if (Baud != 0)
+        {
+            usleep(POLL_US);
+        }
+        unsigned long long now = now_us();
+        link_deliver(&Link[0], &end[1], now - last);
+        link_deliver(&Link[1], &end[0], now - last);
+        last = now;
+        for (int i = 0; i < 2; i++)
+        {
+            if (ret[i] == CLI_PENDING)
+            {
+                ret[i] = cli_xfer_step(&end[i]);
+            }
+        }
+        // The file is through when the sender has DONE, the receiver lingers.
+        if ((done == 0) && (ret[sender] != CLI_PENDING))
+        {
+            done = now_us();
+        }
+    }
+    double sec = (done - start) / 1e6;
+
+    int ok = (ret[0] == 0) && (ret[1] == 0) && Committed && (Received == FileSize) && (Mismatch == 0);
+    printf("Direction= %s\n", sender ? "device to host" : "host to device");
+    printf("Block    = %u bytes, window %u\n", (unsigned int) CLI_XFER_BLOCK,
+           (unsigned int) CLI_XFER_WINDOW);
+    printf("File     = %u bytes, %u received, %u mismatched\n", FileSize, Received, Mismatch);
+    printf("Time     = %.3f s, %.1f KB/s", sec, FileSize / sec / 1024);
+    if (Baud != 0)
+    {
+        printf(", %.1f%% of %u baud", FileSize * 10.0 / sec / Baud * 100, Baud);
+    }
+    printf("\n");
+    printf("Link     = %llu bytes sent, %llu returned\n", Link[sender].Sent, Link[!sender].Sent);
+    printf("Resent   = %u blocks, %u bad frames\n", tx->Resent, rx->Errors + tx->Errors);
+    printf("Result   = %s\n", ok ? "OK" : "FAIL");
+    return ok ? 0 : 1;
+}